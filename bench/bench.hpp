@@ -0,0 +1,58 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+#pragma once
+
+#include <esp_log.h>
+#include <nvs_flash.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "wifi_provisioning.hpp"
+
+// 基准程序共用的辅助函数。每个基准是一个独立的应用程序，由 platformio.ini 中对应的
+// bench-* 环境（或 idf.py -DAPP_SRC_DIR=bench/<名称>）构建，不需要修改 IDF 示例。
+namespace bench
+{
+    static const char *TAG = "BENCH";
+
+    // 与 IDF 示例相同地初始化 NVS，基准程序使用示例配网时保存的凭据
+    inline void init_nvs()
+    {
+        esp_err_t err = nvs_flash_init();
+        if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
+        {
+            ESP_ERROR_CHECK(nvs_flash_erase());
+            err = nvs_flash_init();
+        }
+        ESP_ERROR_CHECK(err);
+    }
+
+    // 用保存的凭据连接并等待结果，设备需要先用 IDF 示例完成配网
+    inline bool connect(esp32_wifi_util::wifi_provisioning& wp, int timeout_ms = 30000)
+    {
+        auto result = wp.auto_connect_async();
+        result.cancel_after(timeout_ms);
+
+        if (!result.wait() || result.get() != esp32_wifi_util::wifi_status::CONNECTED)
+        {
+            ESP_LOGE(TAG, "连接失败, 请先用 IDF 示例完成配网");
+            return false;
+        }
+
+        return true;
+    }
+
+    // 基准结束后保持运行，以便在串口监视器中查看结果
+    inline void idle()
+    {
+        ESP_LOGI(TAG, "基准结束");
+        for (;;)
+            vTaskDelay(portMAX_DELAY);
+    }
+}
@@ -0,0 +1,66 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+// 回调分配基准：比较 std::function 与库中的回调类型（inplace_function）保存同一个回调时的
+// 堆使用，以及扫描回调中按值复制扫描结果（旧接口传递 std::vector<wifi_network>）与通过
+// std::span 直接访问库内部结果的堆使用。扫描不需要保存的凭据。
+//
+// 构建并运行：pio run -e bench-callback-alloc -t upload -t monitor
+
+#include <functional>
+#include <vector>
+
+#include <esp_system.h>
+
+#include "../bench.hpp"
+
+using namespace esp32_wifi_util;
+
+static const char *TAG = "BENCH_CALLBACK_ALLOC";
+
+// 超过 std::function 内部缓冲区大小、但不超过 CALLBACK_CAPACITY 的捕获
+struct context
+{
+    void* owner;
+    int retries;
+    int timeout_ms;
+    int flags;
+    int reserved;
+};
+
+extern "C" void app_main()
+{
+    bench::init_nvs();
+
+    context ctx = {};
+
+    auto before = esp_get_free_heap_size();
+    {
+        std::function<void(wifi_status, std::string)> cb = [ctx](wifi_status, std::string) { (void)ctx; };
+        ESP_LOGI(TAG, "std::function 回调: %u 字节", (unsigned)(before - esp_get_free_heap_size()));
+    }
+
+    before = esp_get_free_heap_size();
+    {
+        connect_callback_t cb = [ctx](wifi_status, std::string_view) { (void)ctx; };
+        ESP_LOGI(TAG, "connect_callback_t 回调: %u 字节", (unsigned)(before - esp_get_free_heap_size()));
+    }
+
+    // 回调在控制任务中执行，wp 在 bench::idle() 中一直存活
+    wifi_provisioning wp;
+    wp.scan_networks([](std::span<const wifi_network> networks)
+    {
+        auto before = esp_get_free_heap_size();
+        std::vector<wifi_network> copy(networks.begin(), networks.end());
+        auto copied = before - esp_get_free_heap_size();
+
+        ESP_LOGI(TAG, "扫描到 %d 个网络, 复制列表: %u 字节, span: 0 字节",
+            (int)networks.size(), (unsigned)copied);
+    });
+
+    bench::idle();
+}
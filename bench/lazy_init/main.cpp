@@ -0,0 +1,58 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+// 分阶段延迟初始化基准：测量构造 wifi_provisioning 的耗时和堆占用（只创建控制任务），确认
+// 构造后网络协议栈和驱动尚未初始化，再测量第一次连接时才进行的驱动初始化（INIT 阶段）的
+// 耗时和堆占用，以及连接成功后的空闲堆。改为延迟初始化之前，INIT 阶段的开销和热点接口都在
+// 构造函数中支付，与是否需要联网无关。
+//
+// 构建并运行：pio run -e bench-lazy-init -t upload -t monitor
+
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "../bench.hpp"
+
+using namespace esp32_wifi_util;
+
+static const char *TAG = "BENCH_LAZY_INIT";
+
+extern "C" void app_main()
+{
+    bench::init_nvs();
+
+    auto boot_heap = esp_get_free_heap_size();
+    auto start = esp_timer_get_time();
+
+    wifi_provisioning wp;
+
+    auto construct_us = esp_timer_get_time() - start;
+    ESP_LOGI(TAG, "构造: %d us, 堆 %u 字节", (int)construct_us,
+        (unsigned)(boot_heap - esp_get_free_heap_size()));
+
+    if (wp.get_memory_usage(provisioning_phase::INIT).recorded)
+        ESP_LOGW(TAG, "构造后驱动已经初始化");
+    else
+        ESP_LOGI(TAG, "构造后驱动尚未初始化");
+
+    start = esp_timer_get_time();
+    if (!bench::connect(wp))
+        bench::idle();
+
+    auto connect_ms = (esp_timer_get_time() - start) / 1000;
+
+    auto init = wp.get_memory_usage(provisioning_phase::INIT);
+    auto history = wp.get_connect_history();
+    int init_us = history.empty() ? 0 : history.back().init_us;
+
+    ESP_LOGI(TAG, "第一次连接时的驱动初始化: %d us, 堆 %u 字节", init_us,
+        (unsigned)(init.free_before > init.free_after ? init.free_before - init.free_after : 0));
+    ESP_LOGI(TAG, "连接耗时 %d ms, 连接后空闲堆 %u 字节 (启动时 %u 字节)", (int)connect_ms,
+        (unsigned)esp_get_free_heap_size(), (unsigned)boot_heap);
+
+    bench::idle();
+}
@@ -0,0 +1,81 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+// link_profile 基准：连接后依次切换各个 link_profile，ping 网关测量往返时延和丢包，
+// 评估省电模式（modem sleep 和 listen_interval）对延迟的影响。
+// 设备内部的回环不经过射频，看不出省电模式的代价，因此测量的是到网关的第一跳。
+//
+// 构建并运行：pio run -e bench-link-profile -t upload -t monitor
+
+#include <unistd.h>
+
+#include "../bench.hpp"
+
+using namespace esp32_wifi_util;
+
+static const char *TAG = "BENCH_LINK_PROFILE";
+
+// 每个模式 ping 网关的次数和间隔
+static const int RTT_COUNT = 50;
+static const int RTT_INTERVAL_MS = 200;
+
+// LOW_POWER 模式使用的 listen_interval
+static const uint16_t LOW_POWER_LISTEN_INTERVAL = 3;
+
+static bool run_profile(wifi_provisioning& wp, link_profile profile, const char* name)
+{
+    wp.set_link_profile(profile, LOW_POWER_LISTEN_INTERVAL);
+
+    // listen_interval 只在关联时协商，重新连接后 LOW_POWER 模式才完整生效
+    if (profile == link_profile::LOW_POWER && !bench::connect(wp))
+        return false;
+
+    // 等待省电模式切换稳定
+    usleep(1000000);
+
+    link_rtt_stats stats;
+    if (!wp.measure_link_rtt(stats, RTT_COUNT, RTT_INTERVAL_MS))
+    {
+        ESP_LOGE(TAG, "%s 测量失败", name);
+        return false;
+    }
+
+    ESP_LOGI(TAG, "%-12s RTT min/avg/max: %u/%u/%u ms, 丢包: %d/%d", name,
+        (unsigned)stats.min_ms, (unsigned)stats.avg_ms, (unsigned)stats.max_ms,
+        stats.sent - stats.received, stats.sent);
+
+    return true;
+}
+
+extern "C" void app_main()
+{
+    bench::init_nvs();
+
+    wifi_provisioning wp;
+    if (!bench::connect(wp))
+        bench::idle();
+
+    const struct
+    {
+        link_profile profile;
+        const char* name;
+    } profiles[] = {
+        { link_profile::LOW_LATENCY, "low-latency" },
+        { link_profile::BALANCED, "balanced" },
+        { link_profile::LOW_POWER, "low-power" },
+    };
+
+    for (const auto& p : profiles)
+    {
+        if (!run_profile(wp, p.profile, p.name))
+            break;
+    }
+
+    wp.set_link_profile(link_profile::BALANCED);
+
+    bench::idle();
+}
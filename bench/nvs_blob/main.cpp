@@ -0,0 +1,188 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+// NVS 凭据存储基准：在独立的命名空间中分别按旧布局（ssid、password 两个字符串键）和新布局
+// （一个带 CRC 的 blob）反复读写同一份凭据，比较每次读取和写入（含 nvs_commit）的平均耗时，
+// 两种方式都包含 nvs_open/nvs_close。最后用库实际连接一次，输出 auto_connect 读取配置的耗时
+// （wifi_connect_record::load_us）和库的 NVS 统计。基准使用的命名空间在结束前擦除。
+//
+// 构建并运行：pio run -e bench-nvs-blob -t upload -t monitor
+
+#include <stddef.h>
+#include <string.h>
+
+#include <esp_crc.h>
+#include <esp_timer.h>
+#include <nvs.h>
+
+#include "../bench.hpp"
+#include "scoped_exit.hpp"
+
+using namespace esp32_wifi_util;
+
+static const char *TAG = "BENCH_NVS_BLOB";
+static const char *BENCH_NAMESPACE = "wp_bench";
+
+static const int READ_ITERATIONS = 200;
+
+// 写入会消耗 flash 擦写次数，次数少一些；两个密码交替写入，避免 NVS 跳过内容相同的写入
+static const int WRITE_ITERATIONS = 20;
+
+static const char *BENCH_SSID = "bench-network-ssid";
+static const char *BENCH_PASSWORDS[2] = { "bench-password-0123456789", "bench-password-9876543210" };
+
+// 与库中 stored_credentials 的布局相同
+struct credentials_blob
+{
+    uint8_t version;
+    uint8_t channel;
+    uint8_t reserved[2];
+    char ssid[33];
+    char password[65];
+    uint32_t crc;
+};
+
+// 旧布局：先查询长度再读取，与改用 blob 之前的读取方式相同
+static bool legacy_read()
+{
+    nvs_handle_t handle;
+    if (nvs_open(BENCH_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    scoped_exit close_exit([&]
+        { nvs_close(handle); });
+
+    char ssid[33];
+    char password[65];
+    size_t len = 0;
+
+    if (nvs_get_str(handle, "ssid", nullptr, &len) != ESP_OK || len > sizeof(ssid) ||
+        nvs_get_str(handle, "ssid", ssid, &len) != ESP_OK)
+        return false;
+
+    len = 0;
+    if (nvs_get_str(handle, "password", nullptr, &len) != ESP_OK || len > sizeof(password) ||
+        nvs_get_str(handle, "password", password, &len) != ESP_OK)
+        return false;
+
+    return true;
+}
+
+static bool legacy_write(const char* password)
+{
+    nvs_handle_t handle;
+    if (nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return false;
+
+    scoped_exit close_exit([&]
+        { nvs_close(handle); });
+
+    return nvs_set_str(handle, "ssid", BENCH_SSID) == ESP_OK &&
+        nvs_set_str(handle, "password", password) == ESP_OK &&
+        nvs_commit(handle) == ESP_OK;
+}
+
+// 新布局：一次 nvs_get_blob，并与库一样校验 CRC
+static bool blob_read()
+{
+    nvs_handle_t handle;
+    if (nvs_open(BENCH_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    scoped_exit close_exit([&]
+        { nvs_close(handle); });
+
+    credentials_blob cred;
+    size_t len = sizeof(cred);
+    if (nvs_get_blob(handle, "cred", &cred, &len) != ESP_OK || len != sizeof(cred))
+        return false;
+
+    return cred.crc == esp_crc32_le(0, (const uint8_t *)&cred, offsetof(credentials_blob, crc));
+}
+
+static bool blob_write(const char* password)
+{
+    credentials_blob cred;
+    memset(&cred, 0, sizeof(cred));
+    cred.version = 1;
+    strcpy(cred.ssid, BENCH_SSID);
+    strcpy(cred.password, password);
+    cred.crc = esp_crc32_le(0, (const uint8_t *)&cred, offsetof(credentials_blob, crc));
+
+    nvs_handle_t handle;
+    if (nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return false;
+
+    scoped_exit close_exit([&]
+        { nvs_close(handle); });
+
+    return nvs_set_blob(handle, "cred", &cred, sizeof(cred)) == ESP_OK &&
+        nvs_commit(handle) == ESP_OK;
+}
+
+// 重复执行 op，返回平均耗时（微秒），失败时返回 -1
+template <typename F>
+static int64_t average_us(int iterations, F&& op)
+{
+    auto start = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (!op(i))
+            return -1;
+    }
+
+    return (esp_timer_get_time() - start) / iterations;
+}
+
+static void erase_bench_namespace()
+{
+    nvs_handle_t handle;
+    if (nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+
+    nvs_erase_all(handle);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+extern "C" void app_main()
+{
+    bench::init_nvs();
+
+    if (!legacy_write(BENCH_PASSWORDS[0]) || !blob_write(BENCH_PASSWORDS[0]))
+    {
+        ESP_LOGE(TAG, "写入基准数据失败");
+        bench::idle();
+    }
+
+    auto legacy_read_us = average_us(READ_ITERATIONS, [](int) { return legacy_read(); });
+    auto blob_read_us = average_us(READ_ITERATIONS, [](int) { return blob_read(); });
+    auto legacy_write_us = average_us(WRITE_ITERATIONS, [](int i) { return legacy_write(BENCH_PASSWORDS[i % 2]); });
+    auto blob_write_us = average_us(WRITE_ITERATIONS, [](int i) { return blob_write(BENCH_PASSWORDS[i % 2]); });
+
+    erase_bench_namespace();
+
+    ESP_LOGI(TAG, "读取 avg: 字符串键 %d us, blob %d us (%d 次)",
+        (int)legacy_read_us, (int)blob_read_us, READ_ITERATIONS);
+    ESP_LOGI(TAG, "写入 avg: 字符串键 %d us, blob %d us (%d 次, 含 nvs_commit)",
+        (int)legacy_write_us, (int)blob_write_us, WRITE_ITERATIONS);
+
+    // 库在启动后第一次 auto_connect 时的实际读取耗时
+    wifi_provisioning wp;
+    if (bench::connect(wp))
+    {
+        auto history = wp.get_connect_history();
+        if (!history.empty())
+            ESP_LOGI(TAG, "auto_connect 读取配置耗时: %d us", (int)history.back().load_us);
+
+        auto stats = wp.get_nvs_stats();
+        ESP_LOGI(TAG, "库的 NVS 统计: 读取 %d 次共 %d us, 写入 %d 次共 %d us, 跳过 %d 次",
+            stats.reads, (int)stats.read_us, stats.writes, (int)stats.write_us, stats.skipped_writes);
+    }
+
+    bench::idle();
+}
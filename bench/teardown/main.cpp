@@ -0,0 +1,62 @@
+//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+// 释放检查基准：反复构造 wifi_provisioning、连接、以 FULL 模式停止并析构，每轮结束后检查
+// 空闲堆是否回到构造前的水平。差值超过 TEARDOWN_HEAP_BOUND 时认为存在泄漏并中止。
+// 连接失败（设备尚未配网）时驱动同样已经初始化，检查照常进行。
+//
+// 构建并运行：pio run -e bench-teardown -t upload -t monitor
+
+#include <stdlib.h>
+
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_system.h>
+
+#include "../bench.hpp"
+
+using namespace esp32_wifi_util;
+
+static const char *TAG = "BENCH_TEARDOWN";
+
+// 以 FULL 模式释放后允许的堆差值
+static const uint32_t TEARDOWN_HEAP_BOUND = 2048;
+
+// 多轮运行，区分一次性的分配和每轮累积的泄漏
+static const int CYCLES = 5;
+
+extern "C" void app_main()
+{
+    bench::init_nvs();
+
+    // 网络协议栈和默认事件循环是系统级资源，先于基准创建，库不会释放它们
+    esp_netif_init();
+    esp_event_loop_create_default();
+
+    auto baseline = esp_get_free_heap_size();
+
+    for (int i = 0; i < CYCLES; i++)
+    {
+        auto wp = new wifi_provisioning;
+        bench::connect(*wp);
+
+        wp->stop(teardown_mode::FULL);
+        delete wp;
+
+        auto heap = esp_get_free_heap_size();
+        ESP_LOGI(TAG, "第 %d 轮: 构造前空闲堆 %u, 释放后空闲堆 %u", i + 1,
+            (unsigned)baseline, (unsigned)heap);
+
+        if (heap + TEARDOWN_HEAP_BOUND < baseline)
+        {
+            ESP_LOGE(TAG, "释放后未能回收的堆超过 %u 字节", (unsigned)TEARDOWN_HEAP_BOUND);
+            abort();
+        }
+    }
+
+    bench::idle();
+}
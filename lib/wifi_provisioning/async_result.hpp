@@ -0,0 +1,311 @@
+﻿//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+#ifndef INCLUDE__2026_10_18__ASYNC_RESULT_HPP
+#define INCLUDE__2026_10_18__ASYNC_RESULT_HPP
+
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "inplace_function.hpp"
+
+
+// 异步操作的状态
+enum class async_status
+{
+	PENDING,            // 尚未完成
+	READY,              // 成功完成
+	FAILED,             // 操作失败
+	CANCELLED,          // 被 cancel 取消
+	TIMED_OUT           // 超过 cancel_after 设置的时间
+};
+
+namespace async_detail
+{
+	// 共享状态中与结果类型无关的部分。状态只会从 PENDING 变化一次，之后的完成或取消都被忽略。
+	class state_base
+	{
+	public:
+		using callback_t = inplace_function<void(), 32>;
+
+		virtual ~state_base() = default;
+
+		async_status status() const
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_status;
+		}
+
+		bool wait(int timeout_ms)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			auto done = [this] { return m_status != async_status::PENDING; };
+
+			if (timeout_ms < 0)
+			{
+				m_cv.wait(lock, done);
+				return true;
+			}
+
+			return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+		}
+
+		// 设置取消时调用的函数，用于中止底层操作。设置了 canceller 时由底层操作在自己的任务中结束状态，
+		// cancel 只记录取消的原因，之后以任何状态结束时都改为该原因。
+		void set_canceller(callback_t canceller)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_canceller = std::move(canceller);
+		}
+
+		// 设置完成时调用的函数，已经完成时返回 false 且不保存
+		bool set_continuation(callback_t continuation)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_status != async_status::PENDING)
+				return false;
+
+			m_continuation = std::move(continuation);
+			return true;
+		}
+
+		// 结束操作，返回 false 表示之前已经结束。continuation 在调用者所在的任务中执行。
+		bool finish(async_status status)
+		{
+			callback_t continuation;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_status != async_status::PENDING)
+					return false;
+
+				continuation = settle_locked(status);
+			}
+
+			notify(continuation);
+			return true;
+		}
+
+		// 取消操作。先中止底层操作，由它结束状态，continuation 因而在底层操作所在的任务中执行；
+		// 没有 canceller 时直接在当前任务中结束。
+		bool cancel(async_status status)
+		{
+			callback_t canceller;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_status != async_status::PENDING || m_cancel_status != async_status::PENDING)
+					return false;
+
+				m_cancel_status = status;
+				canceller = std::move(m_canceller);
+				m_canceller = nullptr;
+			}
+
+			if (canceller)
+				canceller();
+			else
+				finish(status);
+
+			return true;
+		}
+
+	protected:
+		// 以下两个函数供派生类在设置结果的同时结束操作，settle_locked 需要持有 m_mutex
+		callback_t settle_locked(async_status status)
+		{
+			m_status = m_cancel_status != async_status::PENDING ? m_cancel_status : status;
+			m_canceller = nullptr;
+
+			auto continuation = std::move(m_continuation);
+			m_continuation = nullptr;
+
+			return continuation;
+		}
+
+		void notify(callback_t& continuation)
+		{
+			m_cv.notify_all();
+
+			if (continuation)
+				continuation();
+		}
+
+		mutable std::mutex m_mutex;
+		async_status m_status = async_status::PENDING;
+		async_status m_cancel_status = async_status::PENDING;   // 已经请求取消时为取消的原因
+
+	private:
+		std::condition_variable m_cv;
+		callback_t m_continuation;
+		callback_t m_canceller;
+	};
+
+	template <typename T>
+	class state : public state_base
+	{
+	public:
+		explicit state(T fallback)
+			: m_value(std::move(fallback))
+		{}
+
+		// 设置结果并以 READY 结束，已经结束时丢弃
+		void complete(T value)
+		{
+			callback_t continuation;
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (m_status != async_status::PENDING)
+					return;
+
+				// 已经请求取消时以取消的原因结束，保留默认值
+				if (m_cancel_status == async_status::PENDING)
+					m_value = std::move(value);
+				continuation = settle_locked(async_status::READY);
+			}
+
+			notify(continuation);
+		}
+
+		// 只能在结束之后读取
+		const T& value() const
+		{
+			return m_value;
+		}
+
+	private:
+		T m_value;
+	};
+
+	// 在 timeout_ms 毫秒后以 TIMED_OUT 取消，由库的实现文件提供
+	void cancel_after(std::shared_ptr<state_base> state, int timeout_ms);
+}
+
+// 异步操作的结果句柄，复制句柄共享同一个结果。
+//
+// 可以阻塞等待（wait），也可以注册完成回调（then），或者在协程中 co_await。操作结束后，FAILED、
+// CANCELLED 或 TIMED_OUT 时 get 返回创建时给定的默认值，例如连接失败时为 wifi_status::FAILED。
+// 完成回调和 co_await 之后的代码在结束该操作的任务中执行。库提供的操作总是在 Wi-Fi 控制任务中结束，
+// 包括被 cancel 取消和 cancel_after 超时的情况，因此其中不能执行长时间阻塞的操作；协程组合的操作在
+// 执行 co_return 的任务中结束。
+//
+// 返回 async_result<T> 的函数本身也可以是协程，协程 co_return 的值成为结果，从而可以把多个异步
+// 操作组合为一个。协程帧在堆上分配。
+template <typename T>
+class async_result
+{
+	using state_t = async_detail::state<T>;
+
+public:
+	struct promise_type
+	{
+		std::shared_ptr<state_t> m_state = std::make_shared<state_t>(T{});
+
+		async_result get_return_object() noexcept
+		{
+			return async_result(m_state);
+		}
+
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+
+		void return_value(T value)
+		{
+			m_state->complete(std::move(value));
+		}
+
+		void unhandled_exception() noexcept
+		{
+			std::terminate();
+		}
+	};
+
+	async_result() = default;
+
+	explicit async_result(std::shared_ptr<state_t> state)
+		: m_state(std::move(state))
+	{}
+
+	inline explicit operator bool() const noexcept
+	{
+		return m_state != nullptr;
+	}
+
+	async_status status() const
+	{
+		return m_state->status();
+	}
+
+	bool ready() const
+	{
+		return status() != async_status::PENDING;
+	}
+
+	// 等待操作结束，timeout_ms 为负数时一直等待，超时返回 false（操作仍在进行）
+	bool wait(int timeout_ms = -1) const
+	{
+		return m_state->wait(timeout_ms);
+	}
+
+	// 等待操作结束并返回结果
+	const T& get() const
+	{
+		m_state->wait(-1);
+		return m_state->value();
+	}
+
+	// 取消操作并中止底层的连接、扫描或配网会话，已经结束时没有效果
+	void cancel()
+	{
+		m_state->cancel(async_status::CANCELLED);
+	}
+
+	// timeout_ms 毫秒后仍未结束时以 TIMED_OUT 取消，返回自身以便链式调用
+	async_result& cancel_after(int timeout_ms)
+	{
+		async_detail::cancel_after(m_state, timeout_ms);
+		return *this;
+	}
+
+	// 操作结束时调用 f()，已经结束时立即在当前任务中调用。只能设置一次，f 捕获的数据不能超过 32 字节。
+	template <typename F>
+	void then(F&& f)
+	{
+		async_detail::state_base::callback_t continuation(std::forward<F>(f));
+
+		if (!m_state->set_continuation(continuation))
+			continuation();
+	}
+
+	// 协程支持
+	bool await_ready() const
+	{
+		return ready();
+	}
+
+	bool await_suspend(std::coroutine_handle<> handle)
+	{
+		return m_state->set_continuation([handle] { handle.resume(); });
+	}
+
+	const T& await_resume() const
+	{
+		return m_state->value();
+	}
+
+private:
+	std::shared_ptr<state_t> m_state;
+};
+
+#endif // INCLUDE__2026_10_18__ASYNC_RESULT_HPP
@@ -0,0 +1,165 @@
+﻿//
+// Copyright (C) 2019 Jack.
+//
+// Author: jack
+// Email:  jack.wgm at gmail dot com
+//
+
+#ifndef INCLUDE__2025_05_06__INPLACE_FUNCTION_HPP
+#define INCLUDE__2025_05_06__INPLACE_FUNCTION_HPP
+
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+// 与 std::function 类似的可调用对象包装，但可调用对象总是保存在内部固定大小的缓冲区中，
+// 构造、复制和调用都不会分配堆内存。可调用对象超过 Capacity 时编译失败。
+template <typename Signature, std::size_t Capacity = 32>
+class inplace_function;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class inplace_function<R(Args...), Capacity>
+{
+	struct vtable
+	{
+		R (*invoke)(void* obj, Args&&... args);
+		void (*copy)(void* dst, const void* src);
+		void (*move)(void* dst, void* src);
+		void (*destroy)(void* obj);
+	};
+
+	template <typename F>
+	static const vtable* vtable_for()
+	{
+		static const vtable vt = {
+			[](void* obj, Args&&... args) -> R
+			{
+				return (*static_cast<F*>(obj))(std::forward<Args>(args)...);
+			},
+			[](void* dst, const void* src)
+			{
+				::new (dst) F(*static_cast<const F*>(src));
+			},
+			[](void* dst, void* src)
+			{
+				::new (dst) F(std::move(*static_cast<F*>(src)));
+				static_cast<F*>(src)->~F();
+			},
+			[](void* obj)
+			{
+				static_cast<F*>(obj)->~F();
+			}
+		};
+
+		return &vt;
+	}
+
+public:
+	inplace_function() noexcept = default;
+
+	inplace_function(std::nullptr_t) noexcept
+	{}
+
+	template <typename F, typename D = std::decay_t<F>,
+		typename = std::enable_if_t<!std::is_same_v<D, inplace_function> &&
+			std::is_invocable_r_v<R, D&, Args...>>>
+	inplace_function(F&& f)
+	{
+		static_assert(sizeof(D) <= Capacity, "callable is too large for inplace_function");
+		static_assert(alignof(D) <= alignof(std::max_align_t), "callable is over-aligned for inplace_function");
+		static_assert(std::is_copy_constructible_v<D>, "callable must be copy constructible");
+
+		::new (static_cast<void*>(m_storage)) D(std::forward<F>(f));
+		m_vtable = vtable_for<D>();
+	}
+
+	inplace_function(const inplace_function& other)
+		: m_vtable(other.m_vtable)
+	{
+		if (m_vtable)
+			m_vtable->copy(m_storage, other.m_storage);
+	}
+
+	inplace_function(inplace_function&& other) noexcept
+		: m_vtable(other.m_vtable)
+	{
+		if (m_vtable)
+		{
+			m_vtable->move(m_storage, other.m_storage);
+			other.m_vtable = nullptr;
+		}
+	}
+
+	~inplace_function()
+	{
+		reset();
+	}
+
+	inplace_function& operator=(const inplace_function& other)
+	{
+		if (this != &other)
+		{
+			reset();
+
+			if (other.m_vtable)
+			{
+				other.m_vtable->copy(m_storage, other.m_storage);
+				m_vtable = other.m_vtable;
+			}
+		}
+
+		return *this;
+	}
+
+	inplace_function& operator=(inplace_function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+
+			if (other.m_vtable)
+			{
+				other.m_vtable->move(m_storage, other.m_storage);
+				m_vtable = other.m_vtable;
+				other.m_vtable = nullptr;
+			}
+		}
+
+		return *this;
+	}
+
+	inplace_function& operator=(std::nullptr_t) noexcept
+	{
+		reset();
+		return *this;
+	}
+
+	inline void reset() noexcept
+	{
+		if (m_vtable)
+		{
+			m_vtable->destroy(m_storage);
+			m_vtable = nullptr;
+		}
+	}
+
+	inline explicit operator bool() const noexcept
+	{
+		return m_vtable != nullptr;
+	}
+
+	// 调用空的 inplace_function 是未定义行为，调用前需要先检查
+	inline R operator()(Args... args) const
+	{
+		return m_vtable->invoke(const_cast<unsigned char*>(m_storage), std::forward<Args>(args)...);
+	}
+
+private:
+	alignas(std::max_align_t) unsigned char m_storage[Capacity];
+	const vtable* m_vtable = nullptr;
+};
+
+#endif // INCLUDE__2025_05_06__INPLACE_FUNCTION_HPP
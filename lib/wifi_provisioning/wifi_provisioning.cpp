@@ -8,676 +8,5798 @@
 #include "wifi_provisioning.hpp"
 #include "scoped_exit.hpp"
 
+#include <algorithm>
 #include <atomic>
+#include <mutex>
+#include <type_traits>
 #include <vector>
 
+#include <stddef.h>
+#include <ctype.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 
 #include <esp_log.h>
+#include <esp_attr.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_netif.h>
 #include <esp_timer.h>
 #include <esp_mac.h>
+#include <esp_crc.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
+#if WIFI_PROVISIONING_ASSETS
+#include <esp_partition.h>
+#endif
+#if WIFI_PROVISIONING_OTA
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#endif
 
 #include <esp_http_server.h>
 #include <cJSON.h> // 引入 cJSON 库
+#include <mbedtls/pkcs5.h>
+
+#include "ping/ping_sock.h"
 
 
 #include <nvs_flash.h>
 
-#include "freertos/event_groups.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
 
 
 namespace esp32_wifi_util
 {
-    static const int WIFI_DONE_BIT = BIT0;
-    static const int WIFI_FAIL_BIT = BIT1;
+    // 保留的连接尝试记录条数
+    static const int CONNECT_HISTORY_SIZE = 8;
+
+    // 控制任务参数
+    static const int CONTROL_QUEUE_SIZE = 16;
+    static const int CONTROL_TASK_STACK_SIZE = 6144;
+    static const int CONTROL_TASK_PRIORITY = 5;
+
+    // 从 esp_event 任务传给控制任务的驱动事件缓冲区大小，必须是 2 的幂
+    static const uint32_t EVENT_RING_SIZE = 16;
+
+    // 提交命令到控制任务队列的最长等待时间
+    static const int SUBMIT_TIMEOUT_MS = 1000;
+
+    // 连接和扫描的超时时间，超时后命令以失败结束
+    static const int64_t CONNECT_TIMEOUT_US = 20 * 1000 * 1000;
+    static const int64_t SCAN_TIMEOUT_US = 15 * 1000 * 1000;
+
+    // /wl 返回缓存的扫描结果，超过该时间的缓存会在后台刷新
+    static const int64_t SCAN_CACHE_US = 10 * 1000 * 1000;
+
+    // 提交凭据时用于检查网络是否存在的扫描结果的最长有效期
+    static const int64_t SCAN_VALIDATE_MAX_AGE_US = 5 * 60 * 1000 * 1000LL;
+
+    // 漫游扫描的最小间隔，避免信号持续较弱时反复扫描
+    static const int64_t ROAM_SCAN_INTERVAL_US = 60 * 1000 * 1000;
+
+    // 自动选择热点信道时每个信道的主动扫描时间
+    static const uint32_t AP_CHANNEL_SCAN_MS = 50;
+
+    // 信道评分：同一信道上每个 AP 的占用分，以及 1/6/11 以外的信道的附加分（这些信道与两侧的小区都重叠）。
+    // 干扰分按 AP 信号高于 -100 dBm 的 dB 数乘以重叠程度（同信道为 5，每相隔一个信道减 1）计算。
+    static const int AP_CHANNEL_OCCUPANCY_SCORE = 100;
+    static const int AP_CHANNEL_NONSTANDARD_SCORE = 150;
+
+    // 关闭热点时如果还有未完成的扫描或命令，推迟这么久再试
+    static const int64_t AP_SHUTDOWN_RETRY_US = 1000 * 1000;
+
+    // DNS 任务检查退出标志的间隔
+#if WIFI_PROVISIONING_DNS
+    static const int DNS_RECV_TIMEOUT_MS = 500;
+#endif
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+    // 联网检测的应答，预先生成完整的 HTTP 响应，收到探测时一次发送。
+    // 配网成功前重定向到配置页面；配网成功且 STA 已连接后返回各系统期望的“已联网”响应，
+    // 让客户端停止反复探测。
+#define CAPTIVE_APPLE_SUCCESS_BODY "<HTML><HEAD><TITLE>Success</TITLE></HEAD><BODY>Success</BODY></HTML>"
+#define CAPTIVE_MSFT_CONNECT_BODY "Microsoft Connect Test"
+#define CAPTIVE_MSFT_NCSI_BODY "Microsoft NCSI"
+#define CAPTIVE_NM_ONLINE_BODY "NetworkManager is online\n"
+#define CAPTIVE_FIREFOX_SUCCESS_BODY "success\n"
+
+    static const char CAPTIVE_REDIRECT[] =
+        "HTTP/1.1 302 Found\r\n"
+        "Location: http://192.168.4.1/webconfig\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+
+    static const char CAPTIVE_NO_CONTENT[] =
+        "HTTP/1.1 204 No Content\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+
+    static const char CAPTIVE_APPLE_SUCCESS[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/html\r\n"
+        "Content-Length: 68\r\n"
+        "Connection: close\r\n\r\n"
+        CAPTIVE_APPLE_SUCCESS_BODY;
+
+    static const char CAPTIVE_MSFT_CONNECT[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 22\r\n"
+        "Connection: close\r\n\r\n"
+        CAPTIVE_MSFT_CONNECT_BODY;
+
+    static const char CAPTIVE_MSFT_NCSI[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 14\r\n"
+        "Connection: close\r\n\r\n"
+        CAPTIVE_MSFT_NCSI_BODY;
+
+    static const char CAPTIVE_NM_ONLINE[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 25\r\n"
+        "Connection: close\r\n\r\n"
+        CAPTIVE_NM_ONLINE_BODY;
+
+    static const char CAPTIVE_FIREFOX_SUCCESS[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: 8\r\n"
+        "Connection: close\r\n\r\n"
+        CAPTIVE_FIREFOX_SUCCESS_BODY;
+
+    static_assert(sizeof(CAPTIVE_APPLE_SUCCESS_BODY) - 1 == 68, "Content-Length mismatch");
+    static_assert(sizeof(CAPTIVE_MSFT_CONNECT_BODY) - 1 == 22, "Content-Length mismatch");
+    static_assert(sizeof(CAPTIVE_MSFT_NCSI_BODY) - 1 == 14, "Content-Length mismatch");
+    static_assert(sizeof(CAPTIVE_NM_ONLINE_BODY) - 1 == 25, "Content-Length mismatch");
+    static_assert(sizeof(CAPTIVE_FIREFOX_SUCCESS_BODY) - 1 == 8, "Content-Length mismatch");
+
+    struct captive_probe
+    {
+        const char* uri;
+        const char* success;    // 配网成功后的响应
+        size_t success_size;
+    };
+
+#define CAPTIVE_PROBE(uri, response) { uri, response, sizeof(response) - 1 }
+
+    static const captive_probe captive_probes[] = {
+        CAPTIVE_PROBE("/hotspot-detect.html", CAPTIVE_APPLE_SUCCESS),           // Apple
+        CAPTIVE_PROBE("/library/test/success.html", CAPTIVE_APPLE_SUCCESS),     // Apple
+        CAPTIVE_PROBE("/generate_204", CAPTIVE_NO_CONTENT),                     // Android
+        CAPTIVE_PROBE("/mobile/status.php", CAPTIVE_NO_CONTENT),                // Android
+        CAPTIVE_PROBE("/connecttest.txt", CAPTIVE_MSFT_CONNECT),                // Windows
+        CAPTIVE_PROBE("/ncsi.txt", CAPTIVE_MSFT_NCSI),                          // Windows
+        CAPTIVE_PROBE("/redirect", CAPTIVE_NO_CONTENT),                         // Windows
+        CAPTIVE_PROBE("/fwlink/", CAPTIVE_NO_CONTENT),                          // Microsoft
+        CAPTIVE_PROBE("/check_network_status.txt", CAPTIVE_NM_ONLINE),          // NetworkManager
+        CAPTIVE_PROBE("/connectivity-check.html", CAPTIVE_NO_CONTENT),          // Ubuntu
+        CAPTIVE_PROBE("/success.txt", CAPTIVE_FIREFOX_SUCCESS),                 // Firefox
+        CAPTIVE_PROBE("/portal.html", CAPTIVE_NO_CONTENT),                      // Various
+    };
+
+#undef CAPTIVE_PROBE
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+    // mDNS 组播地址（主机字节序）和端口，任务检查退出标志和接口地址变化的间隔
+    static const uint32_t MDNS_GROUP = 0xe00000fb;     // 224.0.0.251
+    static const uint16_t MDNS_PORT = 5353;
+    static const int MDNS_RECV_TIMEOUT_MS = 500;
+
+    // RFC 6762 建议的 TTL，主机名相关记录 120 秒，其它记录 75 分钟
+    static const uint32_t MDNS_HOST_TTL = 120;
+    static const uint32_t MDNS_SERVICE_TTL = 4500;
+
+    // 传统单播查询（源端口不是 5353）应答中的最大 TTL，RFC 6762 6.7 要求不超过 10 秒
+    static const uint32_t MDNS_LEGACY_TTL = 10;
+
+    // options.txt 的总长度上限（含每项的长度字节），保证服务应答报文不超过一个以太网帧
+    static const size_t MDNS_TXT_MAX_SIZE = 768;
+
+    // 热点 DHCP 服务器分配地址的子网掩码，用于判断查询来自哪个接口
+    static const uint32_t AP_NETMASK = 0xffffff00;
+#endif
+
+#if WIFI_PROVISIONING_OTA
+    // OTA 每次接收和写入的块大小，接收和写入各占一个缓冲区
+    static const size_t OTA_BUFFER_SIZE = 4096;
+    static const int OTA_TASK_STACK_SIZE = 3072;
+    static const int OTA_TASK_PRIORITY = 5;
+
+    // 接收固件时连续超时的重试次数，以及升级成功后重启前等待响应发出的时间
+    static const int OTA_RECV_RETRIES = 5;
+    static const int OTA_REBOOT_DELAY_MS = 500;
+
+    // 交给认证函数的 Authorization 请求头的最大长度
+    static const size_t OTA_AUTH_HEADER_SIZE = 256;
+#endif
+
+    // /wb 请求体和请求 id 的最大长度
+    static const size_t BATCH_BODY_SIZE = 512;
+    static const size_t BATCH_ID_MAX_LEN = 64;
+
+    // 接收 /wb 请求体时连续超时的重试次数，客户端停止发送时不能一直占用 httpd 任务
+    static const int BATCH_RECV_RETRIES = 5;
+
+    // 记录内存使用的阶段数，与 provisioning_phase 对应
+    static const int PHASE_COUNT = (int)provisioning_phase::CONNECT + 1;
 
     static const char *TAG = "WIFI_PROVISIONING";
     static const char *wifi_settings = "wifi_settings";
+    static const char *credentials_key = "cred";
 
-    //////////////// Wi-Fi 事件处理函数 ////////////////
+    // NVS 中保存的 Wi-Fi 配置，作为一个 blob 整体读写，不会出现只更新了一半的情况。
+    // 修改布局时需要增加 CREDENTIALS_VERSION。
+    static const uint8_t CREDENTIALS_VERSION = 1;
 
-    void Wifi_Event_Handler(void* event_handler_arg,
-        esp_event_base_t event_base, int32_t event_id, void* event_data);
+    struct stored_credentials
+    {
+        uint8_t version;
+        uint8_t channel;        // 上次连接成功时 AP 所在的信道，0 表示未知
+        uint8_t reserved[2];
+        char ssid[33];          // 以 '\0' 结尾
+        char password[65];      // 以 '\0' 结尾
+        uint32_t crc;           // 以上所有字节的 CRC32
+    };
 
-    //////////////// Wi-Fi 配置类 ////////////////
+    // 深度睡眠期间保存在 RTC 慢速内存中的连接记录，resume_connect 用它跳过 NVS 读取和全信道扫描。
+    // RTC_DATA_ATTR 变量在上电和普通复位时重新初始化，只在深度睡眠唤醒时保留，magic 和 CRC
+    // 用于识别未初始化或被破坏的记录。修改布局时需要增加 RESUME_RECORD_VERSION。
+    static const uint32_t RESUME_RECORD_MAGIC = 0x57505253;    // "WPRS"
+    static const uint8_t RESUME_RECORD_VERSION = 2;
 
-    class wifi_provisioning_impl
+    // 记录保存后多久之内直接复用其中的 IP 地址租约，超过后仍然使用记录中的 AP，但重新 DHCP
+    static const int64_t RESUME_LEASE_MAX_AGE_S = 30 * 60;
+
+    // 后台计算 PSK 的任务，优先级低于控制任务和应用任务
+    static const int PSK_TASK_STACK_SIZE = 3072;
+    static const int PSK_TASK_PRIORITY = 1;
+
+    struct resume_record
     {
-        wifi_provisioning_impl(const wifi_provisioning_impl &) = delete;
-        wifi_provisioning_impl &operator=(const wifi_provisioning_impl &) = delete;
+        uint32_t magic;
+        uint8_t version;
+        uint8_t channel;
+        uint8_t bssid[6];
+        char ssid[33];          // 以 '\0' 结尾
+        char secret[65];        // 预先计算的 PSK（64 个十六进制字符），不适用或尚未算出时为空，此时从 NVS 读取密码
+        uint8_t reserved[2];
+        uint32_t password_crc;  // 计算 PSK 所用密码的 CRC32，密码未变化时沿用 PSK
+        int64_t saved_at;       // 保存时刻，gettimeofday 的秒数，深度睡眠期间由 RTC 继续计时
+        uint32_t ip;            // 以下为网络字节序的 IP 地址租约，ip 为 0 表示没有
+        uint32_t netmask;
+        uint32_t gw;
+        uint32_t dns;
+        uint32_t crc;           // 以上所有字节的 CRC32
+    };
 
-        friend void Wifi_Event_Handler(void* event_handler_arg,
-            esp_event_base_t event_base, int32_t event_id, void* event_data);
+    static RTC_DATA_ATTR resume_record rtc_resume_record;
 
-    public:
-        wifi_provisioning_impl()
-        {
-            m_wifi_event_group = xEventGroupCreate();
+    // 库内部投递给控制任务的事件
+    static const char *SUPERVISOR_EVENT = "SUPERVISOR_EVENT";
 
-            // 初始化网络协议栈
-            ESP_ERROR_CHECK(esp_netif_init());
-            ESP_ERROR_CHECK(esp_event_loop_create_default());
+    enum
+    {
+        SUPERVISOR_EVENT_PING_SUCCESS,
+        SUPERVISOR_EVENT_PING_TIMEOUT,
+        SUPERVISOR_EVENT_RTT_END
+    };
 
-            esp_netif_create_default_wifi_sta();
-            esp_netif_create_default_wifi_ap();
+    //////////////// Wi-Fi 配置存储 ////////////////
 
-            // 初始化 Wi-Fi
-            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    static uint32_t credentials_crc(const stored_credentials& cred)
+    {
+        return esp_crc32_le(0, (const uint8_t *)&cred, offsetof(stored_credentials, crc));
+    }
 
-            ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    static uint32_t resume_record_crc(const resume_record& rec)
+    {
+        return esp_crc32_le(0, (const uint8_t *)&rec, offsetof(resume_record, crc));
+    }
 
-            reset_event_handler();
+    static bool load_resume_record(resume_record& rec)
+    {
+        rec = rtc_resume_record;
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
-        }
+        return rec.magic == RESUME_RECORD_MAGIC && rec.version == RESUME_RECORD_VERSION &&
+            rec.crc == resume_record_crc(rec) && rec.ssid[0] &&
+            memchr(rec.ssid, 0, sizeof(rec.ssid)) && memchr(rec.secret, 0, sizeof(rec.secret));
+    }
+
+    // WPA/WPA2-PSK 的 PSK 由密码和 SSID 经过 4096 轮 PBKDF2-HMAC-SHA1 得到，驱动每次连接时都要重新计算。
+    // 以 64 个十六进制字符作为密码时驱动直接使用该 PSK，省去这一步。
+    static bool derive_psk(const std::string& ssid, const std::string& password, char hex[65])
+    {
+        if (password.size() < 8 || password.size() > 63)
+            return false;
+
+        auto info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA1);
+
+        mbedtls_md_context_t ctx;
+        mbedtls_md_init(&ctx);
+        scoped_exit ctx_exit([&]
+            { mbedtls_md_free(&ctx); });
+
+        uint8_t psk[32];
+        if (!info || mbedtls_md_setup(&ctx, info, 1) != 0 ||
+            mbedtls_pkcs5_pbkdf2_hmac(&ctx, (const unsigned char *)password.data(), password.size(),
+                (const unsigned char *)ssid.data(), ssid.size(), 4096, sizeof(psk), psk) != 0)
+            return false;
+
+        for (size_t i = 0; i < sizeof(psk); i++)
+            sprintf(hex + i * 2, "%02x", psk[i]);
 
-        ~wifi_provisioning_impl() = default;
+        return true;
+    }
+
+    static bool make_credentials(stored_credentials& cred,
+        const std::string& ssid, const std::string& password, uint8_t channel)
+    {
+        if (ssid.empty() || ssid.size() >= sizeof(cred.ssid) || password.size() >= sizeof(cred.password))
+            return false;
+
+        // 填充字节也参与 CRC 计算，必须先清零
+        memset(&cred, 0, sizeof(cred));
+        cred.version = CREDENTIALS_VERSION;
+        cred.channel = channel;
+        memcpy(cred.ssid, ssid.data(), ssid.size());
+        memcpy(cred.password, password.data(), password.size());
 
+        return true;
+    }
+
+    // NVS 中 Wi-Fi 配置的读写层。缓存已保存的记录，只有内容变化时才写入 flash，
+    // 一次 update 中修改的多个字段合并为一次 nvs_set_blob 和 nvs_commit。
+    // httpd 任务和控制任务都会访问，内部使用互斥锁保护。
+    class credential_store
+    {
     public:
-        void auto_connect(connect_callback_t connect_cb)
+        // 读取 Wi-Fi 配置，首次读取后使用缓存
+        bool load(stored_credentials& cred)
         {
-            ESP_LOGI(TAG, "开始自动连接 Wi-Fi ...");
+            std::lock_guard<std::mutex> lock(m_mutex);
 
-            m_retry_count = 0;
-            m_connect_cb = connect_cb;
+            if (!m_loaded)
+                load_locked();
 
-            // 使用 scoped_exit 确保返回时回调失败。
-            scoped_exit failed_exit([&]
-                                    { call_connect_cb(wifi_status::FAILED, m_ssid); });
+            if (!m_valid)
+                return false;
 
-            std::string ap_password;
+            cred = m_cached;
+            return true;
+        }
 
-            // 首先从 NVS 中读取 Wi-Fi 的 SSID 和密码，如果读取成功，则直接连接。
-            nvs_handle_t nvs_handle;
-            auto err = nvs_open(wifi_settings, NVS_READONLY, &nvs_handle);
-            if (err == ESP_OK)
-            {
-                // 使用 scoped_exit 来确保 nvs_close 能够被调用。
-                scoped_exit e([&]
-                              { nvs_close(nvs_handle); });
+        // 在当前记录的副本上调用 modify 修改字段，modify 返回 false 时放弃修改。
+        // 修改后的内容与已保存的记录相同时跳过写入。
+        template <typename F>
+        bool update(F&& modify)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
 
-                size_t len = 0;
-                char buf[64] = {0};
-                err = nvs_get_str(nvs_handle, "ssid", nullptr, &len);
-                if (err != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "NVS 获取 SSID 长度失败, 开始配网");
-                    return;
-                }
+            if (!m_loaded)
+                load_locked();
 
-                err = nvs_get_str(nvs_handle, "ssid", buf, &len);
-                if (err == ESP_OK)
-                {
-                    m_ssid = buf;
-                }
-                else
-                {
-                    ESP_LOGE(TAG, "NVS 获取 SSID 长度失败, 开始配网");
-                    return;
-                }
+            stored_credentials cred;
+            if (m_valid)
+                cred = m_cached;
+            else
+                memset(&cred, 0, sizeof(cred));
 
-                len = 0;
+            if (!modify(cred))
+                return false;
 
-                err = nvs_get_str(nvs_handle, "password", nullptr, &len);
-                if (err != ESP_OK)
-                {
-                    ESP_LOGE(TAG, "NVS 获取密码长度失败, 开始配网");
-                    return;
-                }
+            cred.version = CREDENTIALS_VERSION;
+            cred.crc = credentials_crc(cred);
 
-                memset(&buf[0], 0, sizeof(buf));
-                err = nvs_get_str(nvs_handle, "password", buf, &len);
-                if (err == ESP_OK)
-                {
-                    ap_password = buf;
-                }
-                else
-                {
-                    ESP_LOGW(TAG, "NVS get password empty, start provisioning");
-                }
-            }
-            else
+            if (m_valid && memcmp(&cred, &m_cached, sizeof(cred)) == 0)
             {
-                ESP_LOGI(TAG, "NVS open failed, start provisioning");
-                return;
+                m_stats.skipped_writes++;
+                ESP_LOGI(TAG, "Wi-Fi 配置未变化, 跳过写入");
+                return true;
             }
 
-            // 连接到 Wi-Fi
-            if (!m_ssid.empty())
+            if (!write_locked(cred))
+                return false;
+
+            m_cached = cred;
+            m_valid = true;
+
+            return true;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            nvs_handle_t nvs_handle;
+            auto err = nvs_open(wifi_settings, NVS_READWRITE, &nvs_handle);
+            if (err == ESP_OK)
             {
-                if (connect_wifi(m_ssid, ap_password))
-                {
-                    // 取消失败回调
-                    failed_exit.cancel();
+                auto start = esp_timer_get_time();
 
-                    // 回调成功
-                    call_connect_cb(wifi_status::CONNECTED, m_ssid);
-                    return;
-                }
+                nvs_erase_all(nvs_handle);
+                nvs_commit(nvs_handle);
+                nvs_close(nvs_handle);
+
+                record_write(esp_timer_get_time() - start);
+
+                // 下次读取时重新从 NVS 加载
+                m_loaded = false;
+                m_valid = false;
+
+                ESP_LOGI(TAG, "Wi-Fi 配置已清除");
+                return;
             }
+
+            m_stats.failures++;
+            ESP_LOGW(TAG, "Wi-Fi 清除配置时 nvs 打开失败, ERROR: %d", err);
         }
 
-        bool start_config_server(std::string ap_ssid, std::string ap_password, int port)
+        wifi_nvs_stats stats() const
         {
-            // 创建 Wi-Fi 热点
-            if (!create_ap(ap_ssid, ap_password))
-                return false;
-
-            // 启动 DNS 服务器
-            start_dns();
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_stats;
+        }
 
-            // 创建 HTTP 服务器
-            httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-            config.server_port = port;
-            config.max_uri_handlers = 24;
-            config.max_resp_headers = 24;
-            config.uri_match_fn = httpd_uri_match_wildcard;
+    private:
+        void load_locked()
+        {
+            m_loaded = true;
+            m_valid = read_blob(m_cached) || migrate(m_cached);
+        }
 
-            if (httpd_start(&m_httpd_server, &config) == ESP_OK)
+        // 正常情况下只需要一次 nvs_get_blob
+        bool read_blob(stored_credentials& cred)
+        {
+            nvs_handle_t nvs_handle;
+            auto err = nvs_open(wifi_settings, NVS_READONLY, &nvs_handle);
+            if (err != ESP_OK)
             {
-                // 注册 URI 处理程序
-                httpd_uri_t http_test = {
-                    .uri = "/test",
-                    .method = HTTP_GET, // 处理 GET 请求
-                    .handler = [](httpd_req_t *req) -> esp_err_t
-                    {
-                        auto self = (wifi_provisioning_impl*)req->user_ctx;
-                        return self->http_test_handler(req);
-                    },
-                    .user_ctx = (void *)this // 用户上下文（可选）
-                };
-                httpd_register_uri_handler(m_httpd_server, &http_test);
+                ESP_LOGI(TAG, "NVS open failed, ERROR: %d", err);
+                return false;
+            }
 
-                httpd_uri_t http_wifi_list = {
-                    .uri = "/wl",
-                    .method = HTTP_GET,
-                    .handler = [](httpd_req_t *req) -> esp_err_t
-                    {
-                        auto self = (wifi_provisioning_impl*)req->user_ctx;
-                        return self->http_wifi_list_handler(req);
-                    },
-                    .user_ctx = (void *)this // 用户上下文（可选）
-                };
-                httpd_register_uri_handler(m_httpd_server, &http_wifi_list);
+            // 使用 scoped_exit 来确保 nvs_close 能够被调用。
+            scoped_exit e([&]
+                          { nvs_close(nvs_handle); });
 
-                httpd_uri_t http_wifi_config = {
-                    .uri = "/wc",
-                    .method = HTTP_POST,
-                    .handler = [](httpd_req_t *req) -> esp_err_t
-                    {
-                        auto self = (wifi_provisioning_impl*)req->user_ctx;
-                        return self->http_wifi_config_handler(req);
-                    },
-                    .user_ctx = (void *)this // 用户上下文（可选）
-                };
-                httpd_register_uri_handler(m_httpd_server, &http_wifi_config);
+            auto start = esp_timer_get_time();
 
-                httpd_uri_t http_wifi_webconfig = {
-                    .uri = "/webconfig",
-                    .method = HTTP_GET,
-                    .handler = [](httpd_req_t *req) -> esp_err_t
-                    {
-                        auto self = (wifi_provisioning_impl*)req->user_ctx;
-                        return self->http_wifi_web_config_handler(req);
-                    },
-                    .user_ctx = (void *)this // 用户上下文（可选）
-                };
-                httpd_register_uri_handler(m_httpd_server, &http_wifi_webconfig);
-
-                const char* captive_portal_urls[] = {
-                    "/hotspot-detect.html",         // Apple
-                    "/generate_204",                // Android
-                    "/mobile/status.php",           // Android
-                    "/check_network_status.txt",    // Windows
-                    "/ncsi.txt",                    // Windows
-                    "/connecttest.txt",             // Windows
-                    "/redirect",                    // Windows
-                    "/fwlink/",                     // Microsoft
-                    "/connectivity-check.html",     // Firefox
-                    "/success.txt",                 // Various
-                    "/portal.html",                 // Various
-                    "/library/test/success.html"    // Apple
-                };
+            size_t len = sizeof(cred);
+            err = nvs_get_blob(nvs_handle, credentials_key, &cred, &len);
 
-                for (const auto& url : captive_portal_urls)
-                {
-                    httpd_uri_t captive_redirect_uri = {
-                        .uri = url,
-                        .method = HTTP_GET,
-                        .handler = [](httpd_req_t *req) -> esp_err_t
-                        {
-                            auto self = (wifi_provisioning_impl*)req->user_ctx;
-                            return self->captive_redirect_uri_handler(req);
-                        },
-                        .user_ctx = (void *)this // 用户上下文（可选）
-                    };
+            record_read(esp_timer_get_time() - start);
 
-                    httpd_register_uri_handler(m_httpd_server, &captive_redirect_uri);
+            if (err != ESP_OK)
+            {
+                if (err != ESP_ERR_NVS_NOT_FOUND)
+                {
+                    m_stats.failures++;
+                    ESP_LOGW(TAG, "读取 Wi-Fi 配置失败, ERROR: %d", err);
                 }
-
-                ESP_LOGI(TAG, "HTTP server started on port %d", config.server_port);
+                return false;
             }
-            else
+
+            if (len != sizeof(cred) ||
+                cred.version != CREDENTIALS_VERSION ||
+                cred.crc != credentials_crc(cred) ||
+                cred.ssid[0] == '\0' ||
+                cred.ssid[sizeof(cred.ssid) - 1] != '\0' ||
+                cred.password[sizeof(cred.password) - 1] != '\0')
             {
-                ESP_LOGE(TAG, "Failed to start HTTP server");
+                m_stats.failures++;
+                ESP_LOGW(TAG, "NVS 中的 Wi-Fi 配置无效");
+                return false;
             }
 
             return true;
         }
 
-        void scan_networks(scan_callback_t scan_callback)
+        bool read_legacy_string(nvs_handle_t nvs_handle, const char* key, std::string& value)
         {
-            ESP_LOGI(TAG, "开始扫描 Wi-Fi 网络 ...");
+            auto start = esp_timer_get_time();
+            scoped_exit e([&]
+                          { record_read(esp_timer_get_time() - start); });
 
-            m_scan_cb = scan_callback;
-            m_retry_count = 0;
+            size_t len = 0;
+            if (nvs_get_str(nvs_handle, key, nullptr, &len) != ESP_OK || len == 0)
+                return false;
 
-            // 扫描 Wi-Fi
-            if (!m_wifi_start)
-            {
-                ESP_ERROR_CHECK(esp_wifi_start());
-                m_wifi_start = true;
-            }
+            value.resize(len);
+            if (nvs_get_str(nvs_handle, key, &value[0], &len) != ESP_OK)
+                return false;
+
+            value.resize(len - 1);
+            return true;
+        }
+
+        // 找不到配置 blob 时，把旧版本分开保存的 ssid 和 password 转换为配置 blob，并删除旧的键
+        bool migrate(stored_credentials& cred)
+        {
+            nvs_handle_t nvs_handle;
+            if (nvs_open(wifi_settings, NVS_READWRITE, &nvs_handle) != ESP_OK)
+                return false;
+
+            scoped_exit e([&]
+                          { nvs_close(nvs_handle); });
+
+            std::string ssid;
+            std::string password;
 
-            ESP_ERROR_CHECK(esp_wifi_scan_start(nullptr, false));
+            if (!read_legacy_string(nvs_handle, "ssid", ssid))
+                return false;
 
-            scoped_exit stop_wifi_scan([&]
-                                 { esp_wifi_scan_stop(); });
+            if (!read_legacy_string(nvs_handle, "password", password))
+                ESP_LOGW(TAG, "NVS get password empty");
 
-            xEventGroupClearBits(m_wifi_event_group, WIFI_DONE_BIT | WIFI_FAIL_BIT);
-            auto bits = xEventGroupWaitBits(m_wifi_event_group, WIFI_DONE_BIT | WIFI_FAIL_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
-            if (bits & WIFI_FAIL_BIT)
+            if (!make_credentials(cred, ssid, password, 0))
             {
-                ESP_LOGE(TAG, "Wi-Fi 扫描失败");
-                return;
+                ESP_LOGW(TAG, "旧版本的 Wi-Fi 配置无效");
+                return false;
             }
 
-            uint16_t ap_count = 0;
-            ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_count));
-            if (ap_count == 0)
+            cred.crc = credentials_crc(cred);
+
+            ESP_LOGI(TAG, "迁移旧版本的 Wi-Fi 配置");
+
+            auto start = esp_timer_get_time();
+
+            if (nvs_set_blob(nvs_handle, credentials_key, &cred, sizeof(cred)) == ESP_OK)
             {
-                ESP_LOGW(TAG, "没有扫描到 Wi-Fi 网络");
-                return;
+                nvs_erase_key(nvs_handle, "ssid");
+                nvs_erase_key(nvs_handle, "password");
+                nvs_commit(nvs_handle);
             }
 
-            ESP_LOGI(TAG, "扫描到 %d 个 Wi-Fi 网络", ap_count);
-            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
-            if (!ap_records)
+            record_write(esp_timer_get_time() - start);
+
+            return true;
+        }
+
+        bool write_locked(const stored_credentials& cred)
+        {
+            nvs_handle_t nvs_handle;
+            auto err = nvs_open(wifi_settings, NVS_READWRITE, &nvs_handle);
+            if (err != ESP_OK)
             {
-                ESP_LOGE(TAG, "内存分配失败");
-                return;
+                m_stats.failures++;
+                ESP_LOGW(TAG, "保存 Wi-Fi 配置时 nvs 打开失败, ERROR: %d", err);
+                return false;
             }
-            scoped_exit free_ap_records([&]
-                                       { free(ap_records); });
 
-            m_wifi_list.clear();
+            scoped_exit e([&]
+                          { nvs_close(nvs_handle); });
 
-            // 获取扫描到的接入点信息
-            ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_records));
-            for (int i = 0; i < ap_count; i++)
-            {
-                wifi_network net;
+            auto start = esp_timer_get_time();
 
-                net.ssid = (const char *)&ap_records[i].ssid[0];
-                net.rssi = ap_records[i].rssi;
-                net.auth_mode = ap_records[i].authmode;
+            err = nvs_set_blob(nvs_handle, credentials_key, &cred, sizeof(cred));
+            if (err == ESP_OK)
+                err = nvs_commit(nvs_handle);
 
-                m_wifi_list.push_back(net);
+            auto elapsed = esp_timer_get_time() - start;
+            record_write(elapsed);
 
-                ESP_LOGI(TAG, "SSID: %-32.32s RSSI: %d Auth: %d",
-                         ap_records[i].ssid, ap_records[i].rssi, ap_records[i].authmode);
+            if (err != ESP_OK)
+            {
+                m_stats.failures++;
+                ESP_LOGW(TAG, "保存 Wi-Fi 配置失败, ERROR: %d", err);
+                return false;
             }
 
-            // 释放内存
-            free_ap_records();
+            ESP_LOGI(TAG, "保存 Wi-Fi 配置耗时 %d us", (int)elapsed);
 
-            // 停止扫描
-            stop_wifi_scan();
+            return true;
+        }
 
-            // 回调扫描结果
-            call_scan_cb(m_wifi_list);
+        void record_read(int64_t elapsed)
+        {
+            m_stats.reads++;
+            m_stats.read_us += elapsed;
         }
 
-        bool connect_wifi(const std::string& ssid, const std::string& password)
+        void record_write(int64_t elapsed)
         {
-            m_ssid = ssid;
+            m_stats.writes++;
+            m_stats.write_us += elapsed;
+            if (elapsed > m_stats.max_write_us)
+                m_stats.max_write_us = elapsed;
+        }
 
-            // 保存 Wi-Fi 模式
-            m_wifi_mode = WIFI_MODE_STA;
+    private:
+        mutable std::mutex m_mutex;
+        stored_credentials m_cached = {};
+        bool m_loaded = false;
+        bool m_valid = false;
+        wifi_nvs_stats m_stats = {};
+    };
 
-            // 初始化 Wi-Fi
-            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+#if WIFI_PROVISIONING_ASSETS
+    //////////////// 静态资源包 ////////////////
 
-            ESP_ERROR_CHECK(esp_wifi_stop());
-            ESP_ERROR_CHECK(esp_wifi_deinit());
-            ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+    // 配置页面使用的静态资源包，由 tools/pack_webui.py 生成并写入名为 webui 的数据分区。
+    // 文件格式（小端）：
+    //   asset_bundle_header
+    //   uint16_t buckets[bucket_count]     按路径哈希的开放寻址表，值为条目下标，补齐到 4 字节
+    //   asset_entry entries[entry_count]
+    //   以 '\0' 结尾的路径和 MIME 类型，以及文件内容（可预先 gzip 压缩）
+    static const char *ASSET_PARTITION_LABEL = "webui";
+    static const uint16_t ASSET_BUNDLE_VERSION = 1;
+    static const uint16_t ASSET_EMPTY_BUCKET = 0xFFFF;
+    static const uint8_t ASSET_FLAG_GZIP = 0x01;
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    // 从映射的 flash 发送文件时每个分块的大小
+    static const size_t ASSET_CHUNK_SIZE = 4096;
 
-            m_wifi_start = false;
+    struct asset_bundle_header
+    {
+        char magic[4];          // "WPAB"
+        uint16_t version;
+        uint16_t entry_count;
+        uint16_t bucket_count;  // 2 的幂
+        uint16_t reserved;
+        uint32_t total_size;    // 包括文件头在内的总大小
+        uint32_t crc;           // 文件头之后所有字节的 CRC32
+    };
 
-            // 设置 Wi-Fi 配置并连接到 Wi-Fi
-            wifi_config_t wifi_config = {};
-            memset(&wifi_config, 0, sizeof(wifi_config_t));
+    struct asset_entry
+    {
+        uint32_t hash;          // 路径的 FNV-1a 哈希
+        uint32_t path_offset;
+        uint32_t mime_offset;
+        uint32_t data_offset;
+        uint32_t data_size;
+        uint16_t path_len;
+        uint8_t mime_len;
+        uint8_t flags;
+    };
 
-            strcpy((char *)wifi_config.sta.ssid, ssid.c_str());
-            strcpy((char *)wifi_config.sta.password, password.c_str());
+    static_assert(sizeof(asset_bundle_header) == 20);
+    static_assert(sizeof(asset_entry) == 24);
 
-            return connect_wifi_impl(&wifi_config);
+    static uint32_t asset_path_hash(const char* path, size_t len)
+    {
+        uint32_t hash = 0x811c9dc5;
+        for (size_t i = 0; i < len; i++)
+        {
+            hash ^= (uint8_t)path[i];
+            hash *= 0x01000193;
         }
 
-        bool create_ap(const std::string& ap_ssid, const std::string& ap_password)
+        return hash;
+    }
+
+    // 通过 esp_partition_mmap 映射的静态资源包，只在映射时校验一次，之后按路径哈希 O(1) 查找，
+    // 文件内容直接从映射的 flash 分块发送，不复制到内存。
+    // 由控制任务映射和解除映射，httpd 任务只在配置服务器运行期间读取。
+    class asset_bundle
+    {
+        asset_bundle(const asset_bundle &) = delete;
+        asset_bundle &operator=(const asset_bundle &) = delete;
+
+    public:
+        asset_bundle() = default;
+
+        ~asset_bundle()
+        {
+            unmap();
+        }
+
+        bool map()
+        {
+            if (m_base)
+                return true;
+
+            auto part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, ASSET_PARTITION_LABEL);
+            if (!part)
+            {
+                ESP_LOGI(TAG, "没有找到静态资源分区, 使用内置配置页面");
+                return false;
+            }
+
+            const void* ptr = nullptr;
+            auto err = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &m_handle);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "映射静态资源分区失败: %s", esp_err_to_name(err));
+                return false;
+            }
+
+            m_base = (const uint8_t *)ptr;
+            m_size = part->size;
+
+            if (!validate())
+            {
+                ESP_LOGW(TAG, "静态资源包无效, 使用内置配置页面");
+                unmap();
+                return false;
+            }
+
+            ESP_LOGI(TAG, "已映射静态资源包, %d 个文件, %u 字节",
+                header()->entry_count, (unsigned)header()->total_size);
+
+            return true;
+        }
+
+        void unmap()
+        {
+            if (!m_base)
+                return;
+
+            esp_partition_munmap(m_handle);
+            m_base = nullptr;
+            m_size = 0;
+        }
+
+        bool mapped() const
+        {
+            return m_base != nullptr;
+        }
+
+        // 按路径查找文件，忽略查询字符串，找不到返回 nullptr
+        const asset_entry* find(const char* uri) const
+        {
+            if (!m_base)
+                return nullptr;
+
+            size_t len = strcspn(uri, "?#");
+
+            auto h = header();
+            uint32_t hash = asset_path_hash(uri, len);
+            uint16_t mask = h->bucket_count - 1;
+
+            for (uint16_t i = 0, b = hash & mask; i < h->bucket_count; i++, b = (b + 1) & mask)
+            {
+                uint16_t index = buckets()[b];
+                if (index == ASSET_EMPTY_BUCKET)
+                    return nullptr;
+
+                auto e = &entries()[index];
+                if (e->hash == hash && e->path_len == len && memcmp(m_base + e->path_offset, uri, len) == 0)
+                    return e;
+            }
+
+            return nullptr;
+        }
+
+        esp_err_t send(httpd_req_t* req, const asset_entry* e) const
+        {
+            httpd_resp_set_type(req, (const char *)m_base + e->mime_offset);
+            if (e->flags & ASSET_FLAG_GZIP)
+                httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+
+            auto data = (const char *)m_base + e->data_offset;
+            for (uint32_t offset = 0; offset < e->data_size; offset += ASSET_CHUNK_SIZE)
+            {
+                size_t n = std::min<size_t>(ASSET_CHUNK_SIZE, e->data_size - offset);
+                auto err = httpd_resp_send_chunk(req, data + offset, n);
+                if (err != ESP_OK)
+                    return err;
+            }
+
+            return httpd_resp_send_chunk(req, nullptr, 0);
+        }
+
+    private:
+        const asset_bundle_header* header() const
+        {
+            return (const asset_bundle_header *)m_base;
+        }
+
+        const uint16_t* buckets() const
+        {
+            return (const uint16_t *)(m_base + sizeof(asset_bundle_header));
+        }
+
+        static size_t entries_offset(uint16_t bucket_count)
+        {
+            return (sizeof(asset_bundle_header) + bucket_count * sizeof(uint16_t) + 3) & ~(size_t)3;
+        }
+
+        const asset_entry* entries() const
+        {
+            return (const asset_entry *)(m_base + entries_offset(header()->bucket_count));
+        }
+
+        // 检查文件头、CRC 以及所有偏移都在资源包范围内，之后的查找和发送不再检查
+        bool validate() const
+        {
+            if (m_size < sizeof(asset_bundle_header))
+                return false;
+
+            auto h = header();
+            if (memcmp(h->magic, "WPAB", 4) != 0 || h->version != ASSET_BUNDLE_VERSION)
+                return false;
+
+            if (h->total_size > m_size || h->total_size < sizeof(asset_bundle_header))
+                return false;
+
+            if (h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0 ||
+                h->entry_count >= h->bucket_count)
+                return false;
+
+            uint64_t table_end = entries_offset(h->bucket_count) + (uint64_t)h->entry_count * sizeof(asset_entry);
+            if (table_end > h->total_size)
+                return false;
+
+            uint32_t crc = esp_crc32_le(0, m_base + sizeof(asset_bundle_header),
+                h->total_size - sizeof(asset_bundle_header));
+            if (crc != h->crc)
+            {
+                ESP_LOGW(TAG, "静态资源包 CRC 错误");
+                return false;
+            }
+
+            for (uint16_t b = 0; b < h->bucket_count; b++)
+            {
+                auto index = buckets()[b];
+                if (index != ASSET_EMPTY_BUCKET && index >= h->entry_count)
+                    return false;
+            }
+
+            for (uint16_t i = 0; i < h->entry_count; i++)
+            {
+                auto& e = entries()[i];
+
+                if ((uint64_t)e.path_offset + e.path_len + 1 > h->total_size ||
+                    (uint64_t)e.mime_offset + e.mime_len + 1 > h->total_size ||
+                    (uint64_t)e.data_offset + e.data_size > h->total_size)
+                    return false;
+
+                if (m_base[e.mime_offset + e.mime_len] != '\0')
+                    return false;
+            }
+
+            return true;
+        }
+
+    private:
+        const uint8_t* m_base = nullptr;
+        size_t m_size = 0;
+        esp_partition_mmap_handle_t m_handle = 0;
+    };
+#endif
+
+#if WIFI_PROVISIONING_TRACE
+    //////////////// 跟踪记录 ////////////////
+
+    static const int TRACE_BUFFER_SIZE = 256;
+
+    // 固定大小的跟踪记录环形缓冲区，写满后覆盖最旧的记录。
+    // 任何任务（包括事件循环任务和 httpd 任务）都可以写入，每条记录只需要读一次时钟、
+    // 复制任务名称的前几个字节，再在一个很短的临界区内写入缓冲区。
+    class trace_buffer
+    {
+    public:
+        void add(const char* name, char phase, uint32_t arg)
+        {
+            trace_record r;
+            r.timestamp_us = esp_timer_get_time();
+            r.name = name;
+            r.arg = arg;
+            r.phase = phase;
+            strncpy(r.task, pcTaskGetName(nullptr), sizeof(r.task) - 1);
+            r.task[sizeof(r.task) - 1] = '\0';
+
+            taskENTER_CRITICAL(&m_lock);
+            m_records[m_next] = r;
+            m_next = (m_next + 1) % TRACE_BUFFER_SIZE;
+            if (m_count < TRACE_BUFFER_SIZE)
+                m_count++;
+            taskEXIT_CRITICAL(&m_lock);
+        }
+
+        // 按时间从旧到新返回所有记录
+        std::vector<trace_record> snapshot() const
+        {
+            // 在临界区外分配内存
+            std::vector<trace_record> records(TRACE_BUFFER_SIZE);
+
+            taskENTER_CRITICAL(&m_lock);
+            int count = m_count;
+            int first = (m_next - count + TRACE_BUFFER_SIZE) % TRACE_BUFFER_SIZE;
+            for (int i = 0; i < count; i++)
+                records[i] = m_records[(first + i) % TRACE_BUFFER_SIZE];
+            taskEXIT_CRITICAL(&m_lock);
+
+            records.resize(count);
+            return records;
+        }
+
+    private:
+        mutable portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+        trace_record m_records[TRACE_BUFFER_SIZE] = {};
+        int m_next = 0;
+        int m_count = 0;
+    };
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+    // mDNS/DNS-SD 应答器的报文部分。应答报文在主机名、服务或 TXT 变化时预先生成，收到查询时只需填入
+    // 接收接口的地址（传统单播查询还要填入 id）即可发送，不需要逐条构造记录。只由 mDNS 任务访问。
+    class mdns_responder
+    {
+        enum : uint16_t
+        {
+            TYPE_A = 1,
+            TYPE_PTR = 12,
+            TYPE_TXT = 16,
+            TYPE_SRV = 33,
+            TYPE_ANY = 255
+        };
+
+    public:
+        enum answer : uint8_t
+        {
+            ANSWER_HOST = 1,        // <hostname>.local 的 A 记录
+            ANSWER_SERVICE = 2,     // _http._tcp 的 PTR、SRV、TXT 和 A 记录
+            ANSWER_META = 4         // _services._dns-sd._udp 的 PTR 记录
+        };
+
+        struct query
+        {
+            uint8_t answers;        // 需要发送的应答报文
+            bool unicast;           // 查询要求单播应答（QU）
+            uint16_t id;
+            uint16_t questions;     // question 中的问题数
+            std::string question;   // 解压缩后的问题段，传统单播应答需要重复
+        };
+
+        void build(std::string_view hostname, std::string_view instance, uint16_t port, const std::string& txt)
+        {
+            m_host_name = wire_name({ hostname, "local" });
+            m_service_name = wire_name({ "_http", "_tcp", "local" });
+            m_instance_name = wire_name({ instance, "_http", "_tcp", "local" });
+            m_meta_name = wire_name({ "_services", "_dns-sd", "_udp", "local" });
+
+            std::string srv("\0\0\0\0", 4);     // priority 和 weight
+            srv += (char)(port >> 8);
+            srv += (char)(port & 0xff);
+            srv += m_host_name;
+
+            begin(m_host, 1);
+            m_host_ip = add_host(m_host, false);
+
+            begin(m_service, 4);
+            m_service_ip = add_service(m_service, srv, txt, false);
+
+            begin(m_meta, 1);
+            add_meta(m_meta, false);
+
+            // 传统单播查询的应答记录，发送时在前面加上首部和查询中的问题段
+            m_legacy_host.clear();
+            m_legacy_host_ip = add_host(m_legacy_host, true);
+
+            m_legacy_service.clear();
+            m_legacy_service_ip = add_service(m_legacy_service, srv, txt, true);
+
+            m_legacy_meta.clear();
+            add_meta(m_legacy_meta, true);
+        }
+
+        // 解析查询，返回需要发送的应答报文
+        query parse(const uint8_t* data, size_t len) const
+        {
+            query q = {};
+
+            // 只回答查询，忽略其它设备的应答
+            if (len < 12 || (data[2] & 0x80))
+                return q;
+
+            q.id = data[0] << 8 | data[1];
+
+            int count = data[4] << 8 | data[5];
+            size_t offset = 12;
+            char name[256];
+
+            for (int i = 0; i < count; i++)
+            {
+                auto name_len = read_name(data, len, offset, name, sizeof(name));
+                if (!name_len || offset + 4 > len)
+                    break;
+
+                uint16_t type = data[offset] << 8 | data[offset + 1];
+                bool unicast = data[offset + 2] & 0x80;
+
+                std::string_view qname(name, name_len);
+                q.question.append(qname);
+                q.question.append((const char*)data + offset, 4);
+                q.questions++;
+                offset += 4;
+                uint8_t answer = 0;
+
+                if (equals(qname, m_host_name) && (type == TYPE_A || type == TYPE_ANY))
+                    answer = ANSWER_HOST;
+                else if (equals(qname, m_service_name) && (type == TYPE_PTR || type == TYPE_ANY))
+                    answer = ANSWER_SERVICE;
+                else if (equals(qname, m_instance_name) &&
+                    (type == TYPE_SRV || type == TYPE_TXT || type == TYPE_ANY))
+                    answer = ANSWER_SERVICE;
+                else if (equals(qname, m_meta_name) && (type == TYPE_PTR || type == TYPE_ANY))
+                    answer = ANSWER_META;
+
+                if (answer)
+                {
+                    q.answers |= answer;
+                    q.unicast |= unicast;
+                }
+            }
+
+            // 服务报文已经包含主机记录
+            if (q.answers & ANSWER_SERVICE)
+                q.answers &= ~ANSWER_HOST;
+
+            return q;
+        }
+
+        // 取出应答报文并填入接口地址，ip 为网络字节序
+        std::span<const uint8_t> prepare(answer which, uint32_t ip)
+        {
+            auto& packet = which == ANSWER_HOST ? m_host : which == ANSWER_SERVICE ? m_service : m_meta;
+
+            if (which == ANSWER_HOST)
+                memcpy(&packet[m_host_ip], &ip, 4);
+            else if (which == ANSWER_SERVICE)
+                memcpy(&packet[m_service_ip], &ip, 4);
+
+            return packet;
+        }
+
+        // 生成传统单播查询的应答报文（RFC 6762 6.7）：首部带查询的 id，重复查询中的问题段，
+        // 应答记录的 TTL 不超过 MDNS_LEGACY_TTL，且不设置 cache-flush 位
+        std::span<const uint8_t> prepare_legacy(answer which, uint32_t ip, const query& q)
+        {
+            auto& answers = which == ANSWER_HOST ? m_legacy_host :
+                which == ANSWER_SERVICE ? m_legacy_service : m_legacy_meta;
+
+            begin(m_legacy, which == ANSWER_SERVICE ? 4 : 1);
+            m_legacy[0] = q.id >> 8;
+            m_legacy[1] = q.id & 0xff;
+            m_legacy[4] = q.questions >> 8;
+            m_legacy[5] = q.questions & 0xff;
+
+            m_legacy.insert(m_legacy.end(), q.question.begin(), q.question.end());
+
+            size_t base = m_legacy.size();
+            m_legacy.insert(m_legacy.end(), answers.begin(), answers.end());
+
+            if (which == ANSWER_HOST)
+                memcpy(&m_legacy[base + m_legacy_host_ip], &ip, 4);
+            else if (which == ANSWER_SERVICE)
+                memcpy(&m_legacy[base + m_legacy_service_ip], &ip, 4);
+
+            return m_legacy;
+        }
+
+    private:
+        static std::string wire_name(std::initializer_list<std::string_view> labels)
+        {
+            std::string name;
+
+            for (auto label : labels)
+            {
+                name += (char)label.size();
+                name.append(label);
+            }
+
+            name += '\0';
+            return name;
+        }
+
+        // 应答报文的首部：QR 和 AA 标志，没有问题段
+        static void begin(std::vector<uint8_t>& packet, uint8_t answers)
+        {
+            packet.assign({ 0, 0, 0x84, 0, 0, 0, 0, answers, 0, 0, 0, 0 });
+        }
+
+        static void add_record(std::vector<uint8_t>& packet, const std::string& name, uint16_t type,
+            bool cache_flush, uint32_t ttl, std::string_view rdata)
+        {
+            uint8_t fixed[] = {
+                (uint8_t)(type >> 8), (uint8_t)type,
+                (uint8_t)(cache_flush ? 0x80 : 0), 1,
+                (uint8_t)(ttl >> 24), (uint8_t)(ttl >> 16), (uint8_t)(ttl >> 8), (uint8_t)ttl,
+                (uint8_t)(rdata.size() >> 8), (uint8_t)rdata.size()
+            };
+
+            packet.insert(packet.end(), name.begin(), name.end());
+            packet.insert(packet.end(), fixed, fixed + sizeof(fixed));
+            packet.insert(packet.end(), rdata.begin(), rdata.end());
+        }
+
+        // 以下函数向报文追加应答记录，legacy 为 true 时生成传统单播查询的应答记录
+
+        // 添加地址待填的 A 记录，返回地址在报文中的偏移
+        size_t add_host(std::vector<uint8_t>& packet, bool legacy) const
+        {
+            add_record(packet, m_host_name, TYPE_A, !legacy, ttl(MDNS_HOST_TTL, legacy),
+                std::string_view("\0\0\0\0", 4));
+            return packet.size() - 4;
+        }
+
+        size_t add_service(std::vector<uint8_t>& packet, const std::string& srv, const std::string& txt,
+            bool legacy) const
+        {
+            add_record(packet, m_service_name, TYPE_PTR, false, ttl(MDNS_SERVICE_TTL, legacy), m_instance_name);
+            add_record(packet, m_instance_name, TYPE_SRV, !legacy, ttl(MDNS_HOST_TTL, legacy), srv);
+            add_record(packet, m_instance_name, TYPE_TXT, !legacy, ttl(MDNS_SERVICE_TTL, legacy), txt);
+            return add_host(packet, legacy);
+        }
+
+        void add_meta(std::vector<uint8_t>& packet, bool legacy) const
+        {
+            add_record(packet, m_meta_name, TYPE_PTR, false, ttl(MDNS_SERVICE_TTL, legacy), m_service_name);
+        }
+
+        static uint32_t ttl(uint32_t value, bool legacy)
+        {
+            return legacy ? std::min(value, MDNS_LEGACY_TTL) : value;
+        }
+
+        // 读取可能被压缩的名字，以未压缩的格式写入 out，offset 移动到名字之后，出错时返回 0
+        static size_t read_name(const uint8_t* data, size_t len, size_t& offset, char* out, size_t out_size)
+        {
+            size_t pos = offset;
+            size_t n = 0;
+            int jumps = 0;
+
+            while (pos < len)
+            {
+                uint8_t label = data[pos];
+
+                if ((label & 0xc0) == 0xc0)
+                {
+                    if (pos + 1 >= len || ++jumps > 8)
+                        return 0;
+
+                    if (jumps == 1)
+                        offset = pos + 2;
+
+                    pos = (label & 0x3f) << 8 | data[pos + 1];
+                    continue;
+                }
+
+                if ((label & 0xc0) || pos + 1 + label > len || n + 1 + label > out_size)
+                    return 0;
+
+                memcpy(out + n, data + pos, 1 + label);
+                n += 1 + label;
+                pos += 1 + label;
+
+                if (label == 0)
+                {
+                    if (jumps == 0)
+                        offset = pos;
+                    return n;
+                }
+            }
+
+            return 0;
+        }
+
+        // 名字比较不区分大小写，长度字节不超过 63，不受 tolower 影响
+        static bool equals(std::string_view a, std::string_view b)
+        {
+            if (a.size() != b.size())
+                return false;
+
+            for (size_t i = 0; i < a.size(); i++)
+            {
+                if (tolower((uint8_t)a[i]) != tolower((uint8_t)b[i]))
+                    return false;
+            }
+
+            return true;
+        }
+
+        std::string m_host_name;
+        std::string m_service_name;
+        std::string m_instance_name;
+        std::string m_meta_name;
+
+        std::vector<uint8_t> m_host;
+        std::vector<uint8_t> m_service;
+        std::vector<uint8_t> m_meta;
+        size_t m_host_ip = 0;
+        size_t m_service_ip = 0;
+
+        // 传统单播查询的应答记录（不含首部和问题段），m_legacy 是发送时拼装报文的缓冲区
+        std::vector<uint8_t> m_legacy_host;
+        std::vector<uint8_t> m_legacy_service;
+        std::vector<uint8_t> m_legacy_meta;
+        size_t m_legacy_host_ip = 0;
+        size_t m_legacy_service_ip = 0;
+        std::vector<uint8_t> m_legacy;
+    };
+#endif
+
+#if WIFI_PROVISIONING_OTA
+    //////////////// 流式 OTA 写入 ////////////////
+
+    // 双缓冲的 OTA 写入。两个缓冲区通过 m_free 和 m_filled 两个队列在 httpd 任务和 ota 任务之间交替传递：
+    // httpd 任务接收下一块数据并计算哈希的同时，ota 任务把上一块写入 flash，固件不会整个缓存在内存中。
+    class ota_pipeline
+    {
+        struct block
+        {
+            uint8_t* data;
+            size_t size;        // 0 表示数据结束，ota 任务退出
+        };
+
+    public:
+        ota_pipeline() = default;
+        ota_pipeline(const ota_pipeline&) = delete;
+        ota_pipeline& operator=(const ota_pipeline&) = delete;
+
+        ~ota_pipeline()
+        {
+            finish(false);
+        }
+
+        // 擦除下一个 OTA 分区中固件所需的空间并启动 ota 任务
+        esp_err_t begin(size_t image_size)
+        {
+            m_partition = esp_ota_get_next_update_partition(nullptr);
+            if (!m_partition)
+                return ESP_ERR_NOT_FOUND;
+            if (image_size > m_partition->size)
+                return ESP_ERR_INVALID_SIZE;
+
+            auto err = esp_ota_begin(m_partition, image_size, &m_handle);
+            if (err != ESP_OK)
+                return err;
+            m_begun = true;
+
+            m_buffers = (uint8_t*)malloc(OTA_BUFFER_SIZE * 2);
+            m_free = xQueueCreate(2, sizeof(uint8_t*));
+            m_filled = xQueueCreate(2, sizeof(block));
+            m_exit = xSemaphoreCreateBinary();
+            if (!m_buffers || !m_free || !m_filled || !m_exit)
+                return ESP_ERR_NO_MEM;
+
+            for (int i = 0; i < 2; i++)
+            {
+                uint8_t* data = m_buffers + i * OTA_BUFFER_SIZE;
+                xQueueSend(m_free, &data, 0);
+            }
+
+            if (xTaskCreate([](void* arg) {
+                auto self = static_cast<ota_pipeline*>(arg);
+                self->writer();
+                xSemaphoreGive(self->m_exit);
+                vTaskDelete(nullptr);
+            }, "ota", OTA_TASK_STACK_SIZE, this, OTA_TASK_PRIORITY, nullptr) != pdPASS)
+                return ESP_ERR_NO_MEM;
+
+            m_running = true;
+            return ESP_OK;
+        }
+
+        // 取得一个空闲的缓冲区，两个缓冲区都在使用中时等待 flash 写入完成
+        uint8_t* acquire()
+        {
+            uint8_t* data = nullptr;
+
+            auto start = esp_timer_get_time();
+            xQueueReceive(m_free, &data, portMAX_DELAY);
+            m_stall_us += esp_timer_get_time() - start;
+
+            return data;
+        }
+
+        // 提交填充好的缓冲区，之前的写入已经失败时返回 false
+        bool submit(uint8_t* data, size_t size)
+        {
+            block b = { data, size };
+            xQueueSend(m_filled, &b, portMAX_DELAY);
+
+            return m_error == ESP_OK;
+        }
+
+        // 等待所有数据写入。commit 为 true 时校验固件并设置为启动分区，否则丢弃已写入的数据
+        esp_err_t finish(bool commit)
+        {
+            if (m_running)
+            {
+                block b = { nullptr, 0 };
+                xQueueSend(m_filled, &b, portMAX_DELAY);
+                xSemaphoreTake(m_exit, portMAX_DELAY);
+                m_running = false;
+            }
+
+            esp_err_t err = m_error;
+            if (m_begun)
+            {
+                m_begun = false;
+
+                if (commit && err == ESP_OK)
+                {
+                    err = esp_ota_end(m_handle);
+                    if (err == ESP_OK)
+                        err = esp_ota_set_boot_partition(m_partition);
+                }
+                else
+                {
+                    esp_ota_abort(m_handle);
+                }
+            }
+
+            if (m_free)
+                vQueueDelete(m_free);
+            if (m_filled)
+                vQueueDelete(m_filled);
+            if (m_exit)
+                vSemaphoreDelete(m_exit);
+            free(m_buffers);
+
+            m_free = nullptr;
+            m_filled = nullptr;
+            m_exit = nullptr;
+            m_buffers = nullptr;
+
+            return err;
+        }
+
+        esp_err_t error() const
+        {
+            return m_error;
+        }
+
+        // 写入耗时在 finish 之后读取
+        int64_t write_us() const
+        {
+            return m_write_us;
+        }
+
+        int64_t stall_us() const
+        {
+            return m_stall_us;
+        }
+
+        const esp_partition_t* partition() const
+        {
+            return m_partition;
+        }
+
+    private:
+        // ota 任务：依次写入提交的缓冲区并归还，出错后不再写入，但仍然归还缓冲区直到数据结束
+        void writer()
+        {
+            block b;
+            while (xQueueReceive(m_filled, &b, portMAX_DELAY) == pdTRUE && b.size)
+            {
+                if (m_error == ESP_OK)
+                {
+                    auto start = esp_timer_get_time();
+                    auto err = esp_ota_write(m_handle, b.data, b.size);
+                    m_write_us += esp_timer_get_time() - start;
+
+                    if (err != ESP_OK)
+                        m_error = err;
+                }
+
+                xQueueSend(m_free, &b.data, portMAX_DELAY);
+            }
+        }
+
+        const esp_partition_t* m_partition = nullptr;
+        esp_ota_handle_t m_handle = 0;
+        bool m_begun = false;
+        bool m_running = false;
+
+        uint8_t* m_buffers = nullptr;
+        QueueHandle_t m_free = nullptr;
+        QueueHandle_t m_filled = nullptr;
+        SemaphoreHandle_t m_exit = nullptr;
+
+        std::atomic<esp_err_t> m_error{ ESP_OK };
+        int64_t m_write_us = 0;
+        int64_t m_stall_us = 0;
+    };
+#endif
+
+    //////////////// Wi-Fi 事件处理函数 ////////////////
+
+    void Wifi_Event_Handler(void* event_handler_arg,
+        esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+    //////////////// 控制任务命令与消息 ////////////////
+
+    enum class command_type : uint8_t
+    {
+        AUTO_CONNECT,       // 从 NVS 读取配置并连接
+        CONNECT,            // 连接到指定网络
+#if WIFI_PROVISIONING_SCAN
+        SCAN,               // 扫描网络
+#endif
+        START_AP,           // 创建热点
+        START_SERVER,       // 创建热点并启动配置服务器
+        SET_SUPERVISOR,     // 设置链路监控选项
+        SET_CONNECTION_CB,  // 设置连接信息变化的回调
+        SET_PROFILE,        // 设置功耗与延迟模式
+        SET_AP_GRACE,       // 设置配网成功后热点的保留时间
+        SET_AP_OPTIONS,     // 设置热点参数
+        SET_PORTAL_IDLE,    // 设置配置热点的空闲超时
+        MEASURE_RTT,        // 测量到网关的往返时延
+        RESUME_PSK,         // 后台任务算出的 PSK，写入 RTC 连接记录
+        CANCEL,             // 取消异步接口提交的连接或配网会话
+#if WIFI_PROVISIONING_MDNS
+        START_MDNS,         // 启动 mDNS 应答器
+        STOP_MDNS,          // 停止 mDNS 应答器
+#endif
+        STOP                // 停止并退出控制任务
+    };
+
+    // 提交给控制任务的命令，所有命令都由控制任务串行执行，且保证恰好完成一次。
+    // 命令使用引用计数管理生命周期，同步等待的提交者和控制任务各持有一个引用，
+    // 这样等待超时的提交者可以安全地先行释放。
+    struct command
+    {
+        command_type type;
+
+        std::string ssid;
+        std::string password;
+        int port = 80;
+        uint8_t channel = 0;    // 从该信道开始扫描，0 表示全信道扫描
+        int32_t load_us = 0;    // 自动连接时读取 NVS 配置的耗时
+        bool reinit_driver = false;
+        bool verify = false;    // 来自配置页面的凭据验证，在 APSTA 模式下进行，不中断热点
+        bool resume = false;    // resume_connect 提交的自动连接，使用 RTC 中的连接记录
+        bool readvertise = false;   // 重新广播窗口由控制任务自己提交的 START_SERVER
+
+        connect_callback_t connect_cb;
+#if WIFI_PROVISIONING_SCAN
+        scan_callback_t scan_cb;
+#endif
+
+        link_supervisor_options supervisor;
+        link_callback_t link_cb;
+        connection_callback_t connection_cb;
+
+        link_profile profile = link_profile::BALANCED;
+        uint16_t listen_interval = 0;
+
+        int rtt_count = 0;
+        int rtt_interval_ms = 0;
+        link_rtt_stats rtt = {};
+
+        uint32_t password_crc = 0;  // RESUME_PSK 计算 PSK 所用密码的 CRC32，PSK 在 password 中
+
+        int ap_grace_ms = 0;
+        ap_options ap;
+        portal_idle_options portal_idle;
+        portal_callback_t portal_cb;
+
+#if WIFI_PROVISIONING_MDNS
+        mdns_options mdns;
+#endif
+
+        teardown_mode teardown = teardown_mode::KEEP_STA;
+
+        // 异步接口提交的命令的序号，CANCEL 命令通过 target 指定要取消的序号，
+        // 并在完成时结束 async_state，使取消的结果和 continuation 都在控制任务中处理。
+        // RESUME_PSK 命令的 seq 为提交它的计算任务的序号
+        uint32_t seq = 0;
+        uint32_t target = 0;
+        std::shared_ptr<async_detail::state_base> async_state;
+
+        // 异步接口的完成通知，由库自己提供，因此停止过程中也会调用。
+        // START_SERVER 成功时转交给配网会话，在会话结束时调用。
+        inplace_function<void(bool), CALLBACK_CAPACITY> done_cb;
+
+        // 同步等待完成的信号量，为空表示提交者不等待
+        SemaphoreHandle_t done = nullptr;
+        std::atomic_bool completed{ false };
+        bool result = false;
+
+        std::atomic_int refs{ 1 };
+    };
+
+    static void release_command(command* cmd)
+    {
+        if (--cmd->refs == 0)
+        {
+            if (cmd->done)
+                vSemaphoreDelete(cmd->done);
+            delete cmd;
+        }
+    }
+
+    // 从 esp_event 任务投递到控制任务的驱动事件
+    struct driver_event
+    {
+        esp_event_base_t base;
+        int32_t id;
+        int64_t timestamp_us;   // 事件到达 esp_event 任务的时刻
+        uint8_t code;           // STA_DISCONNECTED 的断开原因，SCAN_DONE 的扫描状态，或 AP_STA* 的 AID
+        uint8_t channel;        // STA_CONNECTED 的信道
+        uint8_t bssid[6];       // STA_CONNECTED 的 BSSID，或 AP_STA* 的客户端 MAC
+        esp_ip4_addr_t ip;      // IP_EVENT_STA_GOT_IP 获取到的地址
+        esp_ip4_addr_t gw;      // IP_EVENT_STA_GOT_IP 获取到的网关
+    };
+
+    // 控制任务队列中的消息，cmd 为空时表示驱动事件
+    struct control_message
+    {
+        command* cmd;
+        driver_event event;
+    };
+
+    // 单生产者单消费者的无锁环形缓冲区，N 必须是 2 的幂。
+    // 用于把 esp_event 任务（唯一的生产者）收到的驱动事件交给控制任务（唯一的消费者）。
+    template <typename T, uint32_t N>
+    class spsc_ring
+    {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of two");
+
+    public:
+        // 只能由生产者调用，缓冲区满时返回 false
+        bool push(const T& item)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head - m_tail.load(std::memory_order_acquire) == N)
+                return false;
+
+            m_items[head & (N - 1)] = item;
+            m_head.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // 只能由消费者调用，缓冲区空时返回 false
+        bool pop(T& item)
+        {
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail == m_head.load(std::memory_order_acquire))
+                return false;
+
+            item = m_items[tail & (N - 1)];
+            m_tail.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+    private:
+        std::atomic<uint32_t> m_head{ 0 };
+        std::atomic<uint32_t> m_tail{ 0 };
+        T m_items[N];
+    };
+
+    // 单写者的顺序锁，读者不加锁，通过前后两次读取序号判断是否读到了完整的数据。
+    // 写者（控制任务）在临界区内写入，同一核心上优先级更高的读者不会在写入中途抢占写者而一直重试。
+    template <typename T>
+    class seqlock
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "T must be trivially copyable");
+
+    public:
+        void store(const T& value)
+        {
+            portENTER_CRITICAL(&m_lock);
+            m_seq.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            memcpy(&m_value, &value, sizeof(T));
+            m_seq.fetch_add(1, std::memory_order_release);
+            portEXIT_CRITICAL(&m_lock);
+        }
+
+        T load() const
+        {
+            T value;
+            uint32_t seq;
+
+            do
+            {
+                seq = m_seq.load(std::memory_order_acquire);
+                memcpy(&value, &m_value, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+
+            return value;
+        }
+
+    private:
+        portMUX_TYPE m_lock = portMUX_INITIALIZER_UNLOCKED;
+        std::atomic<uint32_t> m_seq{ 0 };
+        T m_value = {};
+    };
+
+    // STA 接口的状态机：
+    //   IDLE       --connect-->        CONNECTING
+    //   CONNECTING --GOT_IP-->         CONNECTED
+    //   CONNECTING --DISCONNECTED/超时--> IDLE，或链路监控重连失败时进入 BACKOFF
+    //   CONNECTED  --DISCONNECTED-->   BACKOFF（链路监控开启）或 IDLE
+    //   CONNECTED  --connect/漫游-->    CONNECTING（先断开当前连接）
+    //   BACKOFF    --退避到期-->        CONNECTING
+    // 扫描和热点可以与任一状态并存，分别由 m_scanning 和 m_ap_active 表示，
+    // CONNECTING 状态或漫游扫描期间提交的扫描会推迟执行。
+    enum class sta_state : uint8_t
+    {
+        IDLE,
+        CONNECTING,
+        CONNECTED,
+        BACKOFF
+    };
+
+    //////////////// Wi-Fi 配置类 ////////////////
+
+    // 所有 Wi-Fi 状态都由一个专用的控制任务持有和修改，公共接口只负责向控制任务提交命令，
+    // esp_event 任务中的事件处理函数也只是把事件转发给控制任务，从而避免调用者任务、httpd
+    // 任务、DNS 任务和 esp_event 任务之间的数据竞争。
+    class wifi_provisioning_impl
+    {
+        wifi_provisioning_impl(const wifi_provisioning_impl &) = delete;
+        wifi_provisioning_impl &operator=(const wifi_provisioning_impl &) = delete;
+
+        friend void Wifi_Event_Handler(void* event_handler_arg,
+            esp_event_base_t event_base, int32_t event_id, void* event_data);
+
+    public:
+        wifi_provisioning_impl()
+        {
+            // 网络协议栈和 Wi-Fi 驱动在第一次需要时由控制任务初始化（见 ensure_driver），
+            // 热点接口只在创建热点时创建，构造函数只创建控制任务。
+
+            // 创建控制任务。任何一步失败时 m_running 保持为 false，之后提交的命令直接以失败完成
+            m_control_queue = xQueueCreate(CONTROL_QUEUE_SIZE, sizeof(control_message));
+            m_control_exit = xSemaphoreCreateBinary();
+            if (!m_control_queue || !m_control_exit)
+            {
+                ESP_LOGE(TAG, "创建控制任务的队列失败");
+                return;
+            }
+
+            // 控制任务启动后立即检查 m_running，必须在创建任务前设置
+            m_running = true;
+
+            if (xTaskCreate([](void* arg) {
+                auto self = static_cast<wifi_provisioning_impl*>(arg);
+                self->control_loop();
+            }, "wifi_ctrl", CONTROL_TASK_STACK_SIZE, this, CONTROL_TASK_PRIORITY, &m_control_task) != pdPASS)
+            {
+                ESP_LOGE(TAG, "创建控制任务失败");
+                m_running = false;
+                m_control_task = nullptr;
+            }
+        }
+
+        ~wifi_provisioning_impl()
+        {
+            stop(teardown_mode::KEEP_STA);
+
+            if (m_control_queue)
+                vQueueDelete(m_control_queue);
+
+            if (m_control_exit)
+                vSemaphoreDelete(m_control_exit);
+        }
+
+    public:
+        void auto_connect(connect_callback_t connect_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::AUTO_CONNECT;
+            cmd->connect_cb = connect_cb;
+
+            submit(cmd);
+        }
+
+        void resume_connect(connect_callback_t connect_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::AUTO_CONNECT;
+            cmd->resume = true;
+            cmd->connect_cb = connect_cb;
+
+            submit(cmd);
+        }
+
+        bool start_config_server(std::string ap_ssid, std::string ap_password, int port)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::START_SERVER;
+            cmd->ssid = ap_ssid;
+            cmd->password = ap_password;
+            cmd->port = port;
+
+            return submit_and_wait(cmd, portMAX_DELAY);
+        }
+
+#if WIFI_PROVISIONING_SCAN
+        void scan_networks(scan_callback_t scan_callback)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SCAN;
+            cmd->scan_cb = scan_callback;
+
+            submit(cmd);
+        }
+#endif
+
+        bool connect_wifi(const std::string& ssid, const std::string& password)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::CONNECT;
+            cmd->ssid = ssid;
+            cmd->password = password;
+            cmd->reinit_driver = true;
+
+            return submit_and_wait(cmd, portMAX_DELAY);
+        }
+
+        void connect_wifi(const std::string& ssid, const std::string& password, connect_callback_t connect_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::CONNECT;
+            cmd->ssid = ssid;
+            cmd->password = password;
+            cmd->reinit_driver = true;
+            cmd->connect_cb = connect_cb;
+
+            submit(cmd);
+        }
+
+        async_result<wifi_status> auto_connect_async()
+        {
+            auto state = std::make_shared<async_detail::state<wifi_status>>(wifi_status::FAILED);
+
+            auto cmd = new command;
+            cmd->type = command_type::AUTO_CONNECT;
+            cmd->done_cb = [state](bool result)
+            {
+                if (result)
+                    state->complete(wifi_status::CONNECTED);
+                else
+                    state->finish(async_status::FAILED);
+            };
+
+            submit_async(cmd, state);
+            return async_result<wifi_status>(state);
+        }
+
+        async_result<wifi_status> connect_async(const std::string& ssid, const std::string& password)
+        {
+            auto state = std::make_shared<async_detail::state<wifi_status>>(wifi_status::FAILED);
+
+            auto cmd = new command;
+            cmd->type = command_type::CONNECT;
+            cmd->ssid = ssid;
+            cmd->password = password;
+            cmd->reinit_driver = true;
+            cmd->done_cb = [state](bool result)
+            {
+                if (result)
+                    state->complete(wifi_status::CONNECTED);
+                else
+                    state->finish(async_status::FAILED);
+            };
+
+            submit_async(cmd, state);
+            return async_result<wifi_status>(state);
+        }
+
+#if WIFI_PROVISIONING_SCAN
+        async_result<std::vector<wifi_network>> scan_async()
+        {
+            auto state = std::make_shared<async_detail::state<std::vector<wifi_network>>>(std::vector<wifi_network>{});
+
+            auto cmd = new command;
+            cmd->type = command_type::SCAN;
+            cmd->scan_cb = [state](std::span<const wifi_network> networks)
+            {
+                state->complete(std::vector<wifi_network>(networks.begin(), networks.end()));
+            };
+
+            // 扫描成功时 scan_cb 已经设置了结果，这里不再有效果
+            cmd->done_cb = [state](bool)
+            {
+                state->finish(async_status::FAILED);
+            };
+
+            submit_async(cmd, state);
+            return async_result<std::vector<wifi_network>>(state);
+        }
+#endif
+
+        async_result<wifi_status> start_config_server_async(std::string ap_ssid, std::string ap_password, int port)
+        {
+            auto state = std::make_shared<async_detail::state<wifi_status>>(wifi_status::FAILED);
+
+            auto cmd = new command;
+            cmd->type = command_type::START_SERVER;
+            cmd->ssid = ap_ssid;
+            cmd->password = ap_password;
+            cmd->port = port;
+            cmd->done_cb = [state](bool result)
+            {
+                if (result)
+                    state->complete(wifi_status::CONNECTED);
+                else
+                    state->finish(async_status::FAILED);
+            };
+
+            submit_async(cmd, state);
+            return async_result<wifi_status>(state);
+        }
+
+        bool create_ap(const std::string& ap_ssid, const std::string& ap_password)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::START_AP;
+            cmd->ssid = ap_ssid;
+            cmd->password = ap_password;
+
+            return submit_and_wait(cmd, portMAX_DELAY);
+        }
+
+        void set_link_supervisor(const link_supervisor_options& options, link_callback_t link_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_SUPERVISOR;
+            cmd->supervisor = options;
+            cmd->link_cb = link_cb;
+
+            submit(cmd);
+        }
+
+#if WIFI_PROVISIONING_MDNS
+        void start_mdns(const mdns_options& options)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::START_MDNS;
+            cmd->mdns = options;
+
+            submit(cmd);
+        }
+
+        void stop_mdns()
+        {
+            auto cmd = new command;
+            cmd->type = command_type::STOP_MDNS;
+
+            submit(cmd);
+        }
+#endif
+
+        void set_connection_callback(connection_callback_t connection_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_CONNECTION_CB;
+            cmd->connection_cb = connection_cb;
+
+            submit(cmd);
+        }
+
+        void set_link_profile(link_profile profile, uint16_t listen_interval)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_PROFILE;
+            cmd->profile = profile;
+            cmd->listen_interval = listen_interval;
+
+            submit(cmd);
+        }
+
+        void set_ap_grace_period(int grace_ms)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_AP_GRACE;
+            cmd->ap_grace_ms = grace_ms;
+
+            submit(cmd);
+        }
+
+        void set_ap_options(const ap_options& options)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_AP_OPTIONS;
+            cmd->ap = options;
+
+            submit(cmd);
+        }
+
+        void set_portal_idle(const portal_idle_options& options, portal_callback_t portal_cb)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::SET_PORTAL_IDLE;
+            cmd->portal_idle = options;
+            cmd->portal_cb = portal_cb;
+
+            submit(cmd);
+        }
+
+        bool measure_link_rtt(link_rtt_stats& stats, int count, int interval_ms)
+        {
+            auto cmd = new command;
+            cmd->type = command_type::MEASURE_RTT;
+            cmd->rtt_count = count;
+            cmd->rtt_interval_ms = interval_ms;
+
+            // 命令完成前持有一个额外的引用，以便读取结果
+            cmd->refs++;
+            scoped_exit release_exit([&]
+                { release_command(cmd); });
+
+            if (!submit_and_wait(cmd, portMAX_DELAY))
+                return false;
+
+            stats = cmd->rtt;
+            return true;
+        }
+
+        void stop(teardown_mode mode)
+        {
+            if (!m_control_task)
+            {
+                // 控制任务已经退出，不再有其它任务访问驱动，可以直接在调用者任务中完成剩余的释放
+                if (mode == teardown_mode::FULL)
+                    release_driver();
+                return;
+            }
+
+            // 先设置 m_abort，使之后的提交直接失败，并停止回调
+            m_abort = true;
+
+            // 在回调中调用 stop 时直接执行，控制任务在回调返回后退出
+            if (in_control_task())
+            {
+                if (m_running)
+                    do_stop(mode);
+                return;
+            }
+
+            if (m_running)
+            {
+                control_message msg = {};
+                msg.cmd = new command;
+                msg.cmd->type = command_type::STOP;
+                msg.cmd->teardown = mode;
+
+                if (xQueueSend(m_control_queue, &msg, portMAX_DELAY) != pdTRUE)
+                {
+                    release_command(msg.cmd);
+                    return;
+                }
+
+                wake_control_task();
+            }
+
+            // 等待控制任务退出
+            xSemaphoreTake(m_control_exit, portMAX_DELAY);
+            m_control_task = nullptr;
+
+            // 控制任务之前已经以 KEEP_STA 模式停止时，这里补上 FULL 模式的释放
+            if (mode == teardown_mode::FULL)
+                release_driver();
+        }
+
+        std::string get_connected_ssid() const
+        {
+            return m_connection.load().ssid;
+        }
+
+        std::string get_connected_ip() const
+        {
+            return m_connection.load().ip_str;
+        }
+
+        connection_info get_connection_info() const
+        {
+            return m_connection.load();
+        }
+
+#if WIFI_PROVISIONING_OTA
+        void set_ota_authorizer(ota_auth_callback_t authorizer)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_ota_auth = authorizer;
+        }
+
+        ota_status get_ota_status() const
+        {
+            return m_ota_status.load();
+        }
+#endif
+
+        void clear_wifi_config()
+        {
+            m_store.clear();
+
+            // RTC 中的连接记录同样作废，下次唤醒时不再用它恢复连接
+            rtc_resume_record.magic = 0;
+        }
+
+        wifi_nvs_stats get_nvs_stats() const
+        {
+            return m_store.stats();
+        }
+
+        event_handler_stats get_event_handler_stats() const
+        {
+            event_handler_stats stats = {};
+            stats.events = m_event_stats_count.load(std::memory_order_relaxed);
+            stats.max_us = m_event_stats_max_us.load(std::memory_order_relaxed);
+            if (stats.events)
+                stats.avg_us = m_event_stats_total_us.load(std::memory_order_relaxed) / stats.events;
+
+            return stats;
+        }
+
+        memory_usage get_memory_usage(provisioning_phase phase) const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_memory[(int)phase];
+        }
+
+#if WIFI_PROVISIONING_TRACE
+        std::vector<trace_record> get_trace() const
+        {
+            return m_trace.snapshot();
+        }
+#endif
+
+        std::vector<wifi_connect_record> get_connect_history() const
+        {
+            wifi_connect_record records[CONNECT_HISTORY_SIZE];
+            int count;
+            int first;
+
+            // 在临界区内只做拷贝，避免在其中分配内存
+            taskENTER_CRITICAL(&m_history_lock);
+            count = m_history_count;
+            first = (m_history_next + CONNECT_HISTORY_SIZE - m_history_count) % CONNECT_HISTORY_SIZE;
+            for (int i = 0; i < count; i++)
+                records[i] = m_history[(first + i) % CONNECT_HISTORY_SIZE];
+            taskEXIT_CRITICAL(&m_history_lock);
+
+            return std::vector<wifi_connect_record>(records, records + count);
+        }
+
+    private:
+        //////////////// 命令提交 ////////////////
+
+        bool in_control_task() const
+        {
+            return xTaskGetCurrentTaskHandle() == m_control_task;
+        }
+
+        // 提交命令，不等待完成。在控制任务中（即回调内）提交时直接执行。
+        void submit(command* cmd)
+        {
+            if (m_abort || !m_running)
+            {
+                complete_command(cmd, false);
+                return;
+            }
+
+            if (in_control_task())
+            {
+                handle_command(cmd);
+                return;
+            }
+
+            control_message msg = {};
+            msg.cmd = cmd;
+
+            // cancel_after 的超时在 FreeRTOS 定时器任务中提交 CANCEL 命令，不能阻塞定时器任务
+            TickType_t wait = xTaskGetCurrentTaskHandle() == xTimerGetTimerDaemonTaskHandle() ?
+                0 : pdMS_TO_TICKS(SUBMIT_TIMEOUT_MS);
+
+            if (xQueueSend(m_control_queue, &msg, wait) != pdTRUE)
+            {
+                ESP_LOGE(TAG, "控制任务队列已满, 命令 %d 被丢弃", (int)cmd->type);
+                complete_command(cmd, false);
+                return;
+            }
+
+            wake_control_task();
+        }
+
+        // 提交异步接口的命令，结果句柄被取消时向控制任务提交 CANCEL 命令，由控制任务结束结果句柄。
+        // canceller 保存在状态中，只持有状态的弱引用
+        void submit_async(command* cmd, const std::shared_ptr<async_detail::state_base>& state)
+        {
+            cmd->seq = ++m_async_seq;
+
+            state->set_canceller([this, seq = cmd->seq, weak = std::weak_ptr<async_detail::state_base>(state)]
+            {
+                auto cancel = new command;
+                cancel->type = command_type::CANCEL;
+                cancel->target = seq;
+                cancel->async_state = weak.lock();
+
+                submit(cancel);
+            });
+
+            submit(cmd);
+        }
+
+        // 控制任务阻塞在任务通知上，向队列或事件缓冲区放入消息后都需要唤醒它
+        void wake_control_task()
+        {
+            if (auto task = m_control_task)
+                xTaskNotifyGive(task);
+        }
+
+        // 提交命令并等待其完成，返回命令的执行结果。
+        bool submit_and_wait(command* cmd, TickType_t timeout)
+        {
+            cmd->done = xSemaphoreCreateBinary();
+            if (!cmd->done)
+            {
+                release_command(cmd);
+                return false;
+            }
+
+            // 等待者持有一个额外的引用
+            cmd->refs++;
+
+            scoped_exit release_exit([&]
+                { release_command(cmd); });
+
+            submit(cmd);
+
+            // 在控制任务中同步等待时，需要继续处理队列中的驱动事件，否则命令永远无法完成
+            if (in_control_task())
+            {
+                while (!cmd->completed && m_running)
+                    poll_once();
+
+                return cmd->completed && cmd->result;
+            }
+
+            if (xSemaphoreTake(cmd->done, timeout) != pdTRUE)
+                return false;
+
+            return cmd->result;
+        }
+
+        // 完成命令：调用回调、唤醒等待者并释放控制任务持有的引用
+        void complete_command(command* cmd, bool result)
+        {
+            cmd->result = result;
+
+            switch (cmd->type)
+            {
+            case command_type::AUTO_CONNECT:
+            case command_type::CONNECT:
+                call_connect_cb(cmd->connect_cb,
+                    result ? wifi_status::CONNECTED : wifi_status::FAILED, cmd->ssid);
+                break;
+#if WIFI_PROVISIONING_SCAN
+            case command_type::SCAN:
+                if (result)
+                    call_scan_cb(cmd->scan_cb);
+                break;
+#endif
+            case command_type::CANCEL:
+                // 被取消的操作已经中止时状态已经结束，这里没有效果；扫描等不能中止的操作在此结束。
+                // 提交失败时在提交者的任务中结束
+                if (cmd->async_state)
+                    cmd->async_state->finish(async_status::CANCELLED);
+                break;
+            default:
+                break;
+            }
+
+            if (cmd->done_cb)
+                cmd->done_cb(result);
+
+            cmd->completed = true;
+
+            if (cmd->done)
+                xSemaphoreGive(cmd->done);
+
+            release_command(cmd);
+        }
+
+        //////////////// 控制任务 ////////////////
+
+        void control_loop()
+        {
+            ESP_LOGI(TAG, "Wi-Fi 控制任务已启动");
+
+            while (m_running)
+                poll_once();
+
+            // 退出前结束队列中剩余的命令
+            control_message msg;
+            while (xQueueReceive(m_control_queue, &msg, 0) == pdTRUE)
+            {
+                if (msg.cmd)
+                    complete_command(msg.cmd, false);
+            }
+
+            ESP_LOGI(TAG, "Wi-Fi 控制任务已退出");
+
+            xSemaphoreGive(m_control_exit);
+            vTaskDelete(nullptr);
+        }
+
+        // 等待唤醒或最近的截止时间，然后处理所有待处理的驱动事件和消息
+        void poll_once()
+        {
+            TickType_t wait = portMAX_DELAY;
+            int64_t deadline = next_deadline();
+            if (deadline)
+            {
+                int64_t remain = deadline - esp_timer_get_time();
+                wait = remain > 0 ? pdMS_TO_TICKS(remain / 1000) + 1 : 0;
+            }
+
+            ulTaskNotifyTake(pdTRUE, wait);
+
+            // 驱动事件优先，命令可能依赖事件更新后的状态
+            driver_event ev;
+            while (m_event_ring.pop(ev))
+                handle_driver_event(ev);
+
+            // 丢弃过事件时按驱动的实际状态重新同步，丢失的状态事件不会让状态机停住
+            if (auto dropped = m_events_dropped.exchange(0))
+            {
+                ESP_LOGW(TAG, "事件缓冲区已满, 丢弃 %u 个事件, 重新同步驱动状态", (unsigned)dropped);
+                resync_driver_state();
+            }
+
+            control_message msg;
+            while (m_running && xQueueReceive(m_control_queue, &msg, 0) == pdTRUE)
+            {
+                if (msg.cmd)
+                    handle_command(msg.cmd);
+                else
+                    handle_driver_event(msg.event);
+            }
+
+            check_timeouts();
+        }
+
+        int64_t next_deadline() const
+        {
+            int64_t deadline = 0;
+
+            if (m_state == sta_state::CONNECTING)
+                deadline = m_connect_deadline;
+
+            if (m_scanning && (!deadline || m_scan_deadline < deadline))
+                deadline = m_scan_deadline;
+
+            if (link_timer_active() && (!deadline || m_link_timer_at < deadline))
+                deadline = m_link_timer_at;
+
+            if (m_rtt_cmd && (!deadline || m_rtt_deadline < deadline))
+                deadline = m_rtt_deadline;
+
+            if (m_ap_off_at && (!deadline || m_ap_off_at < deadline))
+                deadline = m_ap_off_at;
+
+            if (m_portal_timer_at && (!deadline || m_portal_timer_at < deadline))
+                deadline = m_portal_timer_at;
+
+            return deadline;
+        }
+
+        void check_timeouts()
+        {
+            auto now = esp_timer_get_time();
+
+            if (m_state == sta_state::CONNECTING && now >= m_connect_deadline)
+            {
+                ESP_LOGE(TAG, "Wi-Fi 连接超时");
+                esp_wifi_disconnect();
+                connect_failed(0, now);
+            }
+
+            if (m_scanning && now >= m_scan_deadline)
+            {
+                ESP_LOGE(TAG, "Wi-Fi 扫描超时");
+                esp_wifi_scan_stop();
+                finish_scan(false);
+            }
+
+            if (m_rtt_cmd && now >= m_rtt_deadline)
+            {
+                ESP_LOGW(TAG, "往返时延测量超时");
+                finish_rtt();
+            }
+
+            if (m_ap_off_at && now >= m_ap_off_at)
+                shutdown_portal(now);
+
+            if (m_portal_timer_at && now >= m_portal_timer_at)
+                check_portal_idle(now);
+
+            if (link_timer_active() && now >= m_link_timer_at)
+            {
+                if (m_state == sta_state::BACKOFF)
+                    reconnect_link();
+                else
+                    check_link(now);
+            }
+        }
+
+        void handle_command(command* cmd)
+        {
+            // 热点信道扫描期间驱动临时处于 STA 模式，除 STOP 外的命令都等热点创建完成后再执行
+            if (m_ap_cmd && cmd->type != command_type::STOP)
+            {
+                m_deferred.push_back(cmd);
+                return;
+            }
+
+            switch (cmd->type)
+            {
+            case command_type::AUTO_CONNECT:
+                do_auto_connect(cmd);
+                break;
+            case command_type::CONNECT:
+                do_connect(cmd);
+                break;
+#if WIFI_PROVISIONING_SCAN
+            case command_type::SCAN:
+                do_scan(cmd);
+                break;
+#endif
+            case command_type::START_AP:
+                do_create_ap(cmd);
+                break;
+            case command_type::START_SERVER:
+                do_start_session(cmd);
+                break;
+            case command_type::SET_SUPERVISOR:
+                do_set_supervisor(cmd);
+                break;
+            case command_type::SET_CONNECTION_CB:
+                m_connection_cb = cmd->connection_cb;
+                if (m_connection_cb && !m_abort)
+                    m_connection_cb(m_published);
+                complete_command(cmd, true);
+                break;
+            case command_type::SET_PROFILE:
+                do_set_profile(cmd);
+                break;
+            case command_type::SET_AP_GRACE:
+                m_ap_grace_ms = cmd->ap_grace_ms;
+                complete_command(cmd, true);
+                break;
+            case command_type::SET_AP_OPTIONS:
+                do_set_ap_options(cmd);
+                break;
+            case command_type::SET_PORTAL_IDLE:
+                do_set_portal_idle(cmd);
+                break;
+            case command_type::MEASURE_RTT:
+                do_measure_rtt(cmd);
+                break;
+            case command_type::RESUME_PSK:
+                do_resume_psk(cmd);
+                break;
+            case command_type::CANCEL:
+                do_cancel(cmd);
+                break;
+#if WIFI_PROVISIONING_MDNS
+            case command_type::START_MDNS:
+                complete_command(cmd, do_start_mdns(cmd->mdns));
+                break;
+            case command_type::STOP_MDNS:
+                do_stop_mdns();
+                complete_command(cmd, true);
+                break;
+#endif
+            case command_type::STOP:
+                do_stop(cmd->teardown);
+                complete_command(cmd, true);
+                break;
+            }
+        }
+
+        // 执行因状态冲突而推迟的命令
+        void run_deferred()
+        {
+            if (m_deferred.empty())
+                return;
+
+            auto deferred = std::move(m_deferred);
+            m_deferred.clear();
+
+            for (auto cmd : deferred)
+                handle_command(cmd);
+        }
+
+        //////////////// 跟踪 ////////////////
+
+        // 关闭 WIFI_PROVISIONING_TRACE 时为空函数，调用会被编译器完全去掉
+        void trace(const char* name, char phase, uint32_t arg = 0)
+        {
+#if WIFI_PROVISIONING_TRACE
+            m_trace.add(name, phase, arg);
+#endif
+        }
+
+        // 在作用域开始和结束时分别记录 'B' 和 'E'
+        class trace_scope
+        {
+            trace_scope(const trace_scope &) = delete;
+            trace_scope &operator=(const trace_scope &) = delete;
+
+        public:
+            trace_scope(wifi_provisioning_impl* self, const char* name, uint32_t arg = 0)
+                : m_self(self)
+                , m_name(name)
+            {
+                m_self->trace(m_name, 'B', arg);
+            }
+
+            ~trace_scope()
+            {
+                m_self->trace(m_name, 'E');
+            }
+
+        private:
+            wifi_provisioning_impl* m_self;
+            const char* m_name;
+        };
+
+        //////////////// 内存使用记录 ////////////////
+
+        static const char* phase_name(provisioning_phase phase)
+        {
+            static const char* names[PHASE_COUNT] = {
+                "phase:init", "phase:scan", "phase:config_server", "phase:connect"
+            };
+
+            return names[(int)phase];
+        }
+
+        void begin_phase(provisioning_phase phase)
+        {
+            trace(phase_name(phase), 'B');
+            m_phase_free[(int)phase] = esp_get_free_heap_size();
+        }
+
+        // 记录阶段结束时的堆和各任务栈的使用情况，栈高水位在 ESP-IDF 中以字节为单位
+        void end_phase(provisioning_phase phase)
+        {
+            auto& free_before = m_phase_free[(int)phase];
+            if (!free_before)
+                return;
+
+            trace(phase_name(phase), 'E');
+
+            memory_usage usage = {};
+            usage.recorded = true;
+            usage.free_before = free_before;
+            usage.free_after = esp_get_free_heap_size();
+            usage.min_free = esp_get_minimum_free_heap_size();
+            usage.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+            usage.control_stack_free = uxTaskGetStackHighWaterMark(nullptr);
+            usage.httpd_stack_free = m_httpd_stack_free;
+            usage.dns_stack_free = m_dns_stack_free;
+
+            free_before = 0;
+
+            ESP_LOGI(TAG, "阶段 %d 内存: 空闲堆 %u -> %u, 最小空闲堆 %u, 最大块 %u, 栈剩余 ctrl/httpd/dns %u/%u/%u",
+                (int)phase, (unsigned)usage.free_before, (unsigned)usage.free_after,
+                (unsigned)usage.min_free, (unsigned)usage.largest_block,
+                (unsigned)usage.control_stack_free, (unsigned)usage.httpd_stack_free,
+                (unsigned)usage.dns_stack_free);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_memory[(int)phase] = usage;
+        }
+
+        // 在 httpd 任务中调用，记录 httpd 任务栈的高水位，同时记为配置热点的一次活动
+        void update_httpd_stack()
+        {
+            m_httpd_stack_free = uxTaskGetStackHighWaterMark(nullptr);
+            mark_portal_activity();
+        }
+
+        //////////////// 分阶段初始化 ////////////////
+
+        // 按需初始化网络协议栈和 Wi-Fi 驱动，只创建 STA 接口。
+        // 返回 true 表示驱动是本次刚初始化的，调用者不需要再重新初始化。
+        bool ensure_driver()
+        {
+            if (m_driver_ready)
+                return false;
+
+            begin_phase(provisioning_phase::INIT);
+
+            auto start = esp_timer_get_time();
+
+            // 初始化网络协议栈
+            ESP_ERROR_CHECK(esp_netif_init());
+
+            // 应用可能已经创建了默认事件循环，只有自己创建的才在 FULL 模式下删除
+            auto err = esp_event_loop_create_default();
+            if (err != ESP_ERR_INVALID_STATE)
+                ESP_ERROR_CHECK(err);
+            m_own_event_loop = err == ESP_OK;
+
+            m_sta_netif = esp_netif_create_default_wifi_sta();
+
+#if WIFI_PROVISIONING_MDNS
+            // DHCP 请求中也使用 mDNS 的主机名，这样在路由器的客户端列表中也能找到设备
+            if (!m_mdns_options.hostname.empty())
+                esp_netif_set_hostname(m_sta_netif, m_mdns_options.hostname.c_str());
+#endif
+
+            // 初始化 Wi-Fi
+            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+
+            ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+            reset_event_handler();
+
+            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+            m_driver_ready = true;
+
+            ESP_LOGI(TAG, "Wi-Fi 驱动初始化耗时 %d us", (int)(esp_timer_get_time() - start));
+
+            end_phase(provisioning_phase::INIT);
+
+            return true;
+        }
+
+        // 热点接口（包括 DHCP 服务器）只在第一次创建热点时创建
+        void ensure_ap_netif()
+        {
+            if (!m_ap_netif)
+                m_ap_netif = esp_netif_create_default_wifi_ap();
+        }
+
+        //////////////// 命令实现 ////////////////
+
+        void do_auto_connect(command* cmd)
+        {
+            m_retry_count = 0;
+
+            if (cmd->resume)
+            {
+                if (load_resume_record(m_resume))
+                {
+                    timeval now;
+                    gettimeofday(&now, nullptr);
+
+                    // 时钟被 SNTP 等调整过时 age 可能为负数，此时不复用租约
+                    auto age = (int64_t)now.tv_sec - m_resume.saved_at;
+                    m_resume_lease = m_resume.ip && age >= 0 && age < RESUME_LEASE_MAX_AGE_S;
+
+                    ESP_LOGI(TAG, "从 RTC 记录恢复连接 %s, 信道: %d, %s", m_resume.ssid, m_resume.channel,
+                        m_resume_lease ? "复用 IP 地址租约" : "重新获取 IP 地址");
+
+                    cmd->ssid = m_resume.ssid;
+                    cmd->password = m_resume.secret;
+                    cmd->channel = m_resume.channel;
+
+                    // 记录中没有 PSK（非 WPA/WPA2-PSK 网络，或 PSK 尚未算出）时从 NVS 读取密码
+                    if (!m_resume.secret[0])
+                    {
+                        stored_credentials cred;
+                        if (!m_store.load(cred) || cmd->ssid != cred.ssid)
+                        {
+                            ESP_LOGW(TAG, "NVS 中没有 %s 的 Wi-Fi 配置, 改用普通的自动连接", m_resume.ssid);
+                            resume_fallback(cmd);
+                            return;
+                        }
+
+                        cmd->password = cred.password;
+                    }
+
+                    cmd->reinit_driver = true;
+                    do_connect(cmd);
+                    return;
+                }
+
+                ESP_LOGI(TAG, "RTC 中没有有效的连接记录, 使用普通的自动连接");
+                cmd->resume = false;
+            }
+
+            ESP_LOGI(TAG, "开始自动连接 Wi-Fi ...");
+
+            // 首先从 NVS 中读取 Wi-Fi 配置，如果读取成功，则直接连接。
+            auto load_start = esp_timer_get_time();
+
+            stored_credentials cred;
+            if (!m_store.load(cred))
+            {
+                ESP_LOGI(TAG, "没有有效的 Wi-Fi 配置, 开始配网");
+                complete_command(cmd, false);
+                return;
+            }
+
+            cmd->load_us = esp_timer_get_time() - load_start;
+            ESP_LOGI(TAG, "读取 Wi-Fi 配置耗时 %d us", (int)cmd->load_us);
+
+            cmd->ssid = cred.ssid;
+            cmd->password = cred.password;
+            cmd->channel = cred.channel;
+
+            // 连接到 Wi-Fi
+            cmd->reinit_driver = true;
+            do_connect(cmd);
+        }
+
+        void do_connect(command* cmd)
+        {
+            // 密码为 0~63 个字符，或 64 个十六进制字符的 PSK（从 RTC 记录恢复时使用的就是 PSK），
+            // 后者正好占满 wifi_sta_config_t::password，不带结尾的 '\0'
+            bool password_ok = cmd->password.size() < sizeof(wifi_sta_config_t::password) ||
+                (cmd->password.size() == sizeof(wifi_sta_config_t::password) && is_hex_string(cmd->password));
+
+            if (cmd->ssid.empty() || cmd->ssid.size() > sizeof(wifi_sta_config_t::ssid) || !password_ok)
+            {
+                // RTC 记录中的配置无效时与恢复连接失败相同，退回普通的自动连接
+                if (cmd->resume && !m_abort)
+                {
+                    ESP_LOGW(TAG, "RTC 记录中的 Wi-Fi 配置无效, 改用普通的自动连接");
+                    resume_fallback(cmd);
+                    return;
+                }
+
+                ESP_LOGE(TAG, "Wi-Fi 配置无效");
+                complete_command(cmd, false);
+                return;
+            }
+
+            if (cmd->verify)
+            {
+                // 浏览器没有收到结果而重新提交相同的凭据时，加入正在进行的验证或直接返回已有的结果，
+                // 而不是重新开始一轮连接
+                if (m_connect_cmd && m_connect_cmd->verify &&
+                    m_connect_cmd->ssid == cmd->ssid && m_connect_cmd->password == cmd->password)
+                {
+                    m_connect_joiners.push_back(cmd);
+                    return;
+                }
+
+                if (m_state == sta_state::CONNECTED &&
+                    m_link_ssid == cmd->ssid && m_link_password == cmd->password)
+                {
+                    store_link_credentials();
+                    set_verify_state(wifi_status::CONNECTED, cmd->ssid, 0);
+                    complete_command(cmd, true);
+                    return;
+                }
+
+                set_verify_state(wifi_status::CONNECTING, cmd->ssid, 0);
+            }
+
+            // 新的连接请求取代正在进行的连接
+            if (m_connect_cmd)
+            {
+                ESP_LOGW(TAG, "取消正在进行的 Wi-Fi 连接");
+                finish_connect(false, 0, esp_timer_get_time());
+            }
+
+            // 停止 Wi-Fi 扫描
+            if (m_scanning)
+            {
+                esp_wifi_scan_stop();
+                finish_scan(false);
+            }
+
+            m_current_ssid = cmd->ssid;
+            publish_connection();
+
+            // 配置服务器运行时不能重新初始化驱动，否则会关闭用户正在使用的热点
+            if (m_httpd_server)
+                cmd->reinit_driver = false;
+
+            // 保存 Wi-Fi 模式，热点仍在工作时处于 APSTA 模式
+            m_wifi_mode = (m_ap_active && !cmd->reinit_driver) ? WIFI_MODE_APSTA : WIFI_MODE_STA;
+
+            // 用户发起的连接取代链路监控的重连
+            m_supervised = false;
+            m_link_attempts = 0;
+
+            begin_phase(provisioning_phase::CONNECT);
+
+            // 开始记录本次连接各阶段的耗时
+            begin_connect_record();
+
+            if (cmd->load_us)
+            {
+                auto load_us = cmd->load_us;
+                update_connect_record([load_us](wifi_connect_record& r, connect_marks& m, int64_t now)
+                    { r.load_us = load_us; });
+            }
+
+            if (cmd->resume)
+            {
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                    { r.resumed = true; });
+            }
+
+            // 第一次连接时才初始化驱动，刚初始化的驱动不需要再重新初始化
+            bool fresh = ensure_driver();
+
+            if (cmd->reinit_driver && !fresh)
+            {
+                stop_gateway_ping();
+
+                // 初始化 Wi-Fi
+                wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+
+                ESP_ERROR_CHECK(esp_wifi_stop());
+                ESP_ERROR_CHECK(esp_wifi_deinit());
+                ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+                ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+                m_wifi_start = false;
+                m_ap_active = false;
+                m_state = sta_state::IDLE;
+            }
+
+            if (fresh || cmd->reinit_driver)
+            {
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                    { r.init_us = now - r.timestamp_us; });
+            }
+
+            // 从 RTC 记录恢复时在关联成功后直接设置记录中的地址，其它连接使用 DHCP
+            set_dhcp(!(cmd->resume && m_resume_lease));
+
+            // 从 RTC 记录恢复时锁定到记录中的 AP，只在其信道上探测
+            m_connect_cmd = cmd;
+            start_connect(cmd->ssid, cmd->password, cmd->resume ? m_resume.bssid : nullptr, cmd->channel);
+        }
+
+        // 启用或停止 STA 接口的 DHCP 客户端。停止时由 apply_resume_lease 在每次关联成功后设置地址
+        void set_dhcp(bool enable)
+        {
+            if (enable == !m_static_ip)
+                return;
+
+            m_static_ip = !enable;
+            if (enable)
+                esp_netif_dhcpc_start(m_sta_netif);
+            else
+                esp_netif_dhcpc_stop(m_sta_netif);
+        }
+
+        // 设置 RTC 记录中的地址租约，esp_netif 随后产生 IP_EVENT_STA_GOT_IP，与 DHCP 获取到地址时相同
+        void apply_resume_lease()
+        {
+            esp_netif_ip_info_t ip_info = {};
+            ip_info.ip.addr = m_resume.ip;
+            ip_info.netmask.addr = m_resume.netmask;
+            ip_info.gw.addr = m_resume.gw;
+
+            auto err = esp_netif_set_ip_info(m_sta_netif, &ip_info);
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "设置 IP 地址失败: %s", esp_err_to_name(err));
+                return;
+            }
+
+            if (m_resume.dns)
+            {
+                esp_netif_dns_info_t dns = {};
+                dns.ip.type = ESP_IPADDR_TYPE_V4;
+                dns.ip.u_addr.ip4.addr = m_resume.dns;
+                esp_netif_set_dns_info(m_sta_netif, ESP_NETIF_DNS_MAIN, &dns);
+            }
+        }
+
+        // 连接成功后更新 RTC 中的连接记录，供深度睡眠唤醒后的 resume_connect 使用。
+        // 记录中只保存 PSK，不保存密码。PSK 的计算需要数百毫秒，只在 SSID 或密码变化时由后台任务进行，
+        // 算出之前记录中的 PSK 为空，其余情况沿用已有记录中的 PSK。
+        void save_resume_record()
+        {
+            wifi_ap_record_t ap_info;
+            esp_netif_ip_info_t ip_info;
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK ||
+                esp_netif_get_ip_info(m_sta_netif, &ip_info) != ESP_OK)
+                return;
+
+            resume_record rec;
+            memset(&rec, 0, sizeof(rec));
+
+            if (m_link_ssid.size() >= sizeof(rec.ssid))
+                return;
+
+            rec.magic = RESUME_RECORD_MAGIC;
+            rec.version = RESUME_RECORD_VERSION;
+            rec.channel = ap_info.primary;
+            memcpy(rec.bssid, ap_info.bssid, sizeof(rec.bssid));
+            memcpy(rec.ssid, m_link_ssid.data(), m_link_ssid.size());
+
+            // WPA3（SAE）不使用预先计算的 PSK，只对纯 WPA/WPA2-PSK 网络计算。
+            // 其它网络不在 RTC 内存中保存任何与密码有关的内容，secret 和 password_crc 保持为空
+            bool psk = ap_info.authmode == WIFI_AUTH_WPA_PSK || ap_info.authmode == WIFI_AUTH_WPA2_PSK ||
+                ap_info.authmode == WIFI_AUTH_WPA_WPA2_PSK;
+
+            if (psk)
+                rec.password_crc = esp_crc32_le(0, (const uint8_t *)m_link_password.data(), m_link_password.size());
+
+            resume_record old;
+            bool same_network = load_resume_record(old) && m_link_ssid == old.ssid;
+
+            bool derive = false;
+            if (psk && m_link_password.size() == 64)
+            {
+                // 密码本身就是 PSK（do_connect 已检查过是十六进制），包括从记录恢复的连接。
+                // 与记录中的 PSK 相同时沿用原密码的 CRC，以后用原密码连接时仍可沿用 PSK
+                memcpy(rec.secret, m_link_password.data(), m_link_password.size());
+                if (same_network && m_link_password == old.secret)
+                    rec.password_crc = old.password_crc;
+            }
+            else if (psk && same_network && rec.password_crc == old.password_crc && strlen(old.secret) == 64)
+            {
+                memcpy(rec.secret, old.secret, sizeof(rec.secret));
+            }
+            else if (psk)
+            {
+                derive = true;
+            }
+
+            // 复用的租约从上次通过 DHCP 获取地址时开始计算有效期，避免一直沿用路由器已经收回的地址
+            timeval now;
+            gettimeofday(&now, nullptr);
+            rec.saved_at = (m_static_ip && same_network) ? old.saved_at : now.tv_sec;
+
+            rec.ip = ip_info.ip.addr;
+            rec.netmask = ip_info.netmask.addr;
+            rec.gw = ip_info.gw.addr;
+
+            esp_netif_dns_info_t dns = {};
+            if (esp_netif_get_dns_info(m_sta_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK &&
+                dns.ip.type == ESP_IPADDR_TYPE_V4)
+                rec.dns = dns.ip.u_addr.ip4.addr;
+
+            rec.crc = resume_record_crc(rec);
+            rtc_resume_record = rec;
+
+            if (derive)
+                start_psk_task();
+        }
+
+        // 在低优先级的任务中为当前连接计算 PSK，避免阻塞控制任务。同一时间只有一个计算任务，
+        // 正在计算时直接返回，结果不再对应当前记录时 do_resume_psk 会重新开始计算
+        void start_psk_task()
+        {
+            if (m_psk_task)
+            {
+                // 结果没能提交（例如队列已满）时任务已经退出，在这里回收
+                if (!uxSemaphoreGetCount(m_psk_exit))
+                    return;
+                join_psk_task();
+            }
+
+            // 计算任务运行期间控制任务不修改这三个成员
+            m_psk_ssid = m_link_ssid;
+            m_psk_password = m_link_password;
+            m_psk_seq++;
+
+            m_psk_exit = xSemaphoreCreateBinary();
+            if (!m_psk_exit || xTaskCreate([](void* arg) {
+                auto self = static_cast<wifi_provisioning_impl*>(arg);
+                self->psk_handler();
+                xSemaphoreGive(self->m_psk_exit);
+                vTaskDelete(nullptr);
+            }, "wifi_psk", PSK_TASK_STACK_SIZE, this, PSK_TASK_PRIORITY, &m_psk_task) != pdPASS)
+            {
+                ESP_LOGW(TAG, "创建 PSK 计算任务失败");
+                m_psk_task = nullptr;
+                if (m_psk_exit)
+                {
+                    vSemaphoreDelete(m_psk_exit);
+                    m_psk_exit = nullptr;
+                }
+                m_psk_password.clear();
+            }
+        }
+
+        // 计算任务：算出 PSK 后提交 RESUME_PSK 命令，计算失败时提交空的 PSK
+        void psk_handler()
+        {
+            auto cmd = new command;
+            cmd->type = command_type::RESUME_PSK;
+            cmd->seq = m_psk_seq;
+            cmd->ssid = m_psk_ssid;
+            cmd->password_crc = esp_crc32_le(0, (const uint8_t *)m_psk_password.data(), m_psk_password.size());
+
+            char psk[65];
+            if (derive_psk(m_psk_ssid, m_psk_password, psk))
+                cmd->password = psk;
+
+            submit(cmd);
+        }
+
+        // 等待计算任务退出并清除密码副本。任务提交结果后立即退出，do_stop 中最多等待一次 PSK 计算
+        void join_psk_task()
+        {
+            if (!m_psk_task)
+                return;
+
+            xSemaphoreTake(m_psk_exit, portMAX_DELAY);
+            vSemaphoreDelete(m_psk_exit);
+            m_psk_exit = nullptr;
+            m_psk_task = nullptr;
+
+            std::fill(m_psk_password.begin(), m_psk_password.end(), 0);
+            m_psk_password.clear();
+        }
+
+        // 把算出的 PSK 写入 RTC 记录。计算期间记录可能已经换成其它网络或密码，此时按当前连接重新保存，
+        // 记录已经作废（例如 clear_wifi_config）时不再写入
+        void do_resume_psk(command* cmd)
+        {
+            // 结果没能及时处理时 start_psk_task 可能已经回收了提交它的任务并开始了新的计算
+            if (cmd->seq == m_psk_seq)
+                join_psk_task();
+
+            resume_record rec;
+            if (!load_resume_record(rec))
+            {
+                complete_command(cmd, false);
+                return;
+            }
+
+            if (rec.secret[0] || cmd->ssid != rec.ssid || cmd->password_crc != rec.password_crc)
+            {
+                if (m_state == sta_state::CONNECTED)
+                    save_resume_record();
+                complete_command(cmd, false);
+                return;
+            }
+
+            if (cmd->password.size() != 64)
+            {
+                ESP_LOGW(TAG, "计算 %s 的 PSK 失败", rec.ssid);
+                complete_command(cmd, false);
+                return;
+            }
+
+            memcpy(rec.secret, cmd->password.data(), cmd->password.size());
+            rec.crc = resume_record_crc(rec);
+            rtc_resume_record = rec;
+
+            ESP_LOGI(TAG, "已在 RTC 记录中保存 %s 的 PSK", rec.ssid);
+            complete_command(cmd, true);
+        }
+
+        // 设置 STA 配置并发起连接，进入 CONNECTING 状态。
+        // bssid 不为空时锁定到指定的 AP，并只在给定信道上快速扫描；
+        // 否则进行全信道扫描，channel 不为 0 时从该信道开始扫描。
+        void start_connect(const std::string& ssid, const std::string& password, const uint8_t* bssid, uint8_t channel)
+        {
+            stop_gateway_ping();
+
+            if (m_state == sta_state::CONNECTED)
+            {
+                // 断开当前连接，由此产生的断开事件会在 CONNECTING 状态下被忽略
+                esp_wifi_disconnect();
+            }
+
+            // 设置 Wi-Fi 配置并连接到 Wi-Fi
+            wifi_config_t wifi_config = {};
+            memset(&wifi_config, 0, sizeof(wifi_config_t));
+
+            memcpy(wifi_config.sta.ssid, ssid.data(), ssid.size());
+            memcpy(wifi_config.sta.password, password.data(), password.size());
+
+            if (bssid)
+            {
+                wifi_config.sta.bssid_set = true;
+                memcpy(wifi_config.sta.bssid, bssid, sizeof(wifi_config.sta.bssid));
+                wifi_config.sta.channel = channel;
+                wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+            }
+            else
+            {
+                wifi_config.sta.channel = channel;
+                wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+            }
+
+            wifi_config.sta.failure_retry_cnt = 1;
+
+            // listen_interval 只在关联 AP 时协商，运行时切换模式需要等到下次连接
+            if (m_profile == link_profile::LOW_POWER)
+                wifi_config.sta.listen_interval = m_listen_interval;
+
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+            m_attempt_ssid = ssid;
+            m_attempt_password = password;
+
+            m_state = sta_state::CONNECTING;
+            m_connect_deadline = esp_timer_get_time() + CONNECT_TIMEOUT_US;
+
+            ESP_LOGI(TAG, "开始连接 WiFi %s", ssid.c_str());
+
+            if (!m_wifi_start)
+            {
+                // 驱动启动后在 WIFI_EVENT_STA_START 事件中发起连接，在此之前收到的断开事件
+                // 都来自上一次连接，需要忽略
+                m_connect_on_start = true;
+
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                    { m.start_requested = now; });
+
+                ESP_ERROR_CHECK(esp_wifi_start());
+                m_wifi_start = true;
+                return;
+            }
+
+            start_sta_connect();
+        }
+
+        void start_sta_connect()
+        {
+            update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                { m.connect_requested = now; });
+
+            auto ret = esp_wifi_connect();
+            if (ret != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Wi-Fi 连接失败: %s", esp_err_to_name(ret));
+                connect_failed(0, esp_timer_get_time());
+            }
+        }
+
+        // 连接尝试本身失败（驱动报告断开、超时或发起连接出错）。从 RTC 记录恢复失败（例如 AP
+        // 更换了信道或已经不在）时作废记录，同一个命令退回普通的自动连接，其它情况结束连接
+        void connect_failed(uint8_t reason, int64_t now)
+        {
+            auto cmd = m_connect_cmd;
+            if (!cmd || !cmd->resume || m_abort)
+            {
+                finish_connect(false, reason, now);
+                return;
+            }
+
+            ESP_LOGW(TAG, "从 RTC 记录恢复连接失败, reason: %d, 改用普通的自动连接", reason);
+
+            finish_connect_record(wifi_status::FAILED, reason, now);
+
+            m_connect_cmd = nullptr;
+            m_connect_on_start = false;
+            m_state = sta_state::IDLE;
+
+            resume_fallback(cmd);
+        }
+
+        // 作废 RTC 中的连接记录，同一个命令改用普通的自动连接
+        void resume_fallback(command* cmd)
+        {
+            rtc_resume_record.magic = 0;
+            cmd->resume = false;
+            do_auto_connect(cmd);
+        }
+
+        // 结束当前的连接命令，并切换状态机
+        void finish_connect(bool success, uint8_t reason, int64_t now)
+        {
+            auto cmd = m_connect_cmd;
+            auto joiners = std::move(m_connect_joiners);
+
+            m_connect_cmd = nullptr;
+            m_connect_joiners.clear();
+            m_connect_on_start = false;
+
+            finish_connect_record(success ? wifi_status::CONNECTED : wifi_status::FAILED, reason, now);
+
+            if (success)
+            {
+                ESP_LOGI(TAG, "Wi-Fi 连接成功, 启动后 %d ms, 空闲堆 %u 字节",
+                    (int)(now / 1000), (unsigned)esp_get_free_heap_size());
+
+                // 记住本次连接，供链路监控重连和漫游使用
+                m_state = sta_state::CONNECTED;
+                m_link_ssid = m_attempt_ssid;
+                m_link_password = m_attempt_password;
+                m_link_attempts = 0;
+                m_supervised = true;
+
+                update_link_rssi();
+                m_link_timer_at = now + (int64_t)m_supervisor.rssi_check_interval_ms * 1000;
+                start_gateway_ping();
+                apply_power_save();
+
+                if (cmd && cmd->verify)
+                    store_link_credentials();
+                else if (cmd && cmd->type == command_type::AUTO_CONNECT && !cmd->resume)
+                    update_stored_channel();
+
+                save_resume_record();
+            }
+            else
+            {
+                ESP_LOGE(TAG, "Wi-Fi 连接失败");
+
+                m_link_reason = reason;
+
+                // 只有链路监控自己发起的重连才继续退避重连，用户发起的连接失败时交由用户处理
+                if (!cmd && m_supervised && m_supervisor.auto_reconnect)
+                {
+                    enter_backoff(now);
+                }
+                else
+                {
+                    m_state = sta_state::IDLE;
+                    m_supervised = false;
+                }
+            }
+
+            if (cmd && cmd->verify)
+            {
+                set_verify_state(success ? wifi_status::CONNECTED : wifi_status::FAILED, cmd->ssid, reason);
+
+                if (success)
+                    finish_session(true);
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+                // 配网成功后联网检测返回“已联网”，客户端不再弹出门户页面
+                m_probe_success = success;
+#endif
+
+                // 验证成功后热点再保留一段时间，让浏览器取得结果
+                if (success && m_ap_active && m_ap_grace_ms >= 0)
+                {
+                    m_ap_off_at = now + (int64_t)m_ap_grace_ms * 1000;
+                    ESP_LOGI(TAG, "%d ms 后关闭配置热点", m_ap_grace_ms);
+                }
+            }
+
+            if (cmd)
+            {
+                end_phase(provisioning_phase::CONNECT);
+                complete_command(cmd, success);
+            }
+
+            for (auto joiner : joiners)
+                complete_command(joiner, success);
+
+            report_link();
+            run_deferred();
+        }
+
+        //////////////// 异步接口 ////////////////
+
+        // 创建热点并启动配置服务器，热点创建完成后由 finish_start_server 完成命令
+        void do_start_session(command* cmd)
+        {
+            begin_phase(provisioning_phase::CONFIG_SERVER);
+            do_create_ap(cmd);
+        }
+
+        // 热点创建完成后启动 DNS 和 HTTP 服务器。任何一步失败时关闭已经启动的服务器和热点，
+        // 之后仍会重新广播时保持 SLEEPING。带有 done_cb 的命令在服务器启动成功后开始一次配网会话
+        void finish_start_server(command* cmd, bool ap_ok)
+        {
+            bool result = ap_ok && start_portal_services(cmd->port);
+
+            if (ap_ok && !result)
+                stop_portal(m_portal_state == portal_state::SLEEPING ? portal_state::SLEEPING : portal_state::OFF);
+
+            end_phase(provisioning_phase::CONFIG_SERVER);
+
+#if WIFI_PROVISIONING_SCAN
+            // 预先扫描一次，配置页面打开时即可直接返回网络列表；选择信道时刚扫描过则不再扫描
+            if (result && (!m_wifi_list_time || esp_timer_get_time() - m_wifi_list_time > SCAN_CACHE_US))
+            {
+                auto scan = new command;
+                scan->type = command_type::SCAN;
+                do_scan(scan);
+            }
+#endif
+
+            if (cmd->readvertise)
+            {
+                auto now = esp_timer_get_time();
+                if (result)
+                {
+                    m_window_started = now;
+                    set_portal_state(portal_state::ADVERTISING);
+                }
+
+                schedule_portal_timer(now);
+                complete_command(cmd, result);
+                return;
+            }
+
+            if (result)
+            {
+                // 保存参数供重新广播使用，空闲时间从服务器启动时开始计算
+                m_portal_ssid = cmd->ssid;
+                m_portal_password = cmd->password;
+                m_portal_port = cmd->port;
+
+                auto now = esp_timer_get_time();
+                m_portal_activity = now;
+                set_portal_state(portal_state::ACTIVE);
+                schedule_portal_timer(now);
+            }
+
+            if (result && cmd->done_cb)
+            {
+                // 新的会话取代之前的会话
+                finish_session(false);
+
+                m_session_cb = std::move(cmd->done_cb);
+                cmd->done_cb = nullptr;
+                m_session_seq = cmd->seq;
+            }
+
+            complete_command(cmd, result);
+        }
+
+        void finish_session(bool success)
+        {
+            auto session_cb = std::move(m_session_cb);
+            m_session_cb = nullptr;
+            m_session_seq = 0;
+
+            if (session_cb)
+                session_cb(success);
+        }
+
+        void do_cancel(command* cmd)
+        {
+            if (m_connect_cmd && m_connect_cmd->seq == cmd->target)
+            {
+                ESP_LOGW(TAG, "取消 Wi-Fi 连接");
+
+                esp_wifi_disconnect();
+                finish_connect(false, 0, esp_timer_get_time());
+            }
+            else if (m_session_cb && m_session_seq == cmd->target)
+            {
+                ESP_LOGW(TAG, "取消配网会话, 关闭配置热点");
+
+                stop_portal();
+            }
+
+            complete_command(cmd, true);
+        }
+
+        //////////////// 配网验证 ////////////////
+
+        void set_verify_state(wifi_status state, const std::string& ssid, uint8_t reason)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_verify_state = state;
+            m_verify_ssid = ssid;
+            m_verify_reason = reason;
+            m_verify_ip = state == wifi_status::CONNECTED ? m_link_ip : esp_ip4_addr_t{};
+        }
+
+        // 宽限期结束，关闭配置服务器、DNS 服务器和热点，只保留 STA 连接
+        void shutdown_portal(int64_t now)
+        {
+            m_ap_off_at = 0;
+
+            // 宽限期内 STA 连接已经断开时保留热点，以便用户重新配置
+            if (m_state != sta_state::CONNECTED || !m_ap_active)
+                return;
+
+            if (portal_busy())
+            {
+                m_ap_off_at = now + AP_SHUTDOWN_RETRY_US;
+                return;
+            }
+
+            ESP_LOGI(TAG, "关闭配置热点");
+
+            stop_portal();
+        }
+
+        // httpd 任务可能正在等待扫描或被推迟的命令，先等它们结束，否则 httpd_stop 会一直等待。
+        // 正在进行的 OTA 升级也等它结束
+        bool portal_busy() const
+        {
+            bool busy = m_scanning || !m_deferred.empty();
+#if WIFI_PROVISIONING_OTA
+            busy = busy || m_ota_busy;
+#endif
+            return busy;
+        }
+
+        // 关闭配置服务器、DNS 服务器和热点，并释放热点接口（包括 DHCP 服务器），只保留 STA。
+        // next 为关闭后的配置热点状态，之后还会重新广播时为 SLEEPING
+        void stop_portal(portal_state next = portal_state::OFF)
+        {
+            m_portal_timer_at = 0;
+
+            stop_http_server();
+
+#if WIFI_PROVISIONING_DNS
+            stop_dns();
+#endif
+
+            if (m_ap_active)
+            {
+                auto err = esp_wifi_set_mode(WIFI_MODE_STA);
+                if (err != ESP_OK)
+                    ESP_LOGW(TAG, "切换到 STA 模式失败: %s", esp_err_to_name(err));
+
+                m_ap_active = false;
+                m_wifi_mode = WIFI_MODE_STA;
+            }
+
+            if (m_ap_netif)
+            {
+                esp_netif_destroy_default_wifi(m_ap_netif);
+                m_ap_netif = nullptr;
+            }
+
+            m_ap_ip = {};
+            m_ap_stations = 0;
+            publish_connection();
+
+            set_portal_state(next);
+
+            // 配置热点在配网成功前被关闭，之后还会重新广播时保留配网会话
+            if (next == portal_state::OFF)
+                finish_session(false);
+        }
+
+        //////////////// 配置热点的空闲超时 ////////////////
+
+        void do_set_portal_idle(command* cmd)
+        {
+            m_portal_idle = cmd->portal_idle;
+            m_portal_cb = cmd->portal_cb;
+
+            // 空闲时间从设置时重新计算
+            auto now = esp_timer_get_time();
+            m_portal_activity = now;
+
+            // 不再重新广播时，已经关闭的配置热点不会再开启
+            if (m_portal_state == portal_state::SLEEPING && !m_portal_idle.readvertise_interval_ms)
+            {
+                set_portal_state(portal_state::OFF);
+                finish_session(false);
+            }
+
+            schedule_portal_timer(now);
+            complete_command(cmd, true);
+        }
+
+        // 在 httpd 任务、DNS 任务和控制任务中调用，记录配置热点最近一次活动的时刻
+        void mark_portal_activity()
+        {
+            m_portal_activity.store(esp_timer_get_time(), std::memory_order_relaxed);
+        }
+
+        void set_portal_state(portal_state state)
+        {
+            if (m_portal_state == state)
+                return;
+
+            m_portal_state = state;
+            trace("portal", 'i', (uint32_t)state);
+
+            if (m_portal_cb && !m_abort)
+                m_portal_cb(state);
+        }
+
+        // 按当前状态计算下一次检查的时刻，0 表示不需要检查
+        void schedule_portal_timer(int64_t now)
+        {
+            int64_t activity = m_portal_activity.load(std::memory_order_relaxed);
+            int64_t reduce_at = m_portal_idle.reduce_ms ? activity + m_portal_idle.reduce_ms * 1000LL : 0;
+            int64_t shutdown_at = m_portal_idle.shutdown_ms ? activity + m_portal_idle.shutdown_ms * 1000LL : 0;
+
+            switch (m_portal_state)
+            {
+            case portal_state::ACTIVE:
+                m_portal_timer_at = reduce_at && (!shutdown_at || reduce_at < shutdown_at) ? reduce_at : shutdown_at;
+                break;
+            case portal_state::REDUCED:
+                m_portal_timer_at = shutdown_at;
+                break;
+            case portal_state::ADVERTISING:
+                m_portal_timer_at = m_window_started + m_portal_idle.readvertise_window_ms * 1000LL;
+                break;
+            case portal_state::SLEEPING:
+                m_portal_timer_at = m_portal_idle.readvertise_interval_ms ?
+                    now + m_portal_idle.readvertise_interval_ms * 1000LL : 0;
+                break;
+            default:
+                m_portal_timer_at = 0;
+                break;
+            }
+        }
+
+        void check_portal_idle(int64_t now)
+        {
+            m_portal_timer_at = 0;
+
+            // 有客户端连接到热点时不算空闲
+            if (m_ap_stations > 0)
+                m_portal_activity = now;
+
+            int64_t idle_ms = (now - m_portal_activity.load(std::memory_order_relaxed)) / 1000;
+
+            // 配网验证期间 httpd 任务可能在等待结果
+            bool busy = portal_busy() || m_connect_cmd;
+
+            switch (m_portal_state)
+            {
+            case portal_state::ACTIVE:
+            case portal_state::REDUCED:
+                if (m_portal_idle.shutdown_ms && idle_ms >= m_portal_idle.shutdown_ms)
+                {
+                    if (busy)
+                        break;
+
+                    ESP_LOGI(TAG, "配置热点空闲 %lld ms, 关闭热点", (long long)idle_ms);
+                    sleep_portal();
+                }
+                else if (m_portal_state == portal_state::ACTIVE &&
+                    m_portal_idle.reduce_ms && idle_ms >= m_portal_idle.reduce_ms)
+                {
+                    if (busy)
+                        break;
+
+                    ESP_LOGI(TAG, "配置热点空闲 %lld ms, 停止 HTTP 和 DNS 服务器", (long long)idle_ms);
+                    reduce_portal();
+                }
+                schedule_portal_timer(now);
+                return;
+            case portal_state::ADVERTISING:
+                // 窗口内有过活动时恢复正常的空闲超时
+                if (m_portal_activity.load(std::memory_order_relaxed) > m_window_started)
+                {
+                    set_portal_state(portal_state::ACTIVE);
+                    schedule_portal_timer(now);
+                    return;
+                }
+
+                if (busy)
+                    break;
+
+                ESP_LOGI(TAG, "重新广播期间没有活动, 关闭热点");
+                sleep_portal();
+                schedule_portal_timer(now);
+                return;
+            case portal_state::SLEEPING:
+                readvertise_portal();
+                schedule_portal_timer(now);
+                return;
+            default:
+                return;
+            }
+
+            // 有未完成的扫描或命令，稍后再试
+            m_portal_timer_at = now + AP_SHUTDOWN_RETRY_US;
+        }
+
+        // 停止 HTTP 和 DNS 服务器并释放扫描结果，热点保持运行，只发送 beacon
+        void reduce_portal()
+        {
+            stop_http_server();
+
+#if WIFI_PROVISIONING_DNS
+            stop_dns();
+#endif
+
+#if WIFI_PROVISIONING_SCAN
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::vector<wifi_network>().swap(m_wifi_list);
+                m_wifi_list_time = 0;
+            }
+#endif
+
+            set_portal_state(portal_state::REDUCED);
+        }
+
+        // 客户端连接到处于 REDUCED 状态的热点，重新启动 DNS 和 HTTP 服务器。
+        // 启动失败时与空闲超时相同，关闭热点，配置了重新广播时由下一个广播窗口重试
+        void resume_portal()
+        {
+            ESP_LOGI(TAG, "客户端连接, 恢复配置服务器");
+
+            bool ok = true;
+
+#if WIFI_PROVISIONING_DNS
+            ok = start_dns();
+#endif
+
+#if WIFI_PROVISIONING_ASSETS
+            if (ok)
+                m_assets.map();
+#endif
+
+            if (!ok || !start_http_server(m_portal_port))
+            {
+                ESP_LOGE(TAG, "恢复配置服务器失败, 关闭配置热点");
+                sleep_portal();
+                return;
+            }
+
+            set_portal_state(portal_state::ACTIVE);
+        }
+
+        void sleep_portal()
+        {
+            stop_portal(m_portal_idle.readvertise_interval_ms ? portal_state::SLEEPING : portal_state::OFF);
+        }
+
+        // 按保存的参数重新启动配置服务器，开始一个重新广播窗口
+        void readvertise_portal()
+        {
+            // 重新创建热点会中断 STA 的连接和扫描，STA 已经连接或正在连接时跳过这次广播
+            if (m_state != sta_state::IDLE || portal_busy() || m_connect_cmd)
+                return;
+
+            ESP_LOGI(TAG, "重新广播配置热点");
+
+            auto cmd = new command;
+            cmd->type = command_type::START_SERVER;
+            cmd->ssid = m_portal_ssid;
+            cmd->password = m_portal_password;
+            cmd->port = m_portal_port;
+            cmd->readvertise = true;
+            do_start_session(cmd);
+        }
+
+        // 停止并释放 Wi-Fi 驱动、STA 接口和自己创建的默认事件循环。
+        // 只能在控制任务中，或控制任务退出后调用。
+        void release_driver()
+        {
+            if (!m_driver_ready)
+                return;
+
+            ESP_LOGI(TAG, "释放 Wi-Fi 驱动");
+
+            esp_wifi_disconnect();
+            esp_wifi_stop();
+            esp_wifi_deinit();
+
+            if (m_ap_netif)
+            {
+                esp_netif_destroy_default_wifi(m_ap_netif);
+                m_ap_netif = nullptr;
+            }
+
+            if (m_sta_netif)
+            {
+                esp_netif_destroy_default_wifi(m_sta_netif);
+                m_sta_netif = nullptr;
+            }
+
+            if (m_own_event_loop)
+            {
+                esp_event_loop_delete_default();
+                m_own_event_loop = false;
+            }
+
+            m_driver_ready = false;
+            m_wifi_start = false;
+            m_ap_active = false;
+            m_state = sta_state::IDLE;
+            m_wifi_mode = WIFI_MODE_NULL;
+
+            m_link_ssid.clear();
+            m_link_password.clear();
+            m_attempt_ssid.clear();
+            m_attempt_password.clear();
+
+            m_current_ssid.clear();
+            m_ap_ip = {};
+            publish_connection();
+        }
+
+        //////////////// Wi-Fi 配置存储 ////////////////
+
+        // 配网验证成功后才保存凭据，同时记住本次连接的信道，内容未变化时不写入 flash
+        void store_link_credentials()
+        {
+            ESP_LOGI(TAG, "保存 Wi-Fi 配置到 NVS");
+            bool saved = m_store.update([&](stored_credentials& cred)
+            {
+                return make_credentials(cred, m_link_ssid, m_link_password, m_link_channel);
+            });
+
+            if (!saved)
+                ESP_LOGE(TAG, "保存 Wi-Fi 配置失败");
+        }
+
+        // 连接成功后记住 AP 所在的信道，下次自动连接时从该信道开始扫描
+        void update_stored_channel()
+        {
+            if (!m_link_channel)
+                return;
+
+            m_store.update([&](stored_credentials& cred)
+            {
+                if (m_link_ssid != cred.ssid || m_link_password != cred.password)
+                    return false;
+
+                cred.channel = m_link_channel;
+                return true;
+            });
+        }
+
+        //////////////// 链路监控 ////////////////
+
+        void do_set_supervisor(command* cmd)
+        {
+            m_supervisor = cmd->supervisor;
+            m_link_cb = cmd->link_cb;
+
+            // 已连接时按新的选项重新开始监控
+            if (m_state == sta_state::CONNECTED)
+            {
+                stop_gateway_ping();
+                start_gateway_ping();
+                m_link_timer_at = esp_timer_get_time() + (int64_t)m_supervisor.rssi_check_interval_ms * 1000;
+            }
+            else if (m_state == sta_state::BACKOFF && !m_supervisor.auto_reconnect)
+            {
+                m_state = sta_state::IDLE;
+                m_supervised = false;
+            }
+
+            complete_command(cmd, true);
+        }
+
+        //////////////// 功耗与延迟模式 ////////////////
+
+        void do_set_profile(command* cmd)
+        {
+            m_profile = cmd->profile;
+            if (cmd->listen_interval)
+                m_listen_interval = cmd->listen_interval;
+
+            if (m_wifi_start)
+                apply_power_save();
+
+            complete_command(cmd, true);
+        }
+
+        void apply_power_save()
+        {
+            wifi_ps_type_t ps = WIFI_PS_MIN_MODEM;
+
+            switch (m_profile)
+            {
+            case link_profile::LOW_LATENCY:
+                ps = WIFI_PS_NONE;
+                break;
+            case link_profile::BALANCED:
+                ps = WIFI_PS_MIN_MODEM;
+                break;
+            case link_profile::LOW_POWER:
+                ps = WIFI_PS_MAX_MODEM;
+                break;
+            }
+
+            auto err = esp_wifi_set_ps(ps);
+            if (err != ESP_OK)
+                ESP_LOGW(TAG, "设置省电模式失败: %s", esp_err_to_name(err));
+            else
+                ESP_LOGI(TAG, "省电模式: %d", (int)ps);
+        }
+
+        void do_measure_rtt(command* cmd)
+        {
+            if (m_state != sta_state::CONNECTED || !m_link_gw.addr || m_rtt_ping || cmd->rtt_count <= 0)
+            {
+                complete_command(cmd, false);
+                return;
+            }
+
+            m_rtt_min = UINT32_MAX;
+            m_rtt_max = 0;
+            m_rtt_sum = 0;
+            m_rtt_received = 0;
+
+            esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+            ip_addr_set_ip4_u32(&config.target_addr, m_link_gw.addr);
+            config.count = cmd->rtt_count;
+            config.interval_ms = cmd->rtt_interval_ms;
+
+            // 成功回调运行在 ping 任务中，在 RTT_END 事件之前控制任务不会读取这些统计
+            esp_ping_callbacks_t cbs = {};
+            cbs.cb_args = this;
+            cbs.on_ping_success = [](esp_ping_handle_t hdl, void* arg)
+            {
+                auto self = static_cast<wifi_provisioning_impl*>(arg);
+
+                uint32_t elapsed = 0;
+                esp_ping_get_profile(hdl, ESP_PING_PROF_TIMEGAP, &elapsed, sizeof(elapsed));
+
+                self->m_rtt_received++;
+                self->m_rtt_sum += elapsed;
+                if (elapsed < self->m_rtt_min)
+                    self->m_rtt_min = elapsed;
+                if (elapsed > self->m_rtt_max)
+                    self->m_rtt_max = elapsed;
+            };
+            cbs.on_ping_end = [](esp_ping_handle_t, void* arg)
+            {
+                static_cast<wifi_provisioning_impl*>(arg)->post_supervisor_event(SUPERVISOR_EVENT_RTT_END);
+            };
+
+            if (esp_ping_new_session(&config, &cbs, &m_rtt_ping) != ESP_OK)
+            {
+                m_rtt_ping = nullptr;
+                complete_command(cmd, false);
+                return;
+            }
+
+            m_rtt_cmd = cmd;
+            m_rtt_deadline = esp_timer_get_time() +
+                (int64_t)cmd->rtt_count * (cmd->rtt_interval_ms + config.timeout_ms) * 1000 + 1000 * 1000;
+
+            esp_ping_start(m_rtt_ping);
+        }
+
+        void finish_rtt()
+        {
+            auto cmd = m_rtt_cmd;
+            m_rtt_cmd = nullptr;
+
+            if (m_rtt_ping)
+            {
+                esp_ping_stop(m_rtt_ping);
+                esp_ping_delete_session(m_rtt_ping);
+                m_rtt_ping = nullptr;
+            }
+
+            if (!cmd)
+                return;
+
+            cmd->rtt.sent = cmd->rtt_count;
+            cmd->rtt.received = m_rtt_received;
+            cmd->rtt.min_ms = m_rtt_received ? m_rtt_min : 0;
+            cmd->rtt.max_ms = m_rtt_max;
+            cmd->rtt.avg_ms = m_rtt_received ? m_rtt_sum / m_rtt_received : 0;
+
+            ESP_LOGI(TAG, "往返时延: %d/%d, min %u ms, avg %u ms, max %u ms",
+                cmd->rtt.received, cmd->rtt.sent,
+                (unsigned)cmd->rtt.min_ms, (unsigned)cmd->rtt.avg_ms, (unsigned)cmd->rtt.max_ms);
+
+            complete_command(cmd, m_rtt_received > 0);
+        }
+
+        bool link_timer_active() const
+        {
+            if (m_state == sta_state::BACKOFF)
+                return true;
+
+            return m_state == sta_state::CONNECTED && m_supervisor.rssi_check_interval_ms > 0;
+        }
+
+        // 进入退避状态，退避间隔按重连次数指数增长
+        void enter_backoff(int64_t now)
+        {
+            int64_t delay_ms = m_supervisor.backoff_min_ms;
+            for (int i = 0; i < m_link_attempts && delay_ms < m_supervisor.backoff_max_ms; i++)
+                delay_ms *= 2;
+
+            if (delay_ms > m_supervisor.backoff_max_ms)
+                delay_ms = m_supervisor.backoff_max_ms;
+
+            m_state = sta_state::BACKOFF;
+            m_link_timer_at = now + delay_ms * 1000;
+
+            ESP_LOGI(TAG, "%d ms 后重新连接 Wi-Fi %s", (int)delay_ms, m_link_ssid.c_str());
+        }
+
+        void reconnect_link()
+        {
+            // 扫描期间无法连接，稍后再试
+            if (m_scanning)
+            {
+                m_link_timer_at = esp_timer_get_time() + 500 * 1000;
+                return;
+            }
+
+            m_link_attempts++;
+
+            ESP_LOGI(TAG, "链路监控第 %d 次重连", m_link_attempts);
+
+            begin_connect_record();
+
+            // 第一次重连复用上次的信道和 BSSID 以跳过全信道扫描，之后退回到完整扫描
+            if (m_link_attempts == 1 && m_link_channel)
+                start_connect(m_link_ssid, m_link_password, m_link_bssid, m_link_channel);
+            else
+                start_connect(m_link_ssid, m_link_password, nullptr, 0);
+
+            report_link();
+        }
+
+        // 定期检查 RSSI，信号变弱时扫描同 SSID 的其它 AP
+        void check_link(int64_t now)
+        {
+            m_link_timer_at = now + (int64_t)m_supervisor.rssi_check_interval_ms * 1000;
+
+            if (!update_link_rssi())
+                return;
+
+            report_link();
+
+            if (m_supervisor.roam_rssi_threshold == 0 || m_link_rssi >= m_supervisor.roam_rssi_threshold)
+                return;
+
+            if (m_scanning || (m_last_roam_scan && now - m_last_roam_scan < ROAM_SCAN_INTERVAL_US))
+                return;
+
+            ESP_LOGI(TAG, "信号较弱 (RSSI: %d), 搜索更强的 AP", m_link_rssi);
+
+            wifi_scan_config_t scan_config = {};
+            scan_config.ssid = (uint8_t *)m_link_ssid.c_str();
+
+            if (esp_wifi_scan_start(&scan_config, false) == ESP_OK)
+            {
+                trace("roam_scan", 'B');
+                m_scanning = true;
+                m_roam_scan = true;
+                m_scan_deadline = now + SCAN_TIMEOUT_US;
+                m_last_roam_scan = now;
+            }
+        }
+
+        // 在漫游扫描结果中寻找同 SSID 下信号明显更强的 AP，找到则切换过去
+        void evaluate_roam()
+        {
+            uint16_t ap_count = 0;
+            if (esp_wifi_scan_get_ap_num(&ap_count) != ESP_OK || ap_count == 0)
+                return;
+
+            std::vector<wifi_ap_record_t> ap_records(ap_count);
+            if (esp_wifi_scan_get_ap_records(&ap_count, ap_records.data()) != ESP_OK)
+                return;
+
+            const wifi_ap_record_t* best = nullptr;
+            for (int i = 0; i < ap_count; i++)
+            {
+                const auto& ap = ap_records[i];
+                if (m_link_ssid != (const char *)ap.ssid)
+                    continue;
+
+                if (memcmp(ap.bssid, m_link_bssid, sizeof(m_link_bssid)) == 0)
+                    continue;
+
+                if (!best || ap.rssi > best->rssi)
+                    best = &ap;
+            }
+
+            if (!best || best->rssi < m_link_rssi + m_supervisor.roam_rssi_hysteresis)
+                return;
+
+            ESP_LOGI(TAG, "漫游到 " MACSTR ", 信道: %d, RSSI: %d -> %d",
+                MAC2STR(best->bssid), best->primary, m_link_rssi, best->rssi);
+
+            begin_connect_record();
+            start_connect(m_link_ssid, m_link_password, best->bssid, best->primary);
+        }
+
+        bool update_link_rssi()
+        {
+            wifi_ap_record_t ap_info;
+            if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+                return false;
+
+            m_link_rssi = ap_info.rssi;
+            m_link_channel = ap_info.primary;
+            memcpy(m_link_bssid, ap_info.bssid, sizeof(m_link_bssid));
+
+            return true;
+        }
+
+        static link_quality quality_from_rssi(int8_t rssi)
+        {
+            if (rssi >= -55)
+                return link_quality::EXCELLENT;
+            if (rssi >= -67)
+                return link_quality::GOOD;
+            if (rssi >= -75)
+                return link_quality::FAIR;
+            return link_quality::POOR;
+        }
+
+        // 连接状态、链路质量或 AP 发生变化时回调
+        void report_link()
+        {
+            publish_connection();
+
+            link_status status = {};
+            status.connected = m_state == sta_state::CONNECTED;
+            status.quality = status.connected ? quality_from_rssi(m_link_rssi) : link_quality::NONE;
+            status.rssi = m_link_rssi;
+            status.channel = m_link_channel;
+            memcpy(status.bssid, m_link_bssid, sizeof(status.bssid));
+            status.disconnect_reason = m_link_reason;
+            status.reconnect_attempts = m_link_attempts;
+
+            if (status.connected == m_reported_link.connected &&
+                status.quality == m_reported_link.quality &&
+                status.reconnect_attempts == m_reported_link.reconnect_attempts &&
+                memcmp(status.bssid, m_reported_link.bssid, sizeof(status.bssid)) == 0)
+                return;
+
+            m_reported_link = status;
+
+            if (m_link_cb && !m_abort)
+                m_link_cb(status);
+        }
+
+        // 重新生成连接信息快照并发布，除 RSSI 以外的字段变化时回调
+        void publish_connection()
+        {
+            connection_info info = {};
+            info.connected = m_state == sta_state::CONNECTED;
+            snprintf(info.ssid, sizeof(info.ssid), "%s", m_current_ssid.c_str());
+            if (info.connected)
+            {
+                memcpy(info.bssid, m_link_bssid, sizeof(info.bssid));
+                info.channel = m_link_channel;
+                info.rssi = m_link_rssi;
+                info.ip = m_link_ip.addr;
+                info.gateway = m_link_gw.addr;
+            }
+            info.ap_ip = m_ap_active ? m_ap_ip.addr : 0;
+
+            esp_ip4_addr_t addr = { info.ip ? info.ip : info.ap_ip };
+            snprintf(info.ip_str, sizeof(info.ip_str), IPSTR, IP2STR(&addr));
+
+            bool changed = info.connected != m_published.connected ||
+                info.channel != m_published.channel ||
+                info.ip != m_published.ip ||
+                info.gateway != m_published.gateway ||
+                info.ap_ip != m_published.ap_ip ||
+                strcmp(info.ssid, m_published.ssid) != 0 ||
+                memcmp(info.bssid, m_published.bssid, sizeof(info.bssid)) != 0;
+
+            if (!changed && info.rssi == m_published.rssi)
+                return;
+
+            m_published = info;
+            m_connection.store(info);
+
+            if (changed && m_connection_cb && !m_abort)
+                m_connection_cb(info);
+        }
+
+        void start_gateway_ping()
+        {
+            if (m_ping || m_supervisor.gateway_ping_interval_ms <= 0 || !m_link_gw.addr)
+                return;
+
+            m_ping_failures = 0;
+
+            esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+            ip_addr_set_ip4_u32(&config.target_addr, m_link_gw.addr);
+            config.count = ESP_PING_COUNT_INFINITE;
+            config.interval_ms = m_supervisor.gateway_ping_interval_ms;
+
+            // ping 回调运行在 ping 任务中，只把结果转发给控制任务
+            esp_ping_callbacks_t cbs = {};
+            cbs.cb_args = this;
+            cbs.on_ping_success = [](esp_ping_handle_t, void* arg)
+            {
+                static_cast<wifi_provisioning_impl*>(arg)->post_supervisor_event(SUPERVISOR_EVENT_PING_SUCCESS);
+            };
+            cbs.on_ping_timeout = [](esp_ping_handle_t, void* arg)
+            {
+                static_cast<wifi_provisioning_impl*>(arg)->post_supervisor_event(SUPERVISOR_EVENT_PING_TIMEOUT);
+            };
+
+            if (esp_ping_new_session(&config, &cbs, &m_ping) != ESP_OK)
+            {
+                ESP_LOGW(TAG, "创建网关 ping 会话失败");
+                m_ping = nullptr;
+                return;
+            }
+
+            esp_ping_start(m_ping);
+        }
+
+        void stop_gateway_ping()
+        {
+            if (!m_ping)
+                return;
+
+            esp_ping_stop(m_ping);
+            esp_ping_delete_session(m_ping);
+            m_ping = nullptr;
+        }
+
+        void post_supervisor_event(int32_t id)
+        {
+            control_message msg = {};
+            msg.event.base = SUPERVISOR_EVENT;
+            msg.event.id = id;
+            msg.event.timestamp_us = esp_timer_get_time();
+
+            if (xQueueSend(m_control_queue, &msg, 0) == pdTRUE)
+                wake_control_task();
+        }
+
+        void handle_supervisor_event(const driver_event& ev)
+        {
+            if (ev.id == SUPERVISOR_EVENT_RTT_END)
+            {
+                finish_rtt();
+                return;
+            }
+
+            if (m_state != sta_state::CONNECTED || !m_ping)
+                return;
+
+            if (ev.id == SUPERVISOR_EVENT_PING_SUCCESS)
+            {
+                m_ping_failures = 0;
+                return;
+            }
+
+            if (++m_ping_failures < m_supervisor.gateway_ping_failures)
+                return;
+
+            // 网关持续不可达，主动断开，由断开事件触发重连
+            ESP_LOGW(TAG, "网关连续 %d 次 ping 失败, 重新连接", m_ping_failures);
+            m_ping_failures = 0;
+            esp_wifi_disconnect();
+        }
+
+#if WIFI_PROVISIONING_SCAN
+        void do_scan(command* cmd)
+        {
+            ESP_LOGI(TAG, "开始扫描 Wi-Fi 网络 ...");
+
+            // 连接过程中驱动无法扫描，推迟到连接结束；漫游扫描只搜索单个 SSID，也需要等待其结束
+            if (m_state == sta_state::CONNECTING || m_roam_scan)
+            {
+                m_deferred.push_back(cmd);
+                return;
+            }
+
+            // 合并到正在进行的扫描
+            m_scan_waiters.push_back(cmd);
+            if (m_scanning)
+                return;
+
+            begin_phase(provisioning_phase::SCAN);
+            trace("scan", 'B');
+
+            // 扫描 Wi-Fi
+            ensure_driver();
+
+            if (!m_wifi_start)
+            {
+                ESP_ERROR_CHECK(esp_wifi_start());
+                m_wifi_start = true;
+            }
+
+            auto err = esp_wifi_scan_start(nullptr, false);
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Wi-Fi 扫描失败: %s", esp_err_to_name(err));
+                finish_scan(false);
+                return;
+            }
+
+            m_scanning = true;
+            m_scan_deadline = esp_timer_get_time() + SCAN_TIMEOUT_US;
+        }
+#endif
+
+        // 扫描结束，读取结果并完成所有等待该次扫描的命令
+        void finish_scan(bool success)
+        {
+            m_scanning = false;
+
+            // 热点信道扫描由 finish_ap_channel_scan 继续创建热点
+            if (m_ap_cmd)
+            {
+                finish_ap_channel_scan(success);
+                return;
+            }
+
+            trace(m_roam_scan ? "roam_scan" : "scan", 'E', success);
+
+            if (m_roam_scan)
+            {
+                m_roam_scan = false;
+
+                if (success && m_state == sta_state::CONNECTED)
+                    evaluate_roam();
+                else
+                    esp_wifi_clear_ap_list();
+
+                run_deferred();
+                return;
+            }
+
+#if WIFI_PROVISIONING_SCAN
+            if (success)
+                success = fetch_scan_results();
+#endif
+
+            end_phase(provisioning_phase::SCAN);
+
+            auto waiters = std::move(m_scan_waiters);
+            m_scan_waiters.clear();
+
+            for (auto cmd : waiters)
+                complete_command(cmd, success);
+        }
+
+#if WIFI_PROVISIONING_SCAN
+        bool fetch_scan_results()
+        {
+            uint16_t ap_count = 0;
+            ESP_ERROR_CHECK(esp_wifi_scan_get_ap_num(&ap_count));
+            if (ap_count == 0)
+            {
+                ESP_LOGW(TAG, "没有扫描到 Wi-Fi 网络");
+                return false;
+            }
+
+            ESP_LOGI(TAG, "扫描到 %d 个 Wi-Fi 网络", ap_count);
+            wifi_ap_record_t *ap_records = (wifi_ap_record_t *)malloc(sizeof(wifi_ap_record_t) * ap_count);
+            if (!ap_records)
+            {
+                ESP_LOGE(TAG, "内存分配失败");
+                esp_wifi_clear_ap_list();
+                return false;
+            }
+            scoped_exit free_ap_records([&]
+                                       { free(ap_records); });
+
+            // 获取扫描到的接入点信息
+            ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_count, ap_records));
+            store_scan_results(ap_records, ap_count);
+
+            return true;
+        }
+
+        void store_scan_results(const wifi_ap_record_t* ap_records, uint16_t ap_count)
+        {
+            std::vector<wifi_network> wifi_list;
+            wifi_list.reserve(ap_count);
+
+            for (int i = 0; i < ap_count; i++)
+            {
+                wifi_network net = {};
+
+                static_assert(sizeof(net.ssid) >= sizeof(ap_records[i].ssid));
+                memcpy(net.ssid, ap_records[i].ssid, sizeof(ap_records[i].ssid));
+                net.rssi = ap_records[i].rssi;
+                net.auth_mode = ap_records[i].authmode;
+
+                wifi_list.push_back(net);
+
+                ESP_LOGI(TAG, "SSID: %-32.32s RSSI: %d Auth: %d",
+                         ap_records[i].ssid, ap_records[i].rssi, ap_records[i].authmode);
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_wifi_list = std::move(wifi_list);
+            m_wifi_list_time = esp_timer_get_time();
+        }
+#endif
+
+        //////////////// 热点参数与信道选择 ////////////////
+
+        void do_set_ap_options(command* cmd)
+        {
+            auto options = cmd->ap;
+
+            if (options.channel > 13)
+                options.channel = 0;
+            options.beacon_interval = std::clamp<uint16_t>(options.beacon_interval, 100, 60000);
+            options.max_connection = std::clamp<uint8_t>(options.max_connection, 1, 10);
+            if (options.max_tx_power)
+                options.max_tx_power = std::clamp<int8_t>(options.max_tx_power, 8, 84);
+
+            m_ap_options = options;
+            complete_command(cmd, true);
+        }
+
+        // 为热点选择信道，分数越小越好。
+        // 1/6/11 优先：分数相同时按 1、6、11 的顺序选择，其它信道另加 AP_CHANNEL_NONSTANDARD_SCORE。
+        // HT40 时同时计入次信道（信道 1 ~ 7 在上方，其余在下方）的分数。
+        static uint8_t score_ap_channels(const wifi_ap_record_t* records, int count,
+            uint8_t first, uint8_t last, bool ht40, int& best_score)
+        {
+            int interference[15] = {};
+            int occupancy[15] = {};
+
+            for (int i = 0; i < count; i++)
+            {
+                int weight = std::max(records[i].rssi + 100, 1);
+
+                auto add = [&](int center)
+                {
+                    for (int c = first; c <= last; c++)
+                    {
+                        int distance = std::abs(c - center);
+                        if (distance < 5)
+                            interference[c] += weight * (5 - distance);
+                    }
+                };
+
+                int primary = records[i].primary;
+                if (primary < 1 || primary > 14)
+                    continue;
+
+                add(primary);
+                if (records[i].second == WIFI_SECOND_CHAN_ABOVE)
+                    add(primary + 4);
+                else if (records[i].second == WIFI_SECOND_CHAN_BELOW)
+                    add(primary - 4);
+
+                occupancy[primary]++;
+            }
+
+            auto score = [&](int c)
+            {
+                bool standard = c == 1 || c == 6 || c == 11;
+                return interference[c] + occupancy[c] * AP_CHANNEL_OCCUPANCY_SCORE +
+                    (standard ? 0 : AP_CHANNEL_NONSTANDARD_SCORE);
+            };
+
+            uint8_t best = 0;
+            best_score = 0;
+
+            auto consider = [&](int c)
+            {
+                if (c < first || c > last)
+                    return;
+
+                int s = score(c);
+                if (ht40)
+                {
+                    int secondary = c <= 7 ? c + 4 : c - 4;
+                    if (secondary < first || secondary > last)
+                        return;
+                    s += interference[secondary] + occupancy[secondary] * AP_CHANNEL_OCCUPANCY_SCORE;
+                }
+
+                if (!best || s < best_score)
+                {
+                    best = c;
+                    best_score = s;
+                }
+            };
+
+            for (int c : { 1, 6, 11 })
+                consider(c);
+            for (int c = first; c <= last; c++)
+                consider(c);
+
+            return best ? best : 1;
+        }
+
+        // 在 STA 模式下异步快速扫描一次，为热点选择最空闲的信道。扫描期间 m_ap_cmd 保存正在创建热点的命令，
+        // WIFI_EVENT_SCAN_DONE 或扫描超时后由 finish_scan 转到 finish_ap_channel_scan 继续
+        void start_ap_channel_scan(command* cmd)
+        {
+            trace("ap_channel_scan", 'B');
+            m_ap_cmd = cmd;
+            m_ap_scan_started = esp_timer_get_time();
+
+            // 扫描需要 STA 模式，结束时恢复之前的模式
+            if (esp_wifi_get_mode(&m_ap_scan_mode) != ESP_OK)
+                m_ap_scan_mode = WIFI_MODE_NULL;
+
+            auto err = esp_wifi_set_mode(WIFI_MODE_STA);
+            if (err == ESP_OK && !m_wifi_start)
+            {
+                err = esp_wifi_start();
+                m_wifi_start = err == ESP_OK;
+            }
+
+            if (err == ESP_OK)
+            {
+                wifi_scan_config_t scan_config = {};
+                scan_config.show_hidden = true;
+                scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+                scan_config.scan_time.active.min = 0;
+                scan_config.scan_time.active.max = AP_CHANNEL_SCAN_MS;
+
+                err = esp_wifi_scan_start(&scan_config, false);
+            }
+
+            if (err != ESP_OK)
+            {
+                ESP_LOGW(TAG, "热点信道扫描失败: %s", esp_err_to_name(err));
+                finish_ap_channel_scan(false);
+                return;
+            }
+
+            m_scanning = true;
+            m_scan_deadline = m_ap_scan_started + SCAN_TIMEOUT_US;
+        }
+
+        // 热点信道扫描结束（包括失败、超时和 stop 中止），恢复扫描前的 Wi-Fi 模式，按扫描结果选择信道
+        // 并创建热点，扫描失败时使用信道 1。扫描结果同时作为 /wl 的网络列表缓存
+        void finish_ap_channel_scan(bool success)
+        {
+            auto cmd = m_ap_cmd;
+            m_ap_cmd = nullptr;
+
+            uint16_t ap_count = 0;
+            if (success)
+                esp_wifi_scan_get_ap_num(&ap_count);
+
+            wifi_ap_record_t* ap_records = nullptr;
+            if (ap_count)
+            {
+                ap_records = (wifi_ap_record_t*)malloc(sizeof(wifi_ap_record_t) * ap_count);
+                if (!ap_records)
+                    ap_count = 0;
+            }
+            scoped_exit free_ap_records([&]
+                { free(ap_records); });
+
+            if (ap_records)
+                esp_wifi_scan_get_ap_records(&ap_count, ap_records);
+            else
+                esp_wifi_clear_ap_list();
+
+            if (m_ap_scan_mode != WIFI_MODE_STA)
+            {
+                auto err = esp_wifi_set_mode(m_ap_scan_mode);
+                if (err != ESP_OK)
+                    ESP_LOGW(TAG, "恢复 Wi-Fi 模式失败: %s", esp_err_to_name(err));
+            }
+
+            uint8_t channel = 1;
+            int score = 0;
+
+            if (success)
+            {
+                uint8_t first = 1;
+                uint8_t last = 11;
+                wifi_country_t country;
+                if (esp_wifi_get_country(&country) == ESP_OK && country.nchan)
+                {
+                    first = country.schan;
+                    // 信道 14 只支持 802.11b，不用于热点
+                    last = std::min(country.schan + country.nchan - 1, 13);
+                }
+
+                channel = score_ap_channels(ap_records, ap_count, first, last, m_ap_options.ht40, score);
+            }
+
+#if WIFI_PROVISIONING_SCAN
+            if (ap_count)
+                store_scan_results(ap_records, ap_count);
+#endif
+
+            ESP_LOGI(TAG, "热点选择信道 %d（评分 %d, 附近 %d 个 AP, 耗时 %d ms）",
+                channel, score, ap_count, (int)((esp_timer_get_time() - m_ap_scan_started) / 1000));
+            trace("ap_channel_scan", 'E', channel);
+
+            // stop 中止的扫描不再创建热点
+            ap_created(cmd, !m_abort && start_ap(cmd->ssid, cmd->password, channel));
+
+            if (!m_abort)
+                run_deferred();
+        }
+
+        // 创建热点。自动选择信道时先异步扫描，热点在扫描结束后创建，两种情况都由 ap_created 完成命令
+        void do_create_ap(command* cmd)
+        {
+            if (!prepare_ap(cmd->ssid, cmd->password))
+            {
+                ap_created(cmd, false);
+                return;
+            }
+
+            if (m_ap_options.channel)
+                ap_created(cmd, start_ap(cmd->ssid, cmd->password, m_ap_options.channel));
+            else
+                start_ap_channel_scan(cmd);
+        }
+
+        // START_AP 在热点创建后完成，START_SERVER 接着启动配置服务器
+        void ap_created(command* cmd, bool success)
+        {
+            if (cmd->type == command_type::START_SERVER)
+                finish_start_server(cmd, success);
+            else
+                complete_command(cmd, success);
+        }
+
+        // 检查热点参数，中断正在进行的连接和扫描，并准备好驱动和热点接口。参数无效时不改变任何状态
+        bool prepare_ap(const std::string& ap_ssid, const std::string& ap_password)
+        {
+            if (ap_ssid.empty())
+            {
+                ESP_LOGW(TAG, "SSID is empty");
+                return false;
+            }
+
+            if (ap_ssid.size() > sizeof(wifi_ap_config_t::ssid) ||
+                ap_password.size() >= sizeof(wifi_ap_config_t::password))
+            {
+                ESP_LOGW(TAG, "SSID or password is too long");
+                return false;
+            }
+
+            // 重新初始化驱动会中断正在进行的连接和扫描
+            if (m_connect_cmd)
+                finish_connect(false, 0, esp_timer_get_time());
+            if (m_scanning)
+                finish_scan(false);
+
+            m_current_ssid = ap_ssid;
+
+            // 保存 Wi-Fi 模式
+            m_wifi_mode = WIFI_MODE_AP;
+            m_state = sta_state::IDLE;
+            m_ap_off_at = 0;
+            m_supervised = false;
+            stop_gateway_ping();
+
+            // 初始化 Wi-Fi，驱动刚刚初始化时不需要重新初始化
+            if (!ensure_driver())
+            {
+                wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+
+                ESP_ERROR_CHECK(esp_wifi_stop());
+                ESP_ERROR_CHECK(esp_wifi_deinit());
+                ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+                m_wifi_start = false;
+
+                // 注册事件处理程序
+                reset_event_handler();
+            }
+
+            ensure_ap_netif();
+
+            return true;
+        }
+
+        // 以 APSTA 模式在指定信道上启动热点
+        bool start_ap(const std::string& ap_ssid, const std::string& ap_password, uint8_t channel)
+        {
+            wifi_config_t wifi_config = {};
+
+            memcpy(wifi_config.ap.ssid, ap_ssid.data(), ap_ssid.size());
+            if (!ap_password.empty())
+            {
+                memcpy(wifi_config.ap.password, ap_password.data(), ap_password.size());
+                wifi_config.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
+            }
+            else
+            {
+                wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+            }
+
+            wifi_config.ap.ssid_len = ap_ssid.size();
+            wifi_config.ap.channel = channel;
+            wifi_config.ap.max_connection = m_ap_options.max_connection;
+            wifi_config.ap.beacon_interval = m_ap_options.beacon_interval;
+
+            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
+
+            auto err = esp_wifi_set_bandwidth(WIFI_IF_AP, m_ap_options.ht40 ? WIFI_BW_HT40 : WIFI_BW_HT20);
+            if (err != ESP_OK)
+                ESP_LOGW(TAG, "设置热点带宽失败: %s", esp_err_to_name(err));
+
+            if (!m_wifi_start)
+            {
+                ESP_ERROR_CHECK(esp_wifi_start());
+                m_wifi_start = true;
+            }
+
+            // 发射功率只能在驱动启动后设置
+            if (m_ap_options.max_tx_power)
+            {
+                err = esp_wifi_set_max_tx_power(m_ap_options.max_tx_power);
+                if (err != ESP_OK)
+                    ESP_LOGW(TAG, "设置发射功率失败: %s", esp_err_to_name(err));
+            }
+
+            m_ap_active = true;
+            m_ap_stations = 0;
+
+            esp_netif_ip_info_t ip_info;
+            if (esp_netif_get_ip_info(m_ap_netif, &ip_info) == ESP_OK)
+                m_ap_ip = ip_info.ip;
+            publish_connection();
+
+            ESP_LOGI(TAG, "WiFi AP 已经启动, SSID: %s, 信道: %d", ap_ssid.c_str(), channel);
+
+            return true;
+        }
+
+        // 启动 DNS 服务器、映射静态资源包并启动 HTTP 服务器
+        bool start_portal_services(int port)
+        {
+#if WIFI_PROVISIONING_DNS
+            if (!start_dns())
+                return false;
+#endif
+
+#if WIFI_PROVISIONING_ASSETS
+            // 没有资源分区时使用内置的配置页面
+            m_assets.map();
+#endif
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+            m_probe_success = false;
+#endif
+
+            return start_http_server(port);
+        }
+
+        // 创建 HTTP 服务器并注册 URI 处理程序，已经在运行时直接返回成功
+        bool start_http_server(int port)
+        {
+            if (m_httpd_server)
+                return true;
+
+            httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+            config.server_port = port;
+            config.max_uri_handlers = 24;
+            config.max_resp_headers = 24;
+            config.uri_match_fn = httpd_uri_match_wildcard;
+
+            // 客户端的连接数超过上限时关闭最久未使用的连接，而不是拒绝新的连接
+            config.lru_purge_enable = true;
+
+            if (httpd_start(&m_httpd_server, &config) != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to start HTTP server");
+                return false;
+            }
+
+            // 注册 URI 处理程序
+#if WIFI_PROVISIONING_TEST_ENDPOINT
+            httpd_uri_t http_test = {
+                .uri = "/test",
+                .method = HTTP_GET, // 处理 GET 请求
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_test_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_test);
+#endif
+
+#if WIFI_PROVISIONING_SCAN
+            httpd_uri_t http_wifi_list = {
+                .uri = "/wl",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_list_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_list);
+#endif
+
+            httpd_uri_t http_wifi_config = {
+                .uri = "/wc",
+                .method = HTTP_POST,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_config_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_config);
+
+            httpd_uri_t http_wifi_batch = {
+                .uri = "/wb",
+                .method = HTTP_POST,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_batch_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_batch);
+
+            httpd_uri_t http_wifi_result = {
+                .uri = "/wr",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_result_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_result);
+
+            httpd_uri_t http_wifi_stats = {
+                .uri = "/ws",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_stats_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_stats);
+
+#if WIFI_PROVISIONING_OTA
+            httpd_uri_t http_ota = {
+                .uri = "/ota",
+                .method = HTTP_POST,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_ota_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_ota);
+#endif
+
+#if WIFI_PROVISIONING_TRACE
+            httpd_uri_t http_trace = {
+                .uri = "/wt",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_trace_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_trace);
+#endif
+
+#if WIFI_PROVISIONING_WEB_UI || WIFI_PROVISIONING_ASSETS
+            httpd_uri_t http_wifi_webconfig = {
+                .uri = "/webconfig",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_wifi_web_config_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_wifi_webconfig);
+#endif
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+            for (const auto& probe : captive_probes)
+            {
+                httpd_uri_t captive_redirect_uri = {
+                    .uri = probe.uri,
+                    .method = HTTP_GET,
+                    .handler = [](httpd_req_t *req) -> esp_err_t
+                    {
+                        auto self = (wifi_provisioning_impl*)req->user_ctx;
+                        return self->captive_redirect_uri_handler(req);
+                    },
+                    .user_ctx = (void *)this // 用户上下文（可选）
+                };
+
+                httpd_register_uri_handler(m_httpd_server, &captive_redirect_uri);
+            }
+#endif
+
+#if WIFI_PROVISIONING_ASSETS
+            // 通配的静态资源处理程序必须最后注册，以免覆盖上面的处理程序
+            httpd_uri_t http_asset = {
+                .uri = "/*",
+                .method = HTTP_GET,
+                .handler = [](httpd_req_t *req) -> esp_err_t
+                {
+                    auto self = (wifi_provisioning_impl*)req->user_ctx;
+                    return self->http_asset_handler(req);
+                },
+                .user_ctx = (void *)this // 用户上下文（可选）
+            };
+            httpd_register_uri_handler(m_httpd_server, &http_asset);
+#endif
+
+            ESP_LOGI(TAG, "HTTP server started on port %d", config.server_port);
+            return true;
+        }
+
+        void stop_http_server()
+        {
+            if (m_httpd_server)
+            {
+                httpd_stop(m_httpd_server);
+                m_httpd_server = nullptr;
+            }
+
+#if WIFI_PROVISIONING_ASSETS
+            // httpd 已经停止，不会再访问映射的资源包
+            m_assets.unmap();
+#endif
+        }
+
+        void do_stop(teardown_mode mode)
+        {
+            m_abort = true;
+
+            // 先结束所有未完成的命令，httpd 任务可能正在等待其中的命令，
+            // 否则下面的 httpd_stop 会一直等待 httpd 任务退出。
+            if (m_connect_cmd)
+                finish_connect(false, 0, esp_timer_get_time());
+
+            if (m_scanning)
+            {
+                esp_wifi_scan_stop();
+                finish_scan(false);
+            }
+
+            auto deferred = std::move(m_deferred);
+            m_deferred.clear();
+            for (auto cmd : deferred)
+                complete_command(cmd, false);
+
+            stop_gateway_ping();
+            m_supervised = false;
+            m_ap_off_at = 0;
+            finish_rtt();
+
+            // 计算任务会访问本对象，必须在控制任务退出前结束，此时提交的结果直接以失败完成
+            join_psk_task();
+
+#if WIFI_PROVISIONING_MDNS
+            do_stop_mdns();
+#endif
+
+            // 等待 DNS 任务退出，关闭热点并释放热点接口
+            stop_portal();
+
+            if (m_instance_any_id)
+            {
+                esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, m_instance_any_id);
+                m_instance_any_id = nullptr;
+            }
+
+            if (m_instance_got_ip)
+            {
+                esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, m_instance_got_ip);
+                m_instance_got_ip = nullptr;
+            }
+
+            // 释放扫描结果和命令队列占用的内存
+#if WIFI_PROVISIONING_SCAN
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::vector<wifi_network>().swap(m_wifi_list);
+                m_wifi_list_time = 0;
+            }
+#endif
+
+            std::vector<command*>().swap(m_scan_waiters);
+            std::vector<command*>().swap(m_deferred);
+            std::vector<command*>().swap(m_connect_joiners);
+
+            if (mode == teardown_mode::FULL)
+                release_driver();
+
+            // 控制任务在当前消息处理完后退出
+            m_running = false;
+        }
+
+        //////////////// 驱动事件 ////////////////
+
+        // 事件处理函数不输出日志，由控制任务补上
+        static void log_driver_event(const driver_event& ev)
         {
-            if (ap_ssid.empty())
+            if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_CONNECTED)
+                ESP_LOGI(TAG, "STATION 模式，已经连接到 Wi-Fi ");
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_START)
+                ESP_LOGI(TAG, "STATION 模式，开始连接到 Wi-Fi");
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_DISCONNECTED)
+                ESP_LOGI(TAG, "STATION 模式，Wi-Fi 连接断开, reason: %d", ev.code);
+            else if (ev.base == IP_EVENT && ev.id == IP_EVENT_STA_GOT_IP)
+                ESP_LOGI(TAG, "获取到 IP: " IPSTR, IP2STR(&ev.ip));
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_SCAN_DONE)
+                ESP_LOGI(TAG, "Wi-Fi 扫描完成");
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_AP_STACONNECTED)
+                ESP_LOGI(TAG, "客户端 " MACSTR " 已连接, AID=%d", MAC2STR(ev.bssid), ev.code);
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_AP_STADISCONNECTED)
+                ESP_LOGI(TAG, "客户端 " MACSTR " 已离开, AID=%d", MAC2STR(ev.bssid), ev.code);
+        }
+
+        void handle_driver_event(const driver_event& ev)
+        {
+            trace_scope scope(this, ev.base, ev.id);
+            log_driver_event(ev);
+
+            if (ev.base == SUPERVISOR_EVENT)
             {
-                ESP_LOGW(TAG, "SSID is empty");
+                handle_supervisor_event(ev);
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_START)
+            {
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                {
+                    if (m.start_requested)
+                        r.start_us = now - m.start_requested;
+                }, ev.timestamp_us);
+
+                if (m_state == sta_state::CONNECTING && m_connect_on_start)
+                {
+                    m_connect_on_start = false;
+                    start_sta_connect();
+                }
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_CONNECTED)
+            {
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                {
+                    if (m.connect_requested)
+                        r.associate_us = now - m.connect_requested;
+                    m.connected = now;
+                }, ev.timestamp_us);
+
+                m_link_channel = ev.channel;
+                memcpy(m_link_bssid, ev.bssid, sizeof(m_link_bssid));
+
+                // 复用 RTC 记录中的地址租约，重连时也使用同一个地址
+                if (m_static_ip && m_state == sta_state::CONNECTING)
+                    apply_resume_lease();
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_STA_DISCONNECTED)
+            {
+                // 驱动尚未启动时收到的，或由我们主动断开产生的断开事件都属于上一次连接
+                if (m_connect_on_start)
+                    return;
+
+                if (m_state == sta_state::CONNECTING)
+                {
+                    // 连接过程中只有我们主动调用 esp_wifi_disconnect 才会产生 ASSOC_LEAVE
+                    if (ev.code == WIFI_REASON_ASSOC_LEAVE)
+                        return;
+
+                    connect_failed(ev.code, ev.timestamp_us);
+                }
+                else if (m_state == sta_state::CONNECTED)
+                {
+                    ESP_LOGW(TAG, "Wi-Fi 连接已断开, reason: %d", ev.code);
+
+                    stop_gateway_ping();
+                    m_link_reason = ev.code;
+
+                    if (m_supervised && m_supervisor.auto_reconnect)
+                        enter_backoff(ev.timestamp_us);
+                    else
+                        m_state = sta_state::IDLE;
+
+                    report_link();
+                    run_deferred();
+                }
+            }
+            else if (ev.base == IP_EVENT && ev.id == IP_EVENT_STA_GOT_IP)
+            {
+                if (m_state != sta_state::CONNECTING || m_connect_on_start)
+                    return;
+
+                update_connect_record([](wifi_connect_record& r, connect_marks& m, int64_t now)
+                {
+                    if (m.connected)
+                        r.dhcp_us = now - m.connected;
+                }, ev.timestamp_us);
+
+                m_link_ip = ev.ip;
+                m_link_gw = ev.gw;
+                finish_connect(true, 0, ev.timestamp_us);
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_SCAN_DONE)
+            {
+                if (m_scanning)
+                    finish_scan(ev.code == 0);
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_AP_STACONNECTED)
+            {
+                m_ap_stations++;
+                mark_portal_activity();
+
+                // 有客户端连接时恢复完整的配置服务
+                if (m_portal_state == portal_state::REDUCED)
+                    resume_portal();
+                else if (m_portal_state == portal_state::ADVERTISING)
+                    set_portal_state(portal_state::ACTIVE);
+
+                schedule_portal_timer(ev.timestamp_us);
+            }
+            else if (ev.base == WIFI_EVENT && ev.id == WIFI_EVENT_AP_STADISCONNECTED)
+            {
+                if (m_ap_stations > 0)
+                    m_ap_stations--;
+                mark_portal_activity();
+                schedule_portal_timer(ev.timestamp_us);
+            }
+        }
+
+        // 事件缓冲区溢出后，重新读取驱动和 esp_netif 的状态，补上可能丢失的状态事件：
+        // CONNECTED 状态下已经不再关联时补上断开事件，CONNECTING 状态下已经获取到地址时补上 GOT_IP，
+        // 并重新统计热点上的客户端数。丢失的 STA_START 和 SCAN_DONE 由连接和扫描的超时兜底
+        void resync_driver_state()
+        {
+            driver_event ev = {};
+            ev.timestamp_us = esp_timer_get_time();
+
+            wifi_ap_record_t ap_info;
+            bool associated = m_wifi_start && esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+
+            if (m_state == sta_state::CONNECTED && !associated)
+            {
+                ev.base = WIFI_EVENT;
+                ev.id = WIFI_EVENT_STA_DISCONNECTED;
+                ev.code = WIFI_REASON_UNSPECIFIED;
+                handle_driver_event(ev);
+            }
+            else if (m_state == sta_state::CONNECTING && !m_connect_on_start && associated)
+            {
+                esp_netif_ip_info_t ip_info = {};
+                if (esp_netif_get_ip_info(m_sta_netif, &ip_info) == ESP_OK && ip_info.ip.addr)
+                {
+                    m_link_channel = ap_info.primary;
+                    memcpy(m_link_bssid, ap_info.bssid, sizeof(m_link_bssid));
+
+                    ev.base = IP_EVENT;
+                    ev.id = IP_EVENT_STA_GOT_IP;
+                    ev.ip = ip_info.ip;
+                    ev.gw = ip_info.gw;
+                    handle_driver_event(ev);
+                }
+            }
+
+            wifi_sta_list_t stations;
+            if (m_ap_active && esp_wifi_ap_get_sta_list(&stations) == ESP_OK)
+                m_ap_stations = stations.num;
+        }
+
+        //////////////// 连接耗时记录 ////////////////
+
+        // 连接过程中各关键时刻的时间戳，0 表示尚未发生
+        struct connect_marks
+        {
+            int64_t start_requested;
+            int64_t connect_requested;
+            int64_t connected;
+        };
+
+        // 开始一条新的连接记录，最旧的记录会被覆盖
+        void begin_connect_record()
+        {
+            auto now = esp_timer_get_time();
+
+            taskENTER_CRITICAL(&m_history_lock);
+            m_attempt_index = m_history_next;
+            m_history_next = (m_history_next + 1) % CONNECT_HISTORY_SIZE;
+            if (m_history_count < CONNECT_HISTORY_SIZE)
+                m_history_count++;
+
+            auto& r = m_history[m_attempt_index];
+            r = {};
+            r.timestamp_us = now;
+            r.result = wifi_status::CONNECTING;
+            m_attempt_marks = {};
+            taskEXIT_CRITICAL(&m_history_lock);
+
+            trace("connect", 'B');
+        }
+
+        // 在临界区内更新当前进行中的连接记录，没有进行中的记录时什么也不做
+        template <typename F>
+        void update_connect_record(F&& f, int64_t now = esp_timer_get_time())
+        {
+            taskENTER_CRITICAL(&m_history_lock);
+            if (m_attempt_index >= 0)
+                f(m_history[m_attempt_index], m_attempt_marks, now);
+            taskEXIT_CRITICAL(&m_history_lock);
+        }
+
+        void finish_connect_record(wifi_status result, uint8_t reason, int64_t now)
+        {
+            taskENTER_CRITICAL(&m_history_lock);
+            if (m_attempt_index >= 0)
+            {
+                auto& r = m_history[m_attempt_index];
+                r.total_us = now - r.timestamp_us;
+                r.disconnect_reason = reason;
+                r.result = result;
+                m_attempt_index = -1;
+            }
+            taskEXIT_CRITICAL(&m_history_lock);
+
+            trace("connect", 'E', reason);
+        }
+
+        //////////////// 回调 ////////////////
+
+        void call_connect_cb(const connect_callback_t& connect_cb, wifi_status status, std::string_view ssid)
+        {
+            if (connect_cb && !m_abort)
+                connect_cb(status, ssid);
+        }
+
+#if WIFI_PROVISIONING_SCAN
+        // m_wifi_list 只由控制任务修改，回调也运行在控制任务中，因此可以不加锁直接传递视图
+        void call_scan_cb(const scan_callback_t& scan_cb)
+        {
+            if (scan_cb && !m_abort)
+                scan_cb(std::span<const wifi_network>(m_wifi_list));
+        }
+#endif
+
+        //////////////// 配网接口 ////////////////
+
+        static bool is_hex_string(const std::string& s)
+        {
+            return std::all_of(s.begin(), s.end(), [](char c) { return isxdigit((unsigned char)c) != 0; });
+        }
+
+        // 按认证方式检查密码格式，返回错误信息，密码有效时返回 nullptr
+        static const char* check_password(uint8_t auth_mode, const std::string& password)
+        {
+            switch (auth_mode)
+            {
+            case WIFI_AUTH_OPEN:
+            case WIFI_AUTH_OWE:
+                if (!password.empty())
+                    return "auth mode mismatch: network is open";
+                return nullptr;
+            case WIFI_AUTH_WEP:
+                // WEP-40/104 密钥为 5/13 个字符或 10/26 个十六进制数字
+                if (password.size() == 5 || password.size() == 13 ||
+                    ((password.size() == 10 || password.size() == 26) && is_hex_string(password)))
+                    return nullptr;
+                return password.empty() ? "password required" : "invalid wep key";
+            case WIFI_AUTH_WPA2_ENTERPRISE:
+                return "enterprise network not supported";
+            default:
+                // WPA/WPA2/WPA3 个人版密码为 8~63 个字符或 64 个十六进制数字
+                if (password.empty())
+                    return "password required";
+                if (password.size() < 8)
+                    return "password too short";
+                if (password.size() == 64 && !is_hex_string(password))
+                    return "invalid password";
+                return nullptr;
+            }
+        }
+
+        // 在进行任何射频操作之前检查凭据，返回错误信息，可以尝试连接时返回 nullptr。
+        // 除长度外，还使用最近的扫描结果检查网络是否存在、认证方式和密码格式；
+        // 隐藏网络不会出现在扫描结果中，hidden 为 true 时跳过存在性检查。
+        const char* validate_credentials(const std::string& ssid, const std::string& password, bool hidden)
+        {
+            stored_credentials validated;
+            if (!make_credentials(validated, ssid, password, 0))
+                return "ssid or password is too long";
+
+            // 没有扫描结果可用时只能检查通用的密码规则
+            if (!password.empty() && password.size() < 8 && password.size() != 5 && password.size() != 13 &&
+                password.size() != 10)
+                return "password too short";
+
+#if WIFI_PROVISIONING_SCAN
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            if (m_wifi_list_time == 0 || esp_timer_get_time() - m_wifi_list_time > SCAN_VALIDATE_MAX_AGE_US)
+                return nullptr;
+
+            const wifi_network* found = nullptr;
+            for (const auto& net : m_wifi_list)
+            {
+                if (ssid != net.ssid)
+                    continue;
+
+                // 同名网络可能有多个 AP，任一 AP 接受该密码即可
+                if (!check_password(net.auth_mode, password))
+                    return nullptr;
+
+                found = &net;
+            }
+
+            if (found)
+                return check_password(found->auth_mode, password);
+
+            if (!hidden)
+                return "ssid not found";
+#endif
+
+            return nullptr;
+        }
+
+        // 检查来自配置接口的凭据并提交验证命令，阻塞等待验证结果，验证成功后控制任务才保存凭据。
+        // 凭据无效时立即返回 false 并设置 error_msg，否则返回 true，验证结果存入 connected。
+        bool submit_credentials(const std::string& new_ssid, const std::string& new_password, bool hidden,
+            bool& connected, std::string& error_msg)
+        {
+            if (auto error = validate_credentials(new_ssid, new_password, hidden))
+            {
+                ESP_LOGW(TAG, "Wi-Fi 配置无效: %s", error);
+                error_msg = error;
                 return false;
             }
 
-            m_ssid = ap_ssid;
+            // 提交验证命令并等待结果，控制任务保证连接在 CONNECT_TIMEOUT_US 内结束。
+            // 验证在 APSTA 模式下进行，热点和 HTTP 服务不受影响，浏览器没有收到响应时
+            // 可以通过 /wr 查询结果。
+            auto cmd = new command;
+            cmd->type = command_type::CONNECT;
+            cmd->ssid = new_ssid;
+            cmd->password = new_password;
+            cmd->verify = true;
 
-            // 保存 Wi-Fi 模式
-            m_wifi_mode = WIFI_MODE_AP;
+            connected = submit_and_wait(cmd, pdMS_TO_TICKS(CONNECT_TIMEOUT_US / 1000 + SUBMIT_TIMEOUT_MS));
+            return true;
+        }
 
-            // 初始化 Wi-Fi
-            wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+        //////////////// HTTP 处理函数 ////////////////
+
+#if WIFI_PROVISIONING_TEST_ENDPOINT
+        int http_test_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "GET /test");
+            ESP_LOGI(TAG, "处理 http_test_handler 请求");
+
+            // 处理请求
+            httpd_resp_send(req, "Hello, World!", -1);
+
+            return ESP_OK;
+        }
+#endif
+
+#if WIFI_PROVISIONING_SCAN
+        int http_wifi_list_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "GET /wl");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_wifi_list_handler 请求!!!");
+
+            // 优先返回缓存的扫描结果，避免 httpd 任务在扫描期间被阻塞。
+            // 只有在还没有任何扫描结果时才同步等待一次扫描。
+            int64_t list_time;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                list_time = m_wifi_list_time;
+            }
+
+            auto cmd = new command;
+            cmd->type = command_type::SCAN;
+
+            if (list_time == 0)
+                submit_and_wait(cmd, pdMS_TO_TICKS(SCAN_TIMEOUT_US / 1000));
+            else if (esp_timer_get_time() - list_time > SCAN_CACHE_US)
+                submit(cmd);
+            else
+                release_command(cmd);
+
+            std::vector<wifi_network> wifi_list;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                wifi_list = m_wifi_list;
+            }
+
+            // 创建 JSON 数组
+            cJSON *root = cJSON_CreateArray();
+            if (!root)
+            {
+                httpd_resp_send_500(req);
+                return ESP_OK;
+            }
+
+            scoped_exit root_deleter([&]
+                { cJSON_Delete(root); });
+
+            // 填充 JSON 数据
+            for (const auto &network : wifi_list)
+            {
+                cJSON *item = cJSON_CreateObject();
+                cJSON_AddStringToObject(item, "ssid", network.ssid);
+                cJSON_AddNumberToObject(item, "rssi", network.rssi);
+                cJSON_AddNumberToObject(item, "auth_mode", network.auth_mode);
+                cJSON_AddItemToArray(root, item);
+            }
+
+            // 将 JSON 对象转换为字符串
+            char *json_str = cJSON_PrintUnformatted(root);
+            if (!json_str)
+            {
+                httpd_resp_send_500(req);
+                return ESP_OK;
+            }
+
+            scoped_exit json_deleter([&]
+                { cJSON_free(json_str); });
+
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_send(req, json_str, -1);
+
+            return ESP_OK;
+        }
+#endif
+
+        int http_wifi_config_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "POST /wc");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_wifi_config_handler 请求");
+
+            char buf[100]; // 用于存储POST数据的缓冲区
+            int ret;
+            std::string error_msg = "error";
+
+            scoped_exit failed_exit([&] () mutable
+            {
+                httpd_resp_set_type(req, "application/json");
+                sprintf(buf, "{ \"result\": \"%s\" }", error_msg.c_str());
+                httpd_resp_send(req, buf, -1);
+            });
+
+            // 获取POST数据
+            ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
+            if (ret <= 0)
+            {
+                return ESP_OK;
+            }
+
+            // 确保缓冲区以null结尾
+            buf[ret] = '\0';
+            ESP_LOGI(TAG, "POST数据: %s", buf);
+
+            // 解析 JSON 数据，获取 SSID 和密码
+            cJSON *root = cJSON_Parse(buf);
+            if (!root)
+            {
+                error_msg = "json parse error";
+                return ESP_OK;
+            }
+
+            scoped_exit root_deleter([&]
+                { cJSON_Delete(root); });
+
+            cJSON *ssid = cJSON_GetObjectItem(root, "ssid");
+            cJSON *password = cJSON_GetObjectItem(root, "password");
+
+            if (!cJSON_IsString(ssid) || !cJSON_IsString(password))
+            {
+                error_msg = "ssid or password is null";
+                return ESP_OK;
+            }
+
+            ESP_LOGI(TAG, "SSID: %s, Password: %s", ssid->valuestring, password->valuestring);
+
+            bool connected = false;
+            bool hidden = cJSON_IsTrue(cJSON_GetObjectItem(root, "hidden"));
+            if (!submit_credentials(ssid->valuestring, password->valuestring, hidden, connected, error_msg))
+                return ESP_OK;
+
+            if (connected)
+            {
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{ \"result\": \"ok\" }", -1);
+            }
+            else
+            {
+                httpd_resp_set_type(req, "application/json");
+                httpd_resp_send(req, "{ \"result\": \"failed\" }", -1);
+            }
+
+            failed_exit.cancel();
+
+            return ESP_OK;
+        }
+
+        // 批量配网接口，一次请求携带凭据和设备设置：
+        //   {"id":"...","ssid":"...","password":"...","ap_grace_ms":30000,"profile":"balanced","listen_interval":3}
+        // 除 ssid 和 password 外都是可选的。id 由客户端为每台设备生成，重试时保持不变，
+        // 相同 id 且请求体相同的请求不会重复配网：已有结果时直接返回，仍在验证时加入正在进行的验证。
+        int http_wifi_batch_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "POST /wb");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_wifi_batch_handler 请求");
+
+            auto send_result = [&](const std::string& id, const char* result, const char* error)
+            {
+                cJSON *root = cJSON_CreateObject();
+                if (!root)
+                    return httpd_resp_send_500(req);
+
+                scoped_exit root_deleter([&]
+                    { cJSON_Delete(root); });
+
+                cJSON_AddStringToObject(root, "id", id.c_str());
+                cJSON_AddStringToObject(root, "result", result);
+                if (error)
+                    cJSON_AddStringToObject(root, "error", error);
+
+                char *json_str = cJSON_PrintUnformatted(root);
+                if (!json_str)
+                    return httpd_resp_send_500(req);
+
+                scoped_exit json_deleter([&]
+                    { cJSON_free(json_str); });
+
+                httpd_resp_set_type(req, "application/json");
+                return httpd_resp_send(req, json_str, -1);
+            };
+
+            // 读取完整的请求体
+            char buf[BATCH_BODY_SIZE];
+            if (req->content_len == 0 || req->content_len >= sizeof(buf))
+                return send_result("", "error", "invalid body size");
+
+            size_t received = 0;
+            int retries = 0;
+            while (received < req->content_len)
+            {
+                int ret = httpd_req_recv(req, buf + received, req->content_len - received);
+                if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries < BATCH_RECV_RETRIES && !m_abort)
+                    continue;
+                if (ret <= 0)
+                    return ESP_FAIL;
+                received += ret;
+                retries = 0;
+            }
+            buf[received] = '\0';
+
+            // 重试必须与原请求完全相同，同一个 id 换了密码或设置时重新配网，不能返回原来的结果
+            uint32_t body_crc = esp_crc32_le(0, (const uint8_t *)buf, received);
+
+            cJSON *root = cJSON_Parse(buf);
+            if (!root)
+                return send_result("", "error", "json parse error");
+
+            scoped_exit root_deleter([&]
+                { cJSON_Delete(root); });
 
-            ESP_ERROR_CHECK(esp_wifi_stop());
-            ESP_ERROR_CHECK(esp_wifi_deinit());
-            ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+            cJSON *id = cJSON_GetObjectItem(root, "id");
+            cJSON *ssid = cJSON_GetObjectItem(root, "ssid");
+            cJSON *password = cJSON_GetObjectItem(root, "password");
 
-            m_wifi_start = false;
+            if (!cJSON_IsString(id) || strlen(id->valuestring) == 0 || strlen(id->valuestring) > BATCH_ID_MAX_LEN)
+                return send_result("", "error", "invalid id");
 
-            // 注册事件处理程序
-            reset_event_handler();
+            std::string request_id = id->valuestring;
 
-            wifi_config_t wifi_config = {};
+            if (!cJSON_IsString(ssid) || !cJSON_IsString(password))
+                return send_result(request_id, "error", "ssid or password is null");
 
-            strcpy((char *)wifi_config.ap.ssid, m_ssid.c_str());
-            if (!ap_password.empty())
-            {
-                strcpy((char *)wifi_config.ap.password, ap_password.c_str());
-                wifi_config.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
-            }
-            else
+            // 相同的请求已经有结果时直接返回，保证重试是幂等的
             {
-                wifi_config.ap.authmode = WIFI_AUTH_OPEN;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (request_id == m_batch_id && body_crc == m_batch_crc && m_verify_ssid == ssid->valuestring)
+                {
+                    if (m_verify_state == wifi_status::CONNECTED)
+                        return send_result(request_id, "ok", nullptr);
+                    if (m_verify_state == wifi_status::FAILED)
+                        return send_result(request_id, "failed", nullptr);
+                }
             }
 
-            wifi_config.ap.ssid_len = m_ssid.size();
-            wifi_config.ap.channel = 1;
-            wifi_config.ap.max_connection = 4;
-            wifi_config.ap.beacon_interval = 100;
+            // 先检查所有设置，任何一项无效都不做修改
+            cJSON *grace = cJSON_GetObjectItem(root, "ap_grace_ms");
+            cJSON *profile = cJSON_GetObjectItem(root, "profile");
+            cJSON *listen_interval = cJSON_GetObjectItem(root, "listen_interval");
 
-            ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
-            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_AP, &wifi_config));
-            if (!m_wifi_start)
+            if (grace && (!cJSON_IsNumber(grace) || grace->valueint < 0))
+                return send_result(request_id, "error", "invalid ap_grace_ms");
+
+            link_profile new_profile = link_profile::BALANCED;
+            if (profile)
             {
-                ESP_ERROR_CHECK(esp_wifi_start());
-                m_wifi_start = true;
+                if (!cJSON_IsString(profile))
+                    return send_result(request_id, "error", "invalid profile");
+                else if (strcmp(profile->valuestring, "low_latency") == 0)
+                    new_profile = link_profile::LOW_LATENCY;
+                else if (strcmp(profile->valuestring, "balanced") == 0)
+                    new_profile = link_profile::BALANCED;
+                else if (strcmp(profile->valuestring, "low_power") == 0)
+                    new_profile = link_profile::LOW_POWER;
+                else
+                    return send_result(request_id, "error", "invalid profile");
             }
 
-            ESP_LOGI(TAG, "WiFi AP 已经启动, SSID: %s", m_ssid.c_str());
+            if (listen_interval && (!cJSON_IsNumber(listen_interval) ||
+                listen_interval->valueint <= 0 || listen_interval->valueint > UINT16_MAX))
+                return send_result(request_id, "error", "invalid listen_interval");
 
-            return true;
-        }
+            // listen_interval 随 profile 一起设置，单独提供时不能静默忽略
+            if (listen_interval && !profile)
+                return send_result(request_id, "error", "listen_interval requires profile");
 
-        void stop()
-        {
-            m_abort = true;
+            // 设置命令先于连接命令提交，控制任务按顺序执行，热点保留时间在连接成功前已经生效
+            if (grace)
+                set_ap_grace_period(grace->valueint);
+            if (profile)
+                set_link_profile(new_profile, listen_interval ? listen_interval->valueint : 3);
 
-            if (m_httpd_server)
+            std::string error_msg;
+            bool connected = false;
+            bool hidden = cJSON_IsTrue(cJSON_GetObjectItem(root, "hidden"));
+            if (!submit_credentials(ssid->valuestring, password->valuestring, hidden, connected, error_msg))
+                return send_result(request_id, "error", error_msg.c_str());
+
+            // 凭据通过检查并得到验证结果后才记录这个请求，被拒绝的请求不会让之后的重试得到旧的结果。
+            // 验证期间到达的重试由控制任务合并到正在进行的验证中
             {
-                httpd_stop(m_httpd_server);
-                m_httpd_server = nullptr;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_batch_id = request_id;
+                m_batch_crc = body_crc;
             }
 
-            stop_dns();
+            return send_result(request_id, connected ? "ok" : "failed", nullptr);
+        }
 
-            if (m_instance_any_id)
+        int http_wifi_result_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "GET /wr");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_wifi_result_handler 请求");
+
+            wifi_status state;
+            std::string ssid;
+            uint8_t reason;
+            esp_ip4_addr_t ip;
             {
-                esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, m_instance_any_id);
-                m_instance_any_id = nullptr;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                state = m_verify_state;
+                ssid = m_verify_ssid;
+                reason = m_verify_reason;
+                ip = m_verify_ip;
             }
 
-            if (m_instance_got_ip)
-            {
-                esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, m_instance_got_ip);
-                m_instance_got_ip = nullptr;
-            }
+            const char* result = "idle";
+            if (state == wifi_status::CONNECTING)
+                result = "connecting";
+            else if (state == wifi_status::CONNECTED)
+                result = "ok";
+            else if (state == wifi_status::FAILED)
+                result = "failed";
 
-            if (m_wifi_event_group)
+            cJSON *root = cJSON_CreateObject();
+            if (!root)
             {
-                vEventGroupDelete(m_wifi_event_group);
-                m_wifi_event_group = nullptr;
+                httpd_resp_send_500(req);
+                return ESP_OK;
             }
-        }
 
-        std::string get_connected_ssid() const
-        {
-            return m_ssid;
-        }
+            scoped_exit root_deleter([&]
+                { cJSON_Delete(root); });
 
-        std::string get_connected_ip() const
-        {
-            esp_netif_ip_info_t ip_info;
+            char ip_str[16] = {0};
+            sprintf(ip_str, IPSTR, IP2STR(&ip));
+
+            cJSON_AddStringToObject(root, "result", result);
+            cJSON_AddStringToObject(root, "ssid", ssid.c_str());
+            cJSON_AddStringToObject(root, "ip", ip_str);
+            cJSON_AddNumberToObject(root, "reason", reason);
 
-            switch (m_wifi_mode)
+            char *json_str = cJSON_PrintUnformatted(root);
+            if (!json_str)
             {
-            case WIFI_MODE_STA:
-                if (esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"), &ip_info) == ESP_OK)
-                {
-                    char ip[16] = {0};
-                    sprintf(ip, IPSTR, IP2STR(&ip_info.ip));
-                    return ip;
-                }
-                break;
-            case WIFI_MODE_AP:
-                if (esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_AP_DEF"), &ip_info) == ESP_OK)
-                {
-                    char ip[16] = {0};
-                    sprintf(ip, IPSTR, IP2STR(&ip_info.ip));
-                    return ip;
-                }
-                break;
-            default:
-                break;
+                httpd_resp_send_500(req);
+                return ESP_OK;
             }
 
-            return {};
+            scoped_exit json_deleter([&]
+                { cJSON_free(json_str); });
+
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_send(req, json_str, -1);
+
+            return ESP_OK;
         }
 
-        void clear_wifi_config()
+        int http_wifi_stats_handler(httpd_req_t* req)
         {
-            nvs_handle_t nvs_handle;
-            auto err = nvs_open(wifi_settings, NVS_READWRITE, &nvs_handle);
-            if (err == ESP_OK)
-            {
-                nvs_erase_all(nvs_handle);
-                nvs_close(nvs_handle);
+            trace_scope scope(this, "GET /ws");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_wifi_stats_handler 请求");
 
-                ESP_LOGI(TAG, "Wi-Fi 配置已清除");
-                return;
+            auto history = get_connect_history();
+
+            cJSON *root = cJSON_CreateArray();
+            if (!root)
+            {
+                httpd_resp_send_500(req);
+                return ESP_OK;
             }
 
-            ESP_LOGW(TAG, "Wi-Fi 清除配置时 nvs 打开失败, ERROR: %d", err);
-        }
+            scoped_exit root_deleter([&]
+                { cJSON_Delete(root); });
 
-    private:
-        void call_connect_cb(wifi_status status, const std::string& ssid)
-        {
-            if (m_connect_cb && !m_abort)
-                m_connect_cb(status, ssid);
-        }
+            for (const auto &r : history)
+            {
+                const char* result = "connecting";
+                if (r.result == wifi_status::CONNECTED)
+                    result = "connected";
+                else if (r.result == wifi_status::FAILED)
+                    result = "failed";
+
+                cJSON *item = cJSON_CreateObject();
+                cJSON_AddNumberToObject(item, "timestamp_us", (double)r.timestamp_us);
+                cJSON_AddStringToObject(item, "result", result);
+                cJSON_AddNumberToObject(item, "reason", r.disconnect_reason);
+                cJSON_AddNumberToObject(item, "load_us", r.load_us);
+                cJSON_AddNumberToObject(item, "init_us", r.init_us);
+                cJSON_AddNumberToObject(item, "start_us", r.start_us);
+                cJSON_AddNumberToObject(item, "associate_us", r.associate_us);
+                cJSON_AddNumberToObject(item, "dhcp_us", r.dhcp_us);
+                cJSON_AddNumberToObject(item, "total_us", r.total_us);
+                cJSON_AddBoolToObject(item, "resumed", r.resumed);
+                cJSON_AddItemToArray(root, item);
+            }
 
-        void call_scan_cb(const std::vector<wifi_network>& wifi_list)
-        {
-            if (m_scan_cb && !m_abort)
-                m_scan_cb(wifi_list);
-        }
+            char *json_str = cJSON_PrintUnformatted(root);
+            if (!json_str)
+            {
+                httpd_resp_send_500(req);
+                return ESP_OK;
+            }
 
-        int http_test_handler(httpd_req_t* req)
-        {
-            ESP_LOGI(TAG, "处理 http_test_handler 请求");
+            scoped_exit json_deleter([&]
+                { cJSON_free(json_str); });
 
-            // 处理请求
-            httpd_resp_send(req, "Hello, World!", -1);
+            httpd_resp_set_type(req, "application/json");
+            httpd_resp_send(req, json_str, -1);
 
             return ESP_OK;
         }
 
-        int http_wifi_list_handler(httpd_req_t* req)
+#if WIFI_PROVISIONING_OTA
+        // 以 Authorization 请求头调用应用设置的认证函数，没有认证函数时拒绝
+        bool authorize_ota(httpd_req_t* req)
         {
-            ESP_LOGI(TAG, "处理 http_wifi_list_handler 请求!!!");
-
-            scan_networks([req](std::vector<wifi_network> wifi_list)
+            ota_auth_callback_t auth;
             {
-                // 创建 JSON 数组
-                cJSON *root = cJSON_CreateArray();
-                if (!root)
-                {
-                    httpd_resp_send_500(req);
-                    return;
-                }
-
-                // 填充 JSON 数据
-                for (const auto &network : wifi_list)
-                {
-                    cJSON *item = cJSON_CreateObject();
-                    cJSON_AddStringToObject(item, "ssid", network.ssid.c_str());
-                    cJSON_AddNumberToObject(item, "rssi", network.rssi);
-                    cJSON_AddNumberToObject(item, "auth_mode", network.auth_mode);
-                    cJSON_AddItemToArray(root, item);
-                }
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auth = m_ota_auth;
+            }
 
-                // 将 JSON 对象转换为字符串
-                char *json_str = cJSON_PrintUnformatted(root);
-                if (!json_str)
-                {
-                    cJSON_Delete(root);
-                    httpd_resp_send_500(req);
-                    return;
-                }
+            if (!auth)
+                return false;
 
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, json_str, -1);
-            });
+            char value[OTA_AUTH_HEADER_SIZE] = {};
+            size_t len = httpd_req_get_hdr_value_len(req, "Authorization");
+            if (len >= sizeof(value) ||
+                (len && httpd_req_get_hdr_value_str(req, "Authorization", value, sizeof(value)) != ESP_OK))
+                return false;
 
-            return ESP_OK;
+            return auth(std::string_view(value, len));
         }
 
-        int http_wifi_config_handler(httpd_req_t* req)
+        // 流式 OTA 升级，请求体为固件镜像，边接收边写入下一个 OTA 分区。请求必须通过 set_ota_authorizer
+        // 设置的认证函数（Authorization 请求头），否则返回 401。可选的请求头：
+        //   X-OTA-SHA256: 固件的 SHA-256（十六进制），接收时增量计算，不一致时放弃升级
+        //   X-OTA-Reboot: 1 表示升级成功并返回结果后重启
+        // 返回 {"result":"ok","size":...,"sha256":"...","kbps":...}，失败时 result 为 error 并附带 error 说明。
+        int http_ota_handler(httpd_req_t* req)
         {
-            ESP_LOGI(TAG, "处理 http_wifi_config_handler 请求");
+            trace_scope scope(this, "POST /ota");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_ota_handler 请求, 固件大小: %u", (unsigned)req->content_len);
 
-            char buf[100]; // 用于存储POST数据的缓冲区
-            int ret;
-            std::string error_msg = "error";
+            char digest_hex[65] = {};
+            ota_status status = {};
 
-            scoped_exit failed_exit([&] () mutable
+            auto send_result = [&](const char* error)
             {
+                char buf[192];
+                if (error)
+                    snprintf(buf, sizeof(buf), "{\"result\":\"error\",\"error\":\"%s\"}", error);
+                else
+                    snprintf(buf, sizeof(buf), "{\"result\":\"ok\",\"size\":%u,\"sha256\":\"%s\",\"kbps\":%u}",
+                        (unsigned)status.received, digest_hex, (unsigned)status.kbps);
+
                 httpd_resp_set_type(req, "application/json");
-                sprintf(buf, "{ \"result\": \"%s\" }", error_msg.c_str());
-                httpd_resp_send(req, buf, -1);
-            });
+                return httpd_resp_send(req, buf, -1);
+            };
 
-            // 获取POST数据
-            ret = httpd_req_recv(req, buf, sizeof(buf) - 1);
-            if (ret <= 0)
+            // 配置热点可能是开放的，配网后 STA 一侧的局域网也能访问，写入 flash 之前先认证
+            if (!authorize_ota(req))
             {
-                return ESP_OK;
+                ESP_LOGW(TAG, "OTA 请求未通过认证");
+                httpd_resp_set_status(req, "401 Unauthorized");
+                return send_result("unauthorized");
             }
 
-            // 确保缓冲区以null结尾
-            buf[ret] = '\0';
-            ESP_LOGI(TAG, "POST数据: %s", buf);
+            if (req->content_len == 0)
+                return send_result("empty image");
 
-            // 解析 JSON 数据，获取 SSID 和密码
-            cJSON *root = cJSON_Parse(buf);
-            if (!root)
-            {
-                error_msg = "json parse error";
-                return ESP_OK;
-            }
+            char expected[65] = {};
+            if (httpd_req_get_hdr_value_len(req, "X-OTA-SHA256") &&
+                (httpd_req_get_hdr_value_str(req, "X-OTA-SHA256", expected, sizeof(expected)) != ESP_OK ||
+                strlen(expected) != 64))
+                return send_result("invalid sha256");
 
-            scoped_exit root_deleter([&]
-                { cJSON_Delete(root); });
+            char reboot[4] = {};
+            httpd_req_get_hdr_value_str(req, "X-OTA-Reboot", reboot, sizeof(reboot));
 
-            cJSON *ssid = cJSON_GetObjectItem(root, "ssid");
-            cJSON *password = cJSON_GetObjectItem(root, "password");
+            // 同一时间只允许一个升级
+            if (m_ota_busy.exchange(true))
+                return send_result("busy");
+
+            scoped_exit busy_exit([this]
+                { m_ota_busy = false; });
+
+            status.state = ota_state::RECEIVING;
+            status.total = req->content_len;
+            m_ota_status.store(status);
 
-            if (!ssid || !password)
+            auto start = esp_timer_get_time();
+
+            auto fail = [&](const char* error, esp_err_t err)
             {
-                error_msg = "ssid or password is null";
-                return ESP_OK;
+                ESP_LOGE(TAG, "OTA 升级失败: %s (%s)", error, esp_err_to_name(err));
+                status.state = ota_state::FAILED;
+                m_ota_status.store(status);
+            };
+
+            // 析构时放弃未完成的升级
+            ota_pipeline ota;
+            auto err = ota.begin(req->content_len);
+            if (err != ESP_OK)
+            {
+                fail("ota begin failed", err);
+                return send_result(err == ESP_ERR_NOT_FOUND ? "no ota partition" :
+                    err == ESP_ERR_INVALID_SIZE ? "image too large" : "ota begin failed");
             }
 
-            ESP_LOGI(TAG, "SSID: %s, Password: %s", ssid->valuestring, password->valuestring);
+            ESP_LOGI(TAG, "写入分区 %s", ota.partition()->label);
 
-            // 存储 Wi-Fi 配置到 NVS
-            nvs_handle_t nvs_handle;
-            auto err = nvs_open(wifi_settings, NVS_READWRITE, &nvs_handle);
-            if (err == ESP_OK)
+            mbedtls_sha256_context sha;
+            mbedtls_sha256_init(&sha);
+            scoped_exit sha_exit([&]
+                { mbedtls_sha256_free(&sha); });
+            mbedtls_sha256_starts(&sha, 0);
+
+            uint32_t logged = 0;
+            while (status.received < status.total)
             {
-                ESP_LOGI(TAG, "保存 Wi-Fi 配置到 NVS");
-                err = nvs_set_str(nvs_handle, "ssid", ssid->valuestring);
-                if (err != ESP_OK)
+                auto data = ota.acquire();
+                size_t want = std::min<size_t>(OTA_BUFFER_SIZE, status.total - status.received);
+                size_t size = 0;
+                int retries = 0;
+
+                auto recv_start = esp_timer_get_time();
+                while (size < want)
                 {
-                    error_msg = "ssid save error";
+                    int ret = httpd_req_recv(req, (char*)data + size, want - size);
+                    if (ret == HTTPD_SOCK_ERR_TIMEOUT && ++retries < OTA_RECV_RETRIES && !m_abort)
+                        continue;
 
-                    ESP_LOGI(TAG, "保存 SSID 失败, ERROR: %d", err);
-                    nvs_close(nvs_handle);
+                    if (ret <= 0)
+                    {
+                        // 连接已经断开或一直没有数据，无法再返回结果
+                        fail("receive failed", ESP_ERR_TIMEOUT);
+                        return ESP_FAIL;
+                    }
 
-                    return ESP_OK;
+                    size += ret;
+                    retries = 0;
                 }
+                status.recv_us += esp_timer_get_time() - recv_start;
 
-                err = nvs_set_str(nvs_handle, "password", password->valuestring);
-                if (err != ESP_OK)
+                // 哈希在 httpd 任务中计算，与上一块的 flash 写入同时进行
+                mbedtls_sha256_update(&sha, data, size);
+
+                if (!ota.submit(data, size))
                 {
-                    error_msg = "password save error";
+                    fail("flash write failed", ota.error());
+                    return send_result("flash write failed");
+                }
 
-                    ESP_LOGI(TAG, "保存密码失败, ERROR: %d", err);
-                    nvs_close(nvs_handle);
+                status.received += size;
+                status.stall_us = ota.stall_us();
+                status.kbps = (uint32_t)(status.received * 1000000LL / 1024 / std::max<int64_t>(esp_timer_get_time() - start, 1));
+                m_ota_status.store(status);
 
-                    return ESP_OK;
+                // 每 10% 输出一次进度
+                if (status.received - logged >= status.total / 10 || status.received == status.total)
+                {
+                    logged = status.received;
+                    ESP_LOGI(TAG, "OTA 进度: %u/%u (%u%%), %u KB/s", (unsigned)status.received, (unsigned)status.total,
+                        (unsigned)(status.received * 100ULL / status.total), (unsigned)status.kbps);
                 }
-
-                ESP_ERROR_CHECK(nvs_commit(nvs_handle));
-                nvs_close(nvs_handle);
             }
 
-            // 设置 Wi-Fi 配置并连接到 Wi-Fi
-            wifi_config_t wifi_config = {};
-            memset(&wifi_config, 0, sizeof(wifi_config_t));
-
-            strcpy((char *)wifi_config.sta.ssid, ssid->valuestring);
-            strcpy((char *)wifi_config.sta.password, password->valuestring);
+            uint8_t digest[32];
+            mbedtls_sha256_finish(&sha, digest);
+            for (int i = 0; i < 32; i++)
+                sprintf(digest_hex + i * 2, "%02x", digest[i]);
 
-            // 连接到 Wi-Fi
-            if (connect_wifi_impl(&wifi_config))
+            if (expected[0] && strcasecmp(expected, digest_hex) != 0)
             {
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, "{ \"result\": \"ok\" }", -1);
+                fail("sha256 mismatch", ESP_ERR_INVALID_CRC);
+                return send_result("sha256 mismatch");
             }
-            else
+
+            // 等待最后一块写入，校验固件并设置启动分区
+            err = ota.finish(true);
+            status.write_us = ota.write_us();
+            status.stall_us = ota.stall_us();
+            if (err != ESP_OK)
             {
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_send(req, "{ \"result\": \"failed\" }", -1);
+                fail("image validation failed", err);
+                return send_result(err == ESP_ERR_OTA_VALIDATE_FAILED ? "invalid image" : "flash write failed");
             }
 
-            failed_exit.cancel();
+            auto elapsed = std::max<int64_t>(esp_timer_get_time() - start, 1);
+            status.state = ota_state::SUCCESS;
+            status.kbps = (uint32_t)(status.received * 1000000LL / 1024 / elapsed);
+            m_ota_status.store(status);
+
+            ESP_LOGI(TAG, "OTA 升级完成: %u 字节, %u KB/s, 总耗时 %lld ms, 接收 %lld ms, 写入 %lld ms, 等待写入 %lld ms",
+                (unsigned)status.received, (unsigned)status.kbps, (long long)elapsed / 1000,
+                (long long)status.recv_us / 1000, (long long)status.write_us / 1000, (long long)status.stall_us / 1000);
+
+            send_result(nullptr);
+
+            if (strcmp(reboot, "1") == 0)
+            {
+                ESP_LOGI(TAG, "重启以运行新固件");
+                vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+                esp_restart();
+            }
 
             return ESP_OK;
         }
+#endif
+
+#if WIFI_PROVISIONING_TRACE
+        // 以 JSON 数组返回跟踪记录，逐条格式化后分块发送，避免为整个响应分配内存
+        int http_trace_handler(httpd_req_t* req)
+        {
+            update_httpd_stack();
+            auto records = get_trace();
+
+            httpd_resp_set_type(req, "application/json");
+
+            char buf[128];
+            for (size_t i = 0; i < records.size(); i++)
+            {
+                const auto& r = records[i];
+                int n = snprintf(buf, sizeof(buf), "%s{\"ts\":%lld,\"ph\":\"%c\",\"name\":\"%s\",\"task\":\"%s\",\"arg\":%u}",
+                    i == 0 ? "[" : ",", (long long)r.timestamp_us, r.phase, r.name, r.task, (unsigned)r.arg);
+                if (n < 0 || n >= (int)sizeof(buf))
+                    continue;
+
+                if (httpd_resp_send_chunk(req, buf, n) != ESP_OK)
+                    return ESP_FAIL;
+            }
+
+            httpd_resp_send_chunk(req, records.empty() ? "[]" : "]", -1);
+            return httpd_resp_send_chunk(req, nullptr, 0);
+        }
+#endif
 
         int http_wifi_web_config_handler(httpd_req_t* req)
         {
+            trace_scope scope(this, "GET /webconfig");
+            update_httpd_stack();
             ESP_LOGI(TAG, "处理 http_wifi_web_config_handler 请求");
 
+#if WIFI_PROVISIONING_ASSETS
+            // 优先使用资源包中的页面
+            if (auto e = m_assets.find("/index.html"))
+                return m_assets.send(req, e);
+#endif
+
+#if WIFI_PROVISIONING_WEB_UI
             // 处理请求
             httpd_resp_send(req,
     R"xxxxxxxx(<!DOCTYPE html>
@@ -804,6 +5926,37 @@ namespace esp32_wifi_util
         <ul id="wifiList"></ul>
 
         <script>
+            function showResult(data) {
+                const wifiList = document.getElementById('wifiList');
+                wifiList.innerHTML = '';
+                const li = document.createElement('li');
+                if (data.result === 'ok') {
+                    li.textContent = data.ip ? `连接 WiFi 成功, IP: ${data.ip}` : '连接 WiFi 成功';
+                } else {
+                    li.textContent = `连接失败: ${data.result}`;
+                }
+                wifiList.appendChild(li);
+                console.log('Success:', data);
+            }
+
+            // 没有收到 /wc 的响应时（例如连接被中断），轮询 /wr 获取验证结果
+            function pollResult(retries) {
+                fetch('http://192.168.4.1/wr')
+                    .then(response => response.json())
+                    .then(data => {
+                        if (data.result === 'connecting' && retries > 0) {
+                            setTimeout(() => pollResult(retries - 1), 2000);
+                            return;
+                        }
+                        showResult(data);
+                    })
+                    .catch(error => {
+                        console.error('Error:', error);
+                        if (retries > 0)
+                            setTimeout(() => pollResult(retries - 1), 2000);
+                    });
+            }
+
             function configureWifi() {
                 const ssid = document.getElementById('ssid').value;
                 const password = document.getElementById('password').value;
@@ -821,18 +5974,15 @@ namespace esp32_wifi_util
                 })
                 .then(response => response.json())
                 .then(data => {
-                    const wifiList = document.getElementById('wifiList');
-                    wifiList.innerHTML = '';
-                    const li = document.createElement('li');
-                    if (data.result === 'ok') {
-                        li.textContent = '连接 WiFi 成功';
-                    } else {
-                        li.textContent = `连接失败: ${data.result}`;
-                    }
-                    wifiList.appendChild(li);
-                    console.log('Success:', data);
+                    if (data.result === 'ok')
+                        pollResult(0);
+                    else
+                        showResult(data);
                 })
-                .catch(error => console.error('Error:', error));
+                .catch(error => {
+                    console.error('Error:', error);
+                    pollResult(15);
+                });
             }
 
             function loadWifiList() {
@@ -858,23 +6008,62 @@ namespace esp32_wifi_util
         </script>
     </body>
     </html>)xxxxxxxx", -1);
+#else
+            httpd_resp_send_404(req);
+#endif
 
             return ESP_OK;
         }
 
+#if WIFI_PROVISIONING_ASSETS
+        int http_asset_handler(httpd_req_t* req)
+        {
+            trace_scope scope(this, "GET asset");
+            update_httpd_stack();
+            ESP_LOGI(TAG, "处理 http_asset_handler 请求: %s", req->uri);
+
+            auto e = m_assets.find(req->uri);
+            if (!e && (strcmp(req->uri, "/") == 0 || req->uri[0] == '?'))
+                e = m_assets.find("/index.html");
+
+            if (!e)
+            {
+                httpd_resp_send_404(req);
+                return ESP_OK;
+            }
+
+            return m_assets.send(req, e);
+        }
+#endif
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+        // 客户端会不停地发送探测，这里只发送预先生成的响应并立即关闭连接释放套接字，不输出日志
         int captive_redirect_uri_handler(httpd_req_t* req)
         {
-            ESP_LOGI(TAG, "处理 captive_redirect_uri_handler 请求");
+            trace_scope scope(this, "GET captive");
+
+            const char* response = CAPTIVE_REDIRECT;
+            size_t size = sizeof(CAPTIVE_REDIRECT) - 1;
+
+            if (m_probe_success && m_connection.load().connected)
+            {
+                for (const auto& probe : captive_probes)
+                {
+                    if (httpd_uri_match_wildcard(probe.uri, req->uri, strcspn(req->uri, "?")))
+                    {
+                        response = probe.success;
+                        size = probe.success_size;
+                        break;
+                    }
+                }
+            }
 
-            std::string url = "http://192.168.4.1/webconfig";
-            httpd_resp_set_type(req, "text/html");
-            httpd_resp_set_status(req, "302 Found");
-            httpd_resp_set_hdr(req, "Location", url.c_str());
-            httpd_resp_set_hdr(req, "Connection", "close");
-            httpd_resp_send(req, nullptr, 0);
+            httpd_send(req, response, size);
+            httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
 
             return ESP_OK;
         }
+#endif
 
         void reset_event_handler()
         {
@@ -902,117 +6091,83 @@ namespace esp32_wifi_util
                 &m_instance_got_ip));
         }
 
+        // 运行在 esp_event 任务中，所有组件的事件都由这个任务依次分发。这里只把事件的必要字段
+        // 复制到无锁环形缓冲区并唤醒控制任务，日志输出和其余处理都在控制任务中进行。
         void wifi_event_handler(esp_event_base_t event_base, int32_t event_id, void* event_data)
         {
+            auto start = esp_timer_get_time();
+            trace(event_base, 'i', event_id);
+
+            driver_event ev = {};
+            ev.base = event_base;
+            ev.id = event_id;
+            ev.timestamp_us = start;
+
             if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
             {
-                ESP_LOGI(TAG, "STATION 模式，已经连接到 Wi-Fi ");
-                xEventGroupSetBits(m_wifi_event_group, WIFI_DONE_BIT);
-                return;
-            }
-            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
-            {
-                ESP_LOGI(TAG, "STATION 模式，开始连接到 Wi-Fi");
-                if (m_wifi_mode == WIFI_MODE_STA)
-                    esp_wifi_connect();
+                auto event = (const wifi_event_sta_connected_t *)event_data;
+                ev.channel = event->channel;
+                memcpy(ev.bssid, event->bssid, sizeof(ev.bssid));
             }
             else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
             {
-                if (m_wifi_mode == WIFI_MODE_STA)
-                {
-                    ESP_LOGI(TAG, "STATION 模式，Wi-Fi 连接失败");
-                    xEventGroupSetBits(m_wifi_event_group, WIFI_FAIL_BIT);
-                }
-                else if (m_wifi_mode == WIFI_MODE_AP)
-                {
-                    ESP_LOGI(TAG, "AP 模式，重新连接到 Wi-Fi");
-                }
+                ev.code = ((const wifi_event_sta_disconnected_t *)event_data)->reason;
             }
             else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
             {
-                ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-                ESP_LOGI(TAG, "获取到 IP: " IPSTR, IP2STR(&event->ip_info.ip));
-                xEventGroupSetBits(m_wifi_event_group, WIFI_DONE_BIT);
-            }
-            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
-            {
-                ESP_LOGI(TAG, "Wi-Fi 扫描完成");
-                xEventGroupSetBits(m_wifi_event_group, WIFI_DONE_BIT);
-            }
-
-            if (event_id == WIFI_EVENT_AP_STACONNECTED)
-            {
-                wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
-                ESP_LOGI(TAG, "客户端 " MACSTR " 已连接, AID=%d",
-                         MAC2STR(event->mac), event->aid);
-            }
-            else if (event_id == WIFI_EVENT_AP_STADISCONNECTED)
-            {
-                wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
-                ESP_LOGI(TAG, "客户端 " MACSTR " 已离开, AID=%d",
-                         MAC2STR(event->mac), event->aid);
-            }
-        }
-
-        bool connect_wifi_impl(wifi_config_t* wifi_config)
-        {
-            // 获取 Wi-Fi 配置指针
-            if (!wifi_config || !wifi_config->sta.ssid[0])
-            {
-                ESP_LOGE(TAG, "Wi-Fi 配置无效");
-                return false;
+                auto event = (const ip_event_got_ip_t *)event_data;
+                ev.ip = event->ip_info.ip;
+                ev.gw = event->ip_info.gw;
             }
-
-            // 停止 Wi-Fi 扫描
-            esp_wifi_scan_stop();
-
-            // 保存 Wi-Fi 模式
-            m_wifi_mode = WIFI_MODE_STA;
-
-            // 初始化 Wi-Fi
-            wifi_config->sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
-            wifi_config->sta.failure_retry_cnt = 1;
-
-            // 开始连接 Wi-Fi
-            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, wifi_config));
-            if (!m_wifi_start)
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
             {
-                ESP_ERROR_CHECK(esp_wifi_start());
-                m_wifi_start = true;
+                ev.code = ((const wifi_event_sta_scan_done_t *)event_data)->status;
             }
-
-            auto ret = esp_wifi_connect();
-            if (ret != ESP_OK)
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED)
             {
-                ESP_LOGE(TAG, "Wi-Fi 连接失败: %s", esp_err_to_name(ret));
-                return false;
+                auto event = (const wifi_event_ap_staconnected_t *)event_data;
+                ev.code = event->aid;
+                memcpy(ev.bssid, event->mac, sizeof(ev.bssid));
             }
-
-            ESP_LOGI(TAG, "开始连接 WiFi %s, 密码: %s",
-                wifi_config->sta.ssid, wifi_config->sta.password);
-
-            xEventGroupClearBits(m_wifi_event_group, WIFI_DONE_BIT | WIFI_FAIL_BIT);
-            auto bits = xEventGroupWaitBits(m_wifi_event_group, WIFI_DONE_BIT | WIFI_FAIL_BIT, pdTRUE, pdFALSE, portMAX_DELAY);
-            if ((bits & WIFI_FAIL_BIT))
+            else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED)
             {
-                ESP_LOGE(TAG, "Wi-Fi 连接失败");
-                return false;
+                auto event = (const wifi_event_ap_stadisconnected_t *)event_data;
+                ev.code = event->aid;
+                memcpy(ev.bssid, event->mac, sizeof(ev.bssid));
+            }
+            else if (!(event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START))
+            {
+                return;
             }
 
-            ESP_LOGI(TAG, "Wi-Fi 连接成功");
-
-            return true;
+            // 不能阻塞 esp_event 任务，缓冲区满时丢弃事件并计数，控制任务看到计数后按驱动的实际状态
+            // 重新同步（见 resync_driver_state）
+            if (!m_event_ring.push(ev))
+                m_events_dropped++;
+            wake_control_task();
+
+            // 记录处理耗时，只有 esp_event 任务写入
+            uint32_t elapsed = esp_timer_get_time() - start;
+            m_event_stats_count.store(m_event_stats_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            m_event_stats_total_us.store(m_event_stats_total_us.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+            if (elapsed > m_event_stats_max_us.load(std::memory_order_relaxed))
+                m_event_stats_max_us.store(elapsed, std::memory_order_relaxed);
         }
 
-        void start_dns()
+#if WIFI_PROVISIONING_DNS
+        // 启动 DNS 服务器，已经在运行时直接返回成功
+        bool start_dns()
         {
+            if (m_dns_fd >= 0)
+                return true;
+
             ESP_LOGI(TAG, "Start DNS server...");
 
-            m_dns_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-            if (m_dns_fd < 0)
+            int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (fd < 0)
             {
                 ESP_LOGE(TAG, "Failed to create DNS socket: %s", strerror(errno));
-                return;
+                return false;
             }
 
             struct sockaddr_in dns_addr;
@@ -1021,40 +6176,73 @@ namespace esp32_wifi_util
             dns_addr.sin_port = htons(53);
             dns_addr.sin_addr.s_addr = htonl(INADDR_ANY);
 
-            if (bind(m_dns_fd, (struct sockaddr *)&dns_addr, sizeof(dns_addr)) < 0)
+            if (bind(fd, (struct sockaddr *)&dns_addr, sizeof(dns_addr)) < 0)
             {
                 ESP_LOGE(TAG, "Failed to bind DNS socket: %s", strerror(errno));
-                close(m_dns_fd);
-                m_dns_fd = -1;
-                return;
+                close(fd);
+                return false;
             }
 
-            ESP_LOGI(TAG, "DNS server started on port 53");
+            // 定期从 recvfrom 返回，以便 stop_dns 能让 DNS 任务退出
+            struct timeval timeout = { 0, DNS_RECV_TIMEOUT_MS * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            m_dns_exit = xSemaphoreCreateBinary();
+            m_dns_fd = fd;
 
-            xTaskCreate([](void* arg) {
+            if (!m_dns_exit || xTaskCreate([](void* arg) {
                 auto self = static_cast<wifi_provisioning_impl*>(arg);
                 self->dns_handler();
-            }, "dns_server", 4096, this, 5, NULL);
+                xSemaphoreGive(self->m_dns_exit);
+                vTaskDelete(nullptr);
+            }, "dns_server", 4096, this, 5, NULL) != pdPASS)
+            {
+                ESP_LOGE(TAG, "Failed to create DNS task");
+                m_dns_fd = -1;
+                close(fd);
+                if (m_dns_exit)
+                {
+                    vSemaphoreDelete(m_dns_exit);
+                    m_dns_exit = nullptr;
+                }
+                return false;
+            }
+
+            ESP_LOGI(TAG, "DNS server started on port 53");
+            return true;
         }
 
         void dns_handler()
         {
-            if (m_dns_fd < 0)
+            int fd = m_dns_fd;
+            if (fd < 0)
             return;
 
-            while (!m_abort)
+            // 套接字由 DNS 任务自己关闭
+            scoped_exit close_exit([&]
+                { close(fd); });
+
+            // stop_dns 清除 m_dns_fd 后退出
+            while (!m_abort && m_dns_fd == fd)
             {
                 struct sockaddr_in client_addr;
                 socklen_t addr_len = sizeof(client_addr);
 
-                char buffer[512];
-                ssize_t len = recvfrom(m_dns_fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &addr_len);
+                // 应答在查询之后追加 16 字节，接收时为其留出空间
+                char buffer[512 + 16];
+                ssize_t len = recvfrom(fd, buffer, sizeof(buffer) - 16, 0, (struct sockaddr *)&client_addr, &addr_len);
                 if (len < 0)
                 {
-                    ESP_LOGE(TAG, "Failed to receive DNS request: %s", strerror(errno));
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        ESP_LOGE(TAG, "Failed to receive DNS request: %s", strerror(errno));
                     continue;
                 }
 
+                if (len < 12)
+                    continue;
+
+                trace_scope scope(this, "dns query", len);
+                mark_portal_activity();
                 ESP_LOGI(TAG, "Received DNS request from %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
 
                 // 这里可以固定返回一个 IP 地址 192.168.4.1
@@ -1073,40 +6261,510 @@ namespace esp32_wifi_util
                 len += 4;
                 ESP_LOGI(TAG, "Sending DNS response to %s", inet_ntoa(ip_info.addr));
 
-                sendto(m_dns_fd, buffer, len, 0, (struct sockaddr *)&client_addr, addr_len);
+                sendto(fd, buffer, len, 0, (struct sockaddr *)&client_addr, addr_len);
+
+                m_dns_stack_free = uxTaskGetStackHighWaterMark(nullptr);
             }
         }
 
         void stop_dns()
         {
             ESP_LOGI(TAG, "stop DNS server...");
-            if (m_dns_fd >= 0)
+            // 通知 DNS 任务退出并等待，套接字由 DNS 任务关闭
+            if (m_dns_fd.exchange(-1) < 0)
+                return;
+
+            xSemaphoreTake(m_dns_exit, portMAX_DELAY);
+            vSemaphoreDelete(m_dns_exit);
+            m_dns_exit = nullptr;
+
+            ESP_LOGI(TAG, "DNS server stopped");
+        }
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+        //////////////// mDNS 应答器 ////////////////
+
+        bool do_start_mdns(const mdns_options& options)
+        {
+            do_stop_mdns();
+
+            m_mdns_options = options;
+
+            if (m_mdns_options.hostname.empty())
             {
-                close(m_dns_fd);
-                m_dns_fd = -1;
-                ESP_LOGI(TAG, "DNS server stopped");
+                uint8_t mac[6];
+                esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+                char hostname[16];
+                snprintf(hostname, sizeof(hostname), "esp32-%02x%02x%02x", mac[3], mac[4], mac[5]);
+                m_mdns_options.hostname = hostname;
+            }
+
+            // 名字的每个标签不能超过 63 字节，否则长度字节的高两位会被当作压缩指针；
+            // 主机名是 .local 下的单个标签，不能包含 '.'
+            const auto& hostname = m_mdns_options.hostname;
+            if (hostname.size() > 63 || hostname.find('.') != std::string::npos ||
+                m_mdns_options.instance.empty() || m_mdns_options.instance.size() > 63)
+            {
+                ESP_LOGE(TAG, "mDNS 主机名或实例名无效");
+                return false;
+            }
+
+            // TXT 记录的每项以一个长度字节开头，不能超过 255 字节
+            size_t txt_size = 0;
+            for (const auto& s : m_mdns_options.txt)
+            {
+                if (s.empty() || s.size() > 255)
+                {
+                    ESP_LOGE(TAG, "mDNS TXT 记录项的长度无效: %u", (unsigned)s.size());
+                    return false;
+                }
+                txt_size += 1 + s.size();
+            }
+
+            if (txt_size > MDNS_TXT_MAX_SIZE)
+            {
+                ESP_LOGE(TAG, "mDNS TXT 记录过长: %u", (unsigned)txt_size);
+                return false;
+            }
+
+            if (m_sta_netif)
+                esp_netif_set_hostname(m_sta_netif, m_mdns_options.hostname.c_str());
+
+            int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            if (fd < 0)
+            {
+                ESP_LOGE(TAG, "创建 mDNS 套接字失败: %s", strerror(errno));
+                return false;
+            }
+
+            int reuse = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(MDNS_PORT);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+            if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            {
+                ESP_LOGE(TAG, "绑定 mDNS 套接字失败: %s", strerror(errno));
+                close(fd);
+                return false;
+            }
+
+            // 定期从 recvfrom 返回，以便检查退出标志和接口地址的变化
+            struct timeval timeout = { 0, MDNS_RECV_TIMEOUT_MS * 1000 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+            // RFC 6762 要求组播报文的 TTL 为 255
+            uint8_t ttl = 255;
+            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+
+            m_mdns_exit = xSemaphoreCreateBinary();
+            m_mdns_fd = fd;
+
+            if (!m_mdns_exit || xTaskCreate([](void* arg) {
+                auto self = static_cast<wifi_provisioning_impl*>(arg);
+                self->mdns_handler();
+                xSemaphoreGive(self->m_mdns_exit);
+                vTaskDelete(nullptr);
+            }, "mdns", 4096, this, 5, NULL) != pdPASS)
+            {
+                ESP_LOGE(TAG, "创建 mDNS 任务失败");
+                m_mdns_fd = -1;
+                close(fd);
+                if (m_mdns_exit)
+                {
+                    vSemaphoreDelete(m_mdns_exit);
+                    m_mdns_exit = nullptr;
+                }
+                return false;
+            }
+
+            ESP_LOGI(TAG, "mDNS 应答器已启动, 主机名: %s.local", m_mdns_options.hostname.c_str());
+
+            return true;
+        }
+
+        // TXT 记录中的配网状态
+        static const char* mdns_state(const connection_info& info)
+        {
+            if (info.connected)
+                return "connected";
+            if (info.ap_ip)
+                return "provisioning";
+            return "idle";
+        }
+
+        // 生成 TXT 记录的数据：每项一个长度字节加内容
+        std::string mdns_txt(const connection_info& info) const
+        {
+            uint8_t mac[6];
+            esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+            char item[64];
+            std::string txt;
+
+            auto append = [&txt](std::string_view s)
+            {
+                if (s.size() > 255)
+                    return;
+                txt += (char)s.size();
+                txt.append(s);
+            };
+
+            snprintf(item, sizeof(item), "state=%s", mdns_state(info));
+            append(item);
+
+            snprintf(item, sizeof(item), "mac=%02X:%02X:%02X:%02X:%02X:%02X",
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            append(item);
+
+#if WIFI_PROVISIONING_WEB_UI
+            if (info.ap_ip)
+                append("path=/webconfig");
+#endif
+
+            for (const auto& s : m_mdns_options.txt)
+                append(s);
+
+            return txt;
+        }
+
+        static void mdns_membership(int fd, uint32_t iface, bool join)
+        {
+            struct ip_mreq mreq;
+            mreq.imr_multiaddr.s_addr = htonl(MDNS_GROUP);
+            mreq.imr_interface.s_addr = iface;
+
+            setsockopt(fd, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+        }
+
+        // to 为空时从 iface 接口发送到组播地址
+        static void mdns_send(int fd, mdns_responder& responder, mdns_responder::answer which,
+            uint32_t iface, const struct sockaddr_in* to)
+        {
+            auto packet = responder.prepare(which, iface);
+
+            struct sockaddr_in group;
+            if (!to)
+            {
+                struct in_addr addr;
+                addr.s_addr = iface;
+                setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+
+                memset(&group, 0, sizeof(group));
+                group.sin_family = AF_INET;
+                group.sin_port = htons(MDNS_PORT);
+                group.sin_addr.s_addr = htonl(MDNS_GROUP);
+                to = &group;
+            }
+
+            sendto(fd, packet.data(), packet.size(), 0, (const struct sockaddr *)to, sizeof(*to));
+        }
+
+        void mdns_handler()
+        {
+            int fd = m_mdns_fd;
+            if (fd < 0)
+                return;
+
+            // 套接字由 mDNS 任务自己关闭
+            scoped_exit close_exit([&]
+                { close(fd); });
+
+            mdns_responder responder;
+            connection_info current = {};
+            bool built = false;
+
+            // do_stop_mdns 清除 m_mdns_fd 后退出
+            while (!m_abort && m_mdns_fd == fd)
+            {
+                // 接口地址或配网状态变化时重新加入组播组、生成应答报文并通告
+                auto info = m_connection.load();
+                if (!built || info.ip != current.ip || info.ap_ip != current.ap_ip ||
+                    info.connected != current.connected)
+                {
+                    if (current.ip != info.ip)
+                    {
+                        if (current.ip)
+                            mdns_membership(fd, current.ip, false);
+                        if (info.ip)
+                            mdns_membership(fd, info.ip, true);
+                    }
+
+                    if (current.ap_ip != info.ap_ip)
+                    {
+                        if (current.ap_ip)
+                            mdns_membership(fd, current.ap_ip, false);
+                        if (info.ap_ip)
+                            mdns_membership(fd, info.ap_ip, true);
+                    }
+
+                    responder.build(m_mdns_options.hostname, m_mdns_options.instance,
+                        m_mdns_options.port, mdns_txt(info));
+                    current = info;
+                    built = true;
+
+                    if (current.ip)
+                        mdns_send(fd, responder, mdns_responder::ANSWER_SERVICE, current.ip, nullptr);
+                    if (current.ap_ip)
+                        mdns_send(fd, responder, mdns_responder::ANSWER_SERVICE, current.ap_ip, nullptr);
+                }
+
+                struct sockaddr_in client_addr;
+                socklen_t addr_len = sizeof(client_addr);
+
+                uint8_t buffer[512];
+                ssize_t len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&client_addr, &addr_len);
+                if (len < 0)
+                {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK)
+                        ESP_LOGE(TAG, "接收 mDNS 报文失败: %s", strerror(errno));
+                    continue;
+                }
+
+                auto query = responder.parse(buffer, len);
+                if (!query.answers)
+                    continue;
+
+                // 按来源地址判断查询来自热点还是 STA 接口，应答中使用该接口的地址
+                uint32_t src = client_addr.sin_addr.s_addr;
+                uint32_t iface = current.ip;
+                if (current.ap_ip && ((src ^ current.ap_ip) & htonl(AP_NETMASK)) == 0)
+                    iface = current.ap_ip;
+
+                if (!iface)
+                    continue;
+
+                // 源端口不是 5353 的传统单播查询以专门的报文单播应答，QU 查询单播应答，其它组播应答
+                bool legacy = ntohs(client_addr.sin_port) != MDNS_PORT;
+                auto to = query.unicast ? &client_addr : nullptr;
+
+                for (auto which : { mdns_responder::ANSWER_HOST, mdns_responder::ANSWER_SERVICE,
+                    mdns_responder::ANSWER_META })
+                {
+                    if (!(query.answers & which))
+                        continue;
+
+                    if (legacy)
+                    {
+                        auto packet = responder.prepare_legacy(which, iface, query);
+                        sendto(fd, packet.data(), packet.size(), 0, (const struct sockaddr *)&client_addr,
+                            sizeof(client_addr));
+                    }
+                    else
+                    {
+                        mdns_send(fd, responder, which, iface, to);
+                    }
+                }
             }
         }
 
+        void do_stop_mdns()
+        {
+            // 通知 mDNS 任务退出并等待，套接字由 mDNS 任务关闭
+            if (m_mdns_fd.exchange(-1) < 0)
+                return;
+
+            xSemaphoreTake(m_mdns_exit, portMAX_DELAY);
+            vSemaphoreDelete(m_mdns_exit);
+            m_mdns_exit = nullptr;
+
+            ESP_LOGI(TAG, "mDNS 应答器已停止");
+        }
+#endif
+
     private:
-        wifi_mode_t m_wifi_mode = WIFI_MODE_NULL;
+        // 以下状态只由控制任务访问
+        sta_state m_state = sta_state::IDLE;
+        bool m_driver_ready = false;
+        bool m_own_event_loop = false;
+        esp_netif_t* m_sta_netif = nullptr;
+        esp_netif_t* m_ap_netif = nullptr;
+        bool m_wifi_start = false;
+        bool m_ap_active = false;
+        bool m_scanning = false;
+        bool m_connect_on_start = false;
+        int m_retry_count = 0;
+
+        command* m_connect_cmd = nullptr;
+        std::vector<command*> m_connect_joiners;   // 重复提交的配网验证，与 m_connect_cmd 一起完成
+        int64_t m_connect_deadline = 0;
+        std::string m_attempt_ssid;
+        std::string m_attempt_password;
+        std::vector<command*> m_scan_waiters;
+        int64_t m_scan_deadline = 0;
+        std::vector<command*> m_deferred;
+        bool m_roam_scan = false;
+        command* m_ap_cmd = nullptr;                // 正在为其扫描热点信道的 START_AP 或 START_SERVER
+        wifi_mode_t m_ap_scan_mode = WIFI_MODE_NULL;    // 信道扫描前的 Wi-Fi 模式
+        int64_t m_ap_scan_started = 0;
+        int64_t m_last_roam_scan = 0;
+
+        // 链路监控
+        link_supervisor_options m_supervisor;
+        link_callback_t m_link_cb;
+        link_status m_reported_link = {};
+
+        bool m_supervised = false;
+        int64_t m_link_timer_at = 0;
+        int m_link_attempts = 0;
+        std::string m_link_ssid;
+        std::string m_link_password;
+        uint8_t m_link_bssid[6] = {};
+        uint8_t m_link_channel = 0;
+        int8_t m_link_rssi = 0;
+        uint8_t m_link_reason = 0;
+        esp_ip4_addr_t m_link_ip = {};
+        esp_ip4_addr_t m_link_gw = {};
+        esp_ping_handle_t m_ping = nullptr;
+        int m_ping_failures = 0;
+
+        // resume_connect 使用的 RTC 连接记录，m_static_ip 表示 DHCP 客户端已停止、使用记录中的地址
+        resume_record m_resume = {};
+        bool m_resume_lease = false;
+        bool m_static_ip = false;
+
+        // 后台计算 PSK 的任务，m_psk_exit 在任务退出时释放
+        TaskHandle_t m_psk_task = nullptr;
+        SemaphoreHandle_t m_psk_exit = nullptr;
+        uint32_t m_psk_seq = 0;
+        std::string m_psk_ssid;
+        std::string m_psk_password;
+
+        // 连接信息快照，m_published 是控制任务自己持有的副本，m_connection 供其它任务读取
+        std::string m_current_ssid;
+        esp_ip4_addr_t m_ap_ip = {};
+        connection_callback_t m_connection_cb;
+        connection_info m_published = {};
+        seqlock<connection_info> m_connection;
+
+#if WIFI_PROVISIONING_OTA
+        // OTA 升级在 httpd 任务中进行，m_ota_busy 保证同一时间只有一个写者
+        std::atomic<bool> m_ota_busy{ false };
+        seqlock<ota_status> m_ota_status;
+        ota_auth_callback_t m_ota_auth;     // 使用 m_mutex 保护
+#endif
+
+        // 异步接口
+        std::atomic<uint32_t> m_async_seq{ 0 };
+        inplace_function<void(bool), CALLBACK_CAPACITY> m_session_cb;
+        uint32_t m_session_seq = 0;
+
+        // 功耗与延迟模式
+        link_profile m_profile = link_profile::BALANCED;
+        uint16_t m_listen_interval = 3;
+
+        // 热点参数
+        ap_options m_ap_options;
+
+        // 配网验证成功后热点的保留时间，以及到期关闭热点的时刻（0 表示没有计划关闭）
+        int m_ap_grace_ms = 30 * 1000;
+        int64_t m_ap_off_at = 0;
+
+        // 配置热点的空闲超时。m_portal_activity 由 httpd 任务、DNS 任务和控制任务写入；
+        // m_portal_ssid 等保存 start_config_server 的参数，供重新广播使用
+        portal_idle_options m_portal_idle;
+        portal_callback_t m_portal_cb;
+        portal_state m_portal_state = portal_state::OFF;
+        std::atomic<int64_t> m_portal_activity{ 0 };
+        int64_t m_portal_timer_at = 0;
+        int64_t m_window_started = 0;
+        int m_ap_stations = 0;
+        std::string m_portal_ssid;
+        std::string m_portal_password;
+        int m_portal_port = 80;
+
+        // 往返时延测量，m_rtt_* 统计在测量期间由 ping 任务写入
+        command* m_rtt_cmd = nullptr;
+        esp_ping_handle_t m_rtt_ping = nullptr;
+        int64_t m_rtt_deadline = 0;
+        uint32_t m_rtt_min = 0;
+        uint32_t m_rtt_max = 0;
+        uint32_t m_rtt_sum = 0;
+        int m_rtt_received = 0;
+
+        // NVS 中的 Wi-Fi 配置，内部加锁，可以在任意任务中访问
+        credential_store m_store;
+
         esp_event_handler_instance_t m_instance_any_id = nullptr;
         esp_event_handler_instance_t m_instance_got_ip = nullptr;
-        EventGroupHandle_t m_wifi_event_group = nullptr;
 
         httpd_handle_t m_httpd_server = nullptr;
-        bool m_wifi_start = false;
-
-        connect_callback_t m_connect_cb;
-        scan_callback_t m_scan_cb;
-
-        std::string m_ssid;
+#if WIFI_PROVISIONING_ASSETS
+        asset_bundle m_assets;
+#endif
+
+        // 控制任务
+        TaskHandle_t m_control_task = nullptr;
+        QueueHandle_t m_control_queue = nullptr;
+        spsc_ring<driver_event, EVENT_RING_SIZE> m_event_ring;
+        std::atomic<uint32_t> m_events_dropped{ 0 };
+        SemaphoreHandle_t m_control_exit = nullptr;
+        std::atomic_bool m_running{ false };
+
+        // 以下状态会被其它任务读取
+        std::atomic<wifi_mode_t> m_wifi_mode{ WIFI_MODE_NULL };
+
+        mutable std::mutex m_mutex;     // 保护 m_wifi_list、m_verify_*、m_batch_* 和 m_ota_auth
+#if WIFI_PROVISIONING_SCAN
         std::vector<wifi_network> m_wifi_list;
-        int m_retry_count = 0;
-
-        int m_dns_fd = -1;
+        int64_t m_wifi_list_time = 0;
+#endif
+
+        // 最近一次配网验证的结果，供 /wr 查询
+        wifi_status m_verify_state = wifi_status::NOT_CONFIGURED;
+        std::string m_verify_ssid;
+        uint8_t m_verify_reason = 0;
+        std::string m_batch_id;         // 最近一次 /wb 请求的 id 和请求体的 CRC32
+        uint32_t m_batch_crc = 0;
+        esp_ip4_addr_t m_verify_ip = {};
+
+#if WIFI_PROVISIONING_DNS
+        std::atomic_int m_dns_fd{ -1 };
+        SemaphoreHandle_t m_dns_exit = nullptr;
+#endif
+
+#if WIFI_PROVISIONING_CAPTIVE_PORTAL
+        // 配网是否已经成功，由控制任务写入，httpd 任务读取
+        std::atomic_bool m_probe_success{ false };
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+        // m_mdns_options 由控制任务在创建 mDNS 任务前写入，mDNS 任务运行期间只读
+        mdns_options m_mdns_options;
+        std::atomic_int m_mdns_fd{ -1 };
+        SemaphoreHandle_t m_mdns_exit = nullptr;
+#endif
+
+        // 各阶段的内存使用记录，使用 m_mutex 保护；m_phase_free 只由控制任务访问
+        memory_usage m_memory[PHASE_COUNT] = {};
+        uint32_t m_phase_free[PHASE_COUNT] = {};
+        std::atomic<uint32_t> m_httpd_stack_free{ 0 };
+        std::atomic<uint32_t> m_dns_stack_free{ 0 };
+
+        // esp_event 任务中事件处理函数的耗时统计
+        std::atomic<uint32_t> m_event_stats_count{ 0 };
+        std::atomic<uint32_t> m_event_stats_max_us{ 0 };
+        std::atomic<uint32_t> m_event_stats_total_us{ 0 };
+
+#if WIFI_PROVISIONING_TRACE
+        trace_buffer m_trace;
+#endif
 
         std::atomic_bool m_abort{ false };
+
+        // 连接耗时记录，由控制任务写入，其它任务读取，使用 m_history_lock 保护
+        mutable portMUX_TYPE m_history_lock = portMUX_INITIALIZER_UNLOCKED;
+        wifi_connect_record m_history[CONNECT_HISTORY_SIZE] = {};
+        int m_history_next = 0;
+        int m_history_count = 0;
+        int m_attempt_index = -1;
+        connect_marks m_attempt_marks = {};
     };
 
     void Wifi_Event_Handler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
@@ -1129,29 +6787,133 @@ namespace esp32_wifi_util
         m_impl->auto_connect(connect_cb);
     }
 
+    void wifi_provisioning::resume_connect(connect_callback_t connect_cb)
+    {
+        m_impl->resume_connect(connect_cb);
+    }
+
     bool wifi_provisioning::start_config_server(std::string ap_ssid, std::string ap_password, int port)
     {
         return m_impl->start_config_server(ap_ssid, ap_password, port);
     }
 
+#if WIFI_PROVISIONING_SCAN
     void wifi_provisioning::scan_networks(scan_callback_t scan_callback)
     {
         m_impl->scan_networks(scan_callback);
     }
+#endif
 
     bool wifi_provisioning::connect_wifi(const std::string& ssid, const std::string& password)
     {
         return m_impl->connect_wifi(ssid, password);
     }
 
+    void wifi_provisioning::connect_wifi(const std::string& ssid, const std::string& password, connect_callback_t connect_cb)
+    {
+        m_impl->connect_wifi(ssid, password, connect_cb);
+    }
+
+    async_result<wifi_status> wifi_provisioning::auto_connect_async()
+    {
+        return m_impl->auto_connect_async();
+    }
+
+    async_result<wifi_status> wifi_provisioning::connect_async(const std::string& ssid, const std::string& password)
+    {
+        return m_impl->connect_async(ssid, password);
+    }
+
+#if WIFI_PROVISIONING_SCAN
+    async_result<std::vector<wifi_network>> wifi_provisioning::scan_async()
+    {
+        return m_impl->scan_async();
+    }
+#endif
+
+    async_result<wifi_status> wifi_provisioning::start_config_server_async(std::string ap_ssid,
+        std::string ap_password, int port)
+    {
+        return m_impl->start_config_server_async(ap_ssid, ap_password, port);
+    }
+
+    void wifi_provisioning::set_ap_options(const ap_options& options)
+    {
+        m_impl->set_ap_options(options);
+    }
+
+    void wifi_provisioning::set_portal_idle(const portal_idle_options& options, portal_callback_t portal_cb)
+    {
+        m_impl->set_portal_idle(options, portal_cb);
+    }
+
     bool wifi_provisioning::create_ap(const std::string& ap_ssid, const std::string& ap_password)
     {
         return m_impl->create_ap(ap_ssid, ap_password);
     }
 
-    void wifi_provisioning::stop()
+    void wifi_provisioning::set_link_supervisor(const link_supervisor_options& options, link_callback_t link_cb)
+    {
+        m_impl->set_link_supervisor(options, link_cb);
+    }
+
+    connection_info wifi_provisioning::get_connection_info() const
+    {
+        return m_impl->get_connection_info();
+    }
+
+#if WIFI_PROVISIONING_OTA
+    ota_status wifi_provisioning::get_ota_status() const
+    {
+        return m_impl->get_ota_status();
+    }
+
+    void wifi_provisioning::set_ota_authorizer(ota_auth_callback_t authorizer)
+    {
+        m_impl->set_ota_authorizer(authorizer);
+    }
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+    void wifi_provisioning::start_mdns(const mdns_options& options)
+    {
+        m_impl->start_mdns(options);
+    }
+
+    void wifi_provisioning::stop_mdns()
+    {
+        m_impl->stop_mdns();
+    }
+#endif
+
+    void wifi_provisioning::set_connection_callback(connection_callback_t connection_cb)
+    {
+        m_impl->set_connection_callback(connection_cb);
+    }
+
+    void wifi_provisioning::set_link_profile(link_profile profile, uint16_t listen_interval)
+    {
+        m_impl->set_link_profile(profile, listen_interval);
+    }
+
+    void wifi_provisioning::set_ap_grace_period(int grace_ms)
+    {
+        m_impl->set_ap_grace_period(grace_ms);
+    }
+
+    bool wifi_provisioning::measure_link_rtt(link_rtt_stats& stats, int count, int interval_ms)
+    {
+        return m_impl->measure_link_rtt(stats, count, interval_ms);
+    }
+
+    event_handler_stats wifi_provisioning::get_event_handler_stats() const
     {
-        m_impl->stop();
+        return m_impl->get_event_handler_stats();
+    }
+
+    void wifi_provisioning::stop(teardown_mode mode)
+    {
+        m_impl->stop(mode);
     }
 
     std::string wifi_provisioning::get_connected_ssid() const
@@ -1168,4 +6930,62 @@ namespace esp32_wifi_util
     {
         m_impl->clear_wifi_config();
     }
+
+    wifi_nvs_stats wifi_provisioning::get_nvs_stats() const
+    {
+        return m_impl->get_nvs_stats();
+    }
+
+    memory_usage wifi_provisioning::get_memory_usage(provisioning_phase phase) const
+    {
+        return m_impl->get_memory_usage(phase);
+    }
+
+    std::vector<wifi_connect_record> wifi_provisioning::get_connect_history() const
+    {
+        return m_impl->get_connect_history();
+    }
+
+#if WIFI_PROVISIONING_TRACE
+    std::vector<trace_record> wifi_provisioning::get_trace() const
+    {
+        return m_impl->get_trace();
+    }
+#endif
+}
+
+namespace async_detail
+{
+    // 使用一次性的 FreeRTOS 软件定时器，定时器只持有结果的弱引用，操作提前结束时到期后什么也不做
+    void cancel_after(std::shared_ptr<state_base> state, int timeout_ms)
+    {
+        if (timeout_ms <= 0)
+        {
+            state->cancel(async_status::TIMED_OUT);
+            return;
+        }
+
+        auto weak = new std::weak_ptr<state_base>(state);
+
+        auto timer = xTimerCreate("async_timeout", std::max<TickType_t>(pdMS_TO_TICKS(timeout_ms), 1),
+            pdFALSE, weak, [](TimerHandle_t timer)
+        {
+            auto weak = static_cast<std::weak_ptr<state_base>*>(pvTimerGetTimerID(timer));
+
+            if (auto state = weak->lock())
+                state->cancel(async_status::TIMED_OUT);
+
+            delete weak;
+            xTimerDelete(timer, 0);
+        });
+
+        if (!timer || xTimerStart(timer, 0) != pdPASS)
+        {
+            ESP_LOGE(esp32_wifi_util::TAG, "创建超时定时器失败");
+
+            if (timer)
+                xTimerDelete(timer, 0);
+            delete weak;
+        }
+    }
 }
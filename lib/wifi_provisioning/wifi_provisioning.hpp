@@ -9,9 +9,55 @@
 #define WIFI_PROVISIONING_HPP
 
 #include <string>
-#include <functional>
+#include <string_view>
+#include <span>
+#include <vector>
 #include <memory>
 
+#include <stdint.h>
+
+#include "inplace_function.hpp"
+#include "async_result.hpp"
+
+// 编译期功能选择，在 build_flags 中将对应的宏定义为 0 即可去掉该子系统的代码，
+// 例如只通过 /wc 配网的设备可以使用 -DWIFI_PROVISIONING_WEB_UI=0 -DWIFI_PROVISIONING_SCAN=0。
+// 各组合的 flash/RAM 占用可以用 tools/footprint.py 统计。
+#ifndef WIFI_PROVISIONING_DNS
+#define WIFI_PROVISIONING_DNS 1             // 强制门户 DNS 服务器，所有域名解析到热点地址
+#endif
+
+#ifndef WIFI_PROVISIONING_CAPTIVE_PORTAL
+#define WIFI_PROVISIONING_CAPTIVE_PORTAL 1  // 各系统联网检测 URL 重定向到配置页面
+#endif
+
+#ifndef WIFI_PROVISIONING_WEB_UI
+#define WIFI_PROVISIONING_WEB_UI 1          // 内置配置页面 /webconfig
+#endif
+
+#ifndef WIFI_PROVISIONING_ASSETS
+#define WIFI_PROVISIONING_ASSETS 1          // 从 webui 分区提供静态资源
+#endif
+
+#ifndef WIFI_PROVISIONING_TEST_ENDPOINT
+#define WIFI_PROVISIONING_TEST_ENDPOINT 1   // 测试接口 /test
+#endif
+
+#ifndef WIFI_PROVISIONING_SCAN
+#define WIFI_PROVISIONING_SCAN 1            // scan_networks 和网络列表接口 /wl
+#endif
+
+#ifndef WIFI_PROVISIONING_MDNS
+#define WIFI_PROVISIONING_MDNS 1            // mDNS/DNS-SD 应答器 start_mdns
+#endif
+
+#ifndef WIFI_PROVISIONING_OTA
+#define WIFI_PROVISIONING_OTA 0             // 流式 OTA 升级接口 POST /ota，需要 set_ota_authorizer，默认关闭
+#endif
+
+#ifndef WIFI_PROVISIONING_TRACE
+#define WIFI_PROVISIONING_TRACE 0           // 跟踪点、get_trace 和 /wt 接口，默认关闭
+#endif
+
 namespace esp32_wifi_util
 {
     enum class wifi_status
@@ -25,16 +71,238 @@ namespace esp32_wifi_util
 
     struct wifi_network
     {
-        std::string ssid;
+        char ssid[33];      // 以 '\0' 结尾
         int8_t rssi;        // 信号强度
         uint8_t auth_mode;  // 认证模式
     };
 
+    // 一次连接尝试中各个阶段的耗时记录，时间单位均为微秒，未经历的阶段为 0。
+    // 注意：驱动在 esp_wifi_connect 之后不会单独报告扫描、认证、关联和四次握手的完成事件，
+    // 因此这些步骤合并统计在 associate_us 中。
+    struct wifi_connect_record
+    {
+        int64_t timestamp_us;       // 本次尝试开始时刻（esp_timer_get_time）
+        int32_t load_us;            // 从 NVS 读取配置（仅 auto_connect），不计入 total_us
+        int32_t init_us;            // 驱动初始化（esp_wifi_init/esp_wifi_set_mode）
+        int32_t start_us;           // esp_wifi_start 到 WIFI_EVENT_STA_START
+        int32_t associate_us;       // esp_wifi_connect 到 WIFI_EVENT_STA_CONNECTED
+        int32_t dhcp_us;            // WIFI_EVENT_STA_CONNECTED 到 IP_EVENT_STA_GOT_IP
+        int32_t total_us;           // 开始到结束的总耗时
+        uint8_t disconnect_reason;  // 失败时的断开原因码（wifi_err_reason_t），成功为 0
+        wifi_status result;         // CONNECTING 表示尚未结束，否则为 CONNECTED 或 FAILED
+        bool resumed;               // 由 resume_connect 使用 RTC 中的连接记录发起
+    };
+
+    // 链路质量，按 RSSI 分级
+    enum class link_quality
+    {
+        NONE,               // 未连接
+        POOR,               // RSSI < -75 dBm
+        FAIR,               // -75 ~ -67 dBm
+        GOOD,               // -67 ~ -55 dBm
+        EXCELLENT           // RSSI >= -55 dBm
+    };
+
+    // 链路状态，由链路监控在状态或质量变化时回调
+    struct link_status
+    {
+        bool connected;
+        link_quality quality;
+        int8_t rssi;
+        uint8_t channel;
+        uint8_t bssid[6];
+        uint8_t disconnect_reason;  // 最近一次断开的原因码
+        int reconnect_attempts;     // 当前这轮重连已尝试的次数
+    };
+
+    // 连接信息快照，由控制任务在连接状态、地址或 AP 变化时整体发布，读取时不加锁也不分配内存
+    struct connection_info
+    {
+        bool connected;             // STA 已连接并获取到 IP
+        char ssid[33];              // 当前连接（或正在连接）的 SSID，只开热点时为热点名称
+        uint8_t bssid[6];
+        uint8_t channel;
+        int8_t rssi;                // 最近一次链路监控读取的 RSSI
+        uint32_t ip;                // STA 地址，网络字节序，未连接时为 0
+        uint32_t gateway;
+        uint32_t ap_ip;             // 热点地址，热点未开启时为 0
+        char ip_str[16];            // 与 get_connected_ip 相同：优先 STA 地址，其次热点地址
+    };
+
+    // 热点参数，create_ap 和 start_config_server 创建热点时使用
+    struct ap_options
+    {
+        uint8_t channel = 0;            // 信道，0 表示创建热点前快速扫描一次，选择最空闲的信道
+        uint16_t beacon_interval = 100; // beacon 间隔，单位 TU（1.024 毫秒），100 ~ 60000
+        bool ht40 = false;              // 使用 40 MHz 带宽，默认 20 MHz
+        int8_t max_tx_power = 0;        // 最大发射功率，单位 0.25 dBm（8 ~ 84），0 表示不修改，同时作用于 STA
+        uint8_t max_connection = 4;     // 最多同时连接的客户端数，1 ~ 10
+    };
+
+    // 配置热点的空闲状态，空闲是指没有 HTTP 请求、DNS 查询，也没有客户端连接到热点
+    enum class portal_state
+    {
+        OFF,                // 配置热点未开启，或已经关闭且不再重新广播
+        ACTIVE,             // 热点、DNS 和 HTTP 服务器都在运行
+        REDUCED,            // 空闲一段时间后停止了 HTTP 和 DNS 服务器并释放扫描结果，热点只发送 beacon；
+                            // 有客户端连接时恢复为 ACTIVE
+        SLEEPING,           // 空闲更久后关闭了热点，等待下一次重新广播
+        ADVERTISING         // 重新广播窗口，热点和服务器都在运行；窗口内有活动时转为 ACTIVE，否则再次关闭
+    };
+
+    // 配置热点的空闲超时，时间都从最近一次活动开始计算，0 表示不启用该项。全部为 0 时（默认）
+    // 配置热点一直运行到 stop 或配网成功后的宽限期结束。
+    struct portal_idle_options
+    {
+        uint32_t reduce_ms = 0;                 // 空闲多久后进入 REDUCED
+        uint32_t shutdown_ms = 0;               // 空闲多久后关闭热点
+        uint32_t readvertise_interval_ms = 0;   // 关闭后每隔多久重新广播一次，0 表示不重新广播
+        uint32_t readvertise_window_ms = 60000; // 每次重新广播的时长
+    };
+
+#if WIFI_PROVISIONING_MDNS
+    // mDNS/DNS-SD 广播选项
+    struct mdns_options
+    {
+        std::string hostname;                           // 主机名（不含 .local），为空时使用 esp32-<MAC 后三字节>
+        std::string instance = "ESP32 Wi-Fi Provisioning"; // _http._tcp 服务的实例名
+        uint16_t port = 80;                             // 广播的 HTTP 端口，配网结束后应由应用自己的服务器提供
+        std::vector<std::string> txt;                   // 额外的 TXT 记录，每项形如 "key=value"
+    };
+#endif
+
+    // 链路监控选项，连接成功后在后台监视链路并在断开后自动重连
+    struct link_supervisor_options
+    {
+        bool auto_reconnect = true;         // 断开后自动重连
+        int backoff_min_ms = 1000;          // 重连退避的初始间隔
+        int backoff_max_ms = 60000;         // 重连退避的最大间隔
+        int rssi_check_interval_ms = 10000; // RSSI 检查间隔
+        int8_t roam_rssi_threshold = -75;   // RSSI 低于该值时搜索同 SSID 的更强 AP，0 表示不漫游
+        int8_t roam_rssi_hysteresis = 8;    // 新 AP 的信号至少要强这么多 dB 才切换
+        int gateway_ping_interval_ms = 0;   // ping 网关的间隔，0 表示不 ping
+        int gateway_ping_failures = 3;      // 连续多少次 ping 失败视为链路失效
+    };
+
+    // 链路的功耗与延迟模式，连接时生效，也可以在运行时切换
+    enum class link_profile
+    {
+        LOW_LATENCY,        // 关闭省电（WIFI_PS_NONE），延迟最低，功耗最高
+        BALANCED,           // 最小 modem 省电（WIFI_PS_MIN_MODEM），每个 DTIM 醒来接收
+        LOW_POWER           // 最大 modem 省电（WIFI_PS_MAX_MODEM），按 listen_interval 醒来接收
+    };
+
+    // 到网关的往返时延统计，单位毫秒
+    struct link_rtt_stats
+    {
+        int sent;
+        int received;
+        uint32_t min_ms;
+        uint32_t avg_ms;
+        uint32_t max_ms;
+    };
+
+    // Wi-Fi 配置的 NVS 读写统计，时间单位为微秒
+    struct wifi_nvs_stats
+    {
+        int reads;              // 读取次数
+        int writes;             // 实际写入并提交的次数（含清除配置）
+        int skipped_writes;     // 内容未变化而跳过的写入次数
+        int failures;           // 失败的读写次数
+        int64_t read_us;        // 读取总耗时
+        int64_t write_us;       // 写入（含 nvs_commit）总耗时
+        int64_t max_write_us;   // 单次写入的最大耗时
+    };
+
+    // 配网流程中记录内存使用的阶段
+    enum class provisioning_phase
+    {
+        INIT,               // 网络协议栈和 Wi-Fi 驱动初始化
+        SCAN,               // 扫描网络（包括读取扫描结果）
+        CONFIG_SERVER,      // 创建热点，启动 DNS 和 HTTP 服务器
+        CONNECT             // 连接到 Wi-Fi，直到获取 IP 或失败
+    };
+
+    // 某个阶段最近一次执行前后的内存情况，单位为字节
+    struct memory_usage
+    {
+        bool recorded;                  // 该阶段是否已经执行过
+        uint32_t free_before;           // 阶段开始时的空闲堆
+        uint32_t free_after;            // 阶段结束时的空闲堆
+        uint32_t min_free;              // 阶段结束时开机以来的最小空闲堆
+        uint32_t largest_block;         // 阶段结束时最大的可分配块
+        uint32_t control_stack_free;    // 控制任务栈剩余空间的最小值（高水位）
+        uint32_t httpd_stack_free;      // httpd 任务栈剩余空间的最小值，0 表示还未处理过请求
+        uint32_t dns_stack_free;        // DNS 任务栈剩余空间的最小值，0 表示还未处理过请求
+    };
+
+    // 一条跟踪记录，可以用 tools/trace2chrome.py 转换为 Chrome trace 格式在时间线上查看
+    struct trace_record
+    {
+        int64_t timestamp_us;   // 记录时刻（esp_timer_get_time）
+        const char* name;       // 事件名称，指向静态字符串
+        uint32_t arg;           // 事件参数，例如事件 id、断开原因码
+        char phase;             // 'B' 开始，'E' 结束，'i' 瞬时事件，与 Chrome trace 的 ph 字段相同
+        char task[15];          // 记录所在任务名称的前 14 个字符
+    };
+
+    // 库在默认事件循环（esp_event 任务）中的事件处理函数的耗时统计，单位微秒。
+    // 这段时间内其它组件的事件分发都会被推迟。
+    struct event_handler_stats
+    {
+        uint32_t events;        // 处理的事件数
+        uint32_t avg_us;        // 平均耗时
+        uint32_t max_us;        // 最大耗时
+    };
+
+#if WIFI_PROVISIONING_OTA
+    // OTA 升级的状态
+    enum class ota_state
+    {
+        IDLE,               // 没有进行过升级
+        RECEIVING,          // 正在接收并写入固件
+        SUCCESS,            // 升级成功，重启后运行新固件
+        FAILED              // 升级失败，启动分区没有改变
+    };
+
+    // 最近一次 OTA 升级的进度和耗时，时间单位为微秒
+    struct ota_status
+    {
+        ota_state state;
+        uint32_t received;      // 已接收并提交写入的字节数
+        uint32_t total;         // 固件大小
+        uint32_t kbps;          // 平均吞吐量，KB/s
+        int64_t recv_us;        // 接收网络数据的总耗时
+        int64_t write_us;       // esp_ota_write 的总耗时，升级结束后有效
+        int64_t stall_us;       // 接收等待 flash 写入（两个缓冲区都在使用中）的总耗时
+    };
+#endif
+
+    // stop 释放资源的方式
+    enum class teardown_mode
+    {
+        KEEP_STA,           // 关闭热点、HTTP 和 DNS 服务器并释放热点接口，保留 STA 连接和 Wi-Fi 驱动
+        FULL                // 另外断开连接，释放 Wi-Fi 驱动、STA 接口以及库自己创建的默认事件循环
+    };
+
     class wifi_provisioning_impl;
 
-    using connect_callback_t = std::function<void(wifi_status, std::string)>;
-    using scan_callback_t = std::function<void(std::vector<wifi_network>)>;
+    // 回调保存在固定大小的缓冲区中，不分配堆内存，捕获的数据不能超过 CALLBACK_CAPACITY 字节。
+    // 回调参数中的 string_view 和 span 指向库内部的数据，只在回调期间有效，需要保留时请复制。
+    constexpr std::size_t CALLBACK_CAPACITY = 32;
 
+    using connect_callback_t = inplace_function<void(wifi_status, std::string_view), CALLBACK_CAPACITY>;
+    using scan_callback_t = inplace_function<void(std::span<const wifi_network>), CALLBACK_CAPACITY>;
+    using link_callback_t = inplace_function<void(const link_status&), CALLBACK_CAPACITY>;
+    using connection_callback_t = inplace_function<void(const connection_info&), CALLBACK_CAPACITY>;
+#if WIFI_PROVISIONING_OTA
+    using ota_auth_callback_t = inplace_function<bool(std::string_view), CALLBACK_CAPACITY>;
+#endif
+    using portal_callback_t = inplace_function<void(portal_state), CALLBACK_CAPACITY>;
+
+    // wifi_provisioning 内部由一个专用的控制任务（wifi_ctrl）持有全部 Wi-Fi 状态，公共接口只是
+    // 向该任务提交命令。所有回调都在控制任务中执行，回调中可以继续调用本类的接口，但不能在回调中
+    // 析构 wifi_provisioning 对象。
     class wifi_provisioning
     {
         // noncopyable for wifi_provisioning
@@ -46,9 +314,15 @@ namespace esp32_wifi_util
         ~wifi_provisioning();
 
     public:
-        // 开始自动配网
+        // 开始自动配网，立即返回，连接结果通过 connect_cb 回调通知。
         void auto_connect(connect_callback_t connect_cb);
 
+        // 从深度睡眠唤醒后快速恢复连接，立即返回，通过回调报告结果。
+        // 使用上次连接成功时保存在 RTC 内存中的记录（BSSID、信道、预先计算的 PSK 和 IP 地址租约），
+        // 不读取 NVS，只在记录中的信道上探测该 AP，租约未过期时跳过 DHCP。
+        // 没有有效的记录（例如上电或普通复位后）或恢复失败时退回 auto_connect 的流程。
+        void resume_connect(connect_callback_t connect_cb);
+
         // 启动配置服务器，通常用于在自动连接 Wi-Fi 失败时调用（auto_connect）。
         // 客户可通过内置的 web 页面进行配置，访问 http://192.168.4.1/webconfig 进入配置页面进行
         // 配置。
@@ -58,6 +332,7 @@ namespace esp32_wifi_util
         // 描到的可用 Wi-Fi 网络列表，并通过 http://192.168.4.1/wc (POST 请求) 提交一个 JSON 数
         // 据来配置 Wi-Fi，JSON 格式示例：
         //   {"ssid":"your_ssid","password":"your_password"}
+        // 如果没有收到 /wc 的响应，可以通过 http://192.168.4.1/wr (GET 请求) 查询最近一次验证的结果。
         //
         // 函数参数：
         //   - ap_ssid: 配置模式下设备的 Wi-Fi 热点名称，默认为 "ESP32"。
@@ -67,18 +342,60 @@ namespace esp32_wifi_util
         //   - bool: 启动服务器成功返回 true，失败返回 false。
         bool start_config_server(std::string ap_ssid = "ESP32", std::string ap_password = "", int port = 80);
 
-        // 扫描 Wi-Fi 网络
+#if WIFI_PROVISIONING_SCAN
+        // 扫描 Wi-Fi 网络，立即返回，扫描成功后通过 scan_callback 回调结果。
         void scan_networks(scan_callback_t scan_callback);
+#endif
 
-        // 连接到指定的 Wi-Fi 网络
+        // 连接到指定的 Wi-Fi 网络，阻塞等待连接结果（获取到 IP 为成功）。
         bool connect_wifi(const std::string& ssid, const std::string& password);
 
+        // 连接到指定的 Wi-Fi 网络，立即返回，连接结果通过 connect_cb 回调通知。
+        void connect_wifi(const std::string& ssid, const std::string& password, connect_callback_t connect_cb);
+
+        // 以下异步接口立即返回结果句柄，可以 wait/get 阻塞等待、then 注册完成回调，或在协程中 co_await。
+        // 句柄 cancel 或 cancel_after 超时会中止对应的连接或配网会话，扫描则只是不再等待结果。
+        // 对象 stop 或析构时未结束的操作以 FAILED 结束。
+
+        // 自动连接，结果为 CONNECTED 或 FAILED（包括没有保存的配置）。
+        async_result<wifi_status> auto_connect_async();
+
+        // 连接到指定的 Wi-Fi 网络，结果为 CONNECTED 或 FAILED。
+        async_result<wifi_status> connect_async(const std::string& ssid, const std::string& password);
+
+#if WIFI_PROVISIONING_SCAN
+        // 扫描 Wi-Fi 网络，结果为扫描到的网络列表的副本。
+        async_result<std::vector<wifi_network>> scan_async();
+#endif
+
+        // 启动配置服务器并开始一次配网会话，不等待服务器启动。用户通过配置页面提交的凭据验证成功后结果
+        // 为 CONNECTED；服务器启动失败或配置热点在配网成功前被关闭时为 FAILED。取消会话会关闭配置热点。
+        async_result<wifi_status> start_config_server_async(std::string ap_ssid = "ESP32",
+            std::string ap_password = "", int port = 80);
+
+        // 设置配网成功后热点的保留时间，默认 30000 毫秒。
+        // 通过配置页面提交的凭据在 APSTA 模式下验证，验证期间热点和 HTTP 服务保持工作；验证成功后，
+        // 热点、DNS 和 HTTP 服务再保留 grace_ms 毫秒让浏览器取得结果，之后关闭热点只保留 STA 连接。
+        // grace_ms 为负数时不自动关闭。
+        void set_ap_grace_period(int grace_ms);
+
+        // 设置热点参数，在下次创建热点时生效。超出范围的参数会被限制到有效范围内。
+        void set_ap_options(const ap_options& options);
+
+        // 设置配置热点的空闲超时，立即生效，空闲时间从设置时重新计算。portal_cb 在配置热点的状态
+        // 变化时回调，包括 start_config_server、stop 和配网成功后关闭热点引起的变化。
+        // 配网会话在热点关闭且不再重新广播时以 FAILED 结束；会重新广播时会话保持，在之后的广播窗口中
+        // 仍然可以完成配网。STA 已经连接或正在连接时跳过重新广播。
+        void set_portal_idle(const portal_idle_options& options, portal_callback_t portal_cb = {});
+
         // 创建一个 Wi-Fi 热点
         bool create_ap(const std::string& ap_ssid, const std::string& ap_password);
 
-        // 停止，当调用 stop 时，会停止所有的 Wi-Fi 操作，如果已经连接到 Wi-Fi，不会断开连接。
-        // 通常用于程序退出时调用，或者成功连接到 Wi-Fi 后调用以释放资源。
-        void stop();
+        // 停止，当调用 stop 时，会停止所有的 Wi-Fi 操作，等待库创建的任务退出并释放扫描结果等缓冲区。
+        // KEEP_STA 模式下如果已经连接到 Wi-Fi，不会断开连接；FULL 模式下释放库占用的全部驱动资源，
+        // 之后堆内存应回到构造前的水平（esp_netif_init 初始化的协议栈除外）。
+        // 通常用于程序退出时调用，或者成功连接到 Wi-Fi 后调用以释放资源。析构函数以 KEEP_STA 模式调用。
+        void stop(teardown_mode mode = teardown_mode::KEEP_STA);
 
         // 连接到指定的 Wi-Fi 网络的 SSID
         std::string get_connected_ssid() const;
@@ -86,9 +403,71 @@ namespace esp32_wifi_util
         // 获取连接的 IP 地址
         std::string get_connected_ip() const;
 
+        // 获取连接信息快照。可在任意任务中调用，不加锁、不分配内存，也不访问 netif。
+        connection_info get_connection_info() const;
+
+#if WIFI_PROVISIONING_OTA
+        // 获取最近一次通过 POST /ota 升级的进度，可在任意任务中调用
+        ota_status get_ota_status() const;
+
+        // 设置 POST /ota 的认证函数。每个升级请求在写入 flash 之前以 Authorization 请求头的值（没有时为空）
+        // 调用 authorizer，返回 false 时以 401 拒绝。未设置时拒绝所有升级请求。authorizer 在 httpd 任务中
+        // 调用，不能阻塞；比较令牌时应使用与内容无关的固定时间比较。
+        void set_ota_authorizer(ota_auth_callback_t authorizer);
+#endif
+
+#if WIFI_PROVISIONING_MDNS
+        // 启动 mDNS/DNS-SD 应答器，在 STA 和热点接口上把设备广播为 <hostname>.local，并广播 _http._tcp
+        // 服务。TXT 记录包含 state（idle、provisioning 或 connected）、mac、path 以及 options.txt，
+        // 状态或地址变化时自动更新并重新通告。再次调用以新的选项重新启动，stop 时停止。
+        void start_mdns(const mdns_options& options = {});
+
+        // 停止 mDNS 应答器
+        void stop_mdns();
+#endif
+
+        // 设置连接信息变化的回调，设置后立即以当前快照回调一次。之后在连接状态、SSID、BSSID、
+        // 信道或地址变化时回调，RSSI 的变化只更新快照不回调。
+        void set_connection_callback(connection_callback_t connection_cb);
+
         // 清除 Wi-Fi 配置信息
         void clear_wifi_config();
 
+        // 获取 Wi-Fi 配置的 NVS 读写次数和耗时。配置只在内容变化时写入，重复提交相同的网络不会
+        // 写 flash。
+        wifi_nvs_stats get_nvs_stats() const;
+
+        // 获取某个阶段最近一次执行前后的堆和任务栈使用情况，可用于检查内存预算。
+        memory_usage get_memory_usage(provisioning_phase phase) const;
+
+        // 获取库的事件处理函数在默认事件循环中的耗时统计。事件处理函数只把事件复制到无锁缓冲区，
+        // 日志输出等其余工作由库的控制任务完成。
+        event_handler_stats get_event_handler_stats() const;
+
+        // 设置链路监控选项。连接成功后，在对象存活且未调用 stop 期间，链路监控会在后台检查 RSSI
+        // 和网关连通性，断开后按退避间隔自动重连（首次重连复用上次的信道和 BSSID），信号变弱时
+        // 漫游到同一 SSID 下信号更强的 AP。link_cb 在连接状态或链路质量变化时回调。
+        void set_link_supervisor(const link_supervisor_options& options, link_callback_t link_cb = {});
+
+        // 设置链路的功耗与延迟模式，默认为 BALANCED。省电模式立即生效，listen_interval（单位为
+        // beacon 间隔，仅 LOW_POWER 使用）在下次关联 AP 时生效。
+        void set_link_profile(link_profile profile, uint16_t listen_interval = 3);
+
+        // 测量到网关的往返时延，阻塞直到 count 次 ping 完成，未连接时返回 false。
+        // 可用于比较不同 link_profile 下的延迟。
+        bool measure_link_rtt(link_rtt_stats& stats, int count = 10, int interval_ms = 100);
+
+        // 获取最近若干次连接尝试的分阶段耗时记录，按时间从旧到新排列。
+        // 配置服务器运行时，也可以通过 http://192.168.4.1/ws (GET 请求) 以 JSON 格式获取。
+        std::vector<wifi_connect_record> get_connect_history() const;
+
+#if WIFI_PROVISIONING_TRACE
+        // 获取跟踪缓冲区中的记录，按时间从旧到新排列。跟踪点包括事件处理、控制任务处理驱动事件、
+        // 各阶段和连接的开始结束、HTTP 请求、DNS 查询以及扫描。
+        // 配置服务器运行时，也可以通过 http://192.168.4.1/wt (GET 请求) 以 JSON 格式获取。
+        std::vector<trace_record> get_trace() const;
+#endif
+
     private:
         std::unique_ptr<wifi_provisioning_impl> m_impl;
     };
@@ -44,20 +44,36 @@ void setup()
 
     g_wifi_provisioning = new wifi_provisioning;
 
-    g_wifi_provisioning->auto_connect([](wifi_status status, std::string ssid) mutable
+    // 连接成功后由链路监控负责断线重连和漫游
+    link_supervisor_options options;
+    options.gateway_ping_interval_ms = 5000;
+
+    g_wifi_provisioning->set_link_supervisor(options, [](const link_status& status)
+    {
+        if (status.connected)
+            ESP_LOGI(TAG, "Wi-Fi 链路质量: %d, RSSI: %d", (int)status.quality, status.rssi);
+        else
+            ESP_LOGW(TAG, "Wi-Fi 链路断开, reason: %d, 重连次数: %d",
+                status.disconnect_reason, status.reconnect_attempts);
+    });
+
+    // 地址变化时输出，无需在 loop 中轮询
+    g_wifi_provisioning->set_connection_callback([](const connection_info& info)
+    {
+        ESP_LOGI(TAG, "IP 地址: %s, SSID: %s, 信道: %d", info.ip_str, info.ssid, info.channel);
+    });
+
+    g_wifi_provisioning->auto_connect([](wifi_status status, std::string_view ssid)
     {
         switch (status)
         {
         case wifi_status::CONNECTED:
-            ESP_LOGI(TAG, "Wi-Fi 连接成功: %s", ssid.c_str());
+            ESP_LOGI(TAG, "Wi-Fi 连接成功: %.*s", (int)ssid.size(), ssid.data());
 
-            // 连接成功释放资源.
-            g_wifi_provisioning->stop();
-            delete g_wifi_provisioning;
-            g_wifi_provisioning = nullptr;
+            // 保持对象存活，链路监控会在断线后自动重连.
             break;
         case wifi_status::FAILED:
-            ESP_LOGE(TAG, "Wi-Fi 连接失败: %s", ssid.c_str());
+            ESP_LOGE(TAG, "Wi-Fi 连接失败: %.*s", (int)ssid.size(), ssid.data());
             g_wifi_provisioning->start_config_server("ESP32-XXXX", "20121208");
             break;
         default:
@@ -75,8 +91,6 @@ void loop()
 
     if (g_wifi_provisioning)
     {
-        ESP_LOGI(TAG, "IP 地址: %s", g_wifi_provisioning->get_connected_ip().c_str());
-
         if (++count == 2000)
         {
             g_wifi_provisioning->stop();
@@ -5,12 +5,25 @@
 // Email:  jack.wgm at gmail dot com
 //
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <esp_log.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
+#include <esp_system.h>
+
+#ifdef EVENT_LATENCY_BENCHMARK
+#include <esp_timer.h>
+#endif
+
+#ifdef DEEP_SLEEP_BENCHMARK
+#include <atomic>
+#include <esp_attr.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#endif
 
 #include "wifi_provisioning.hpp"
 #include "scoped_exit.hpp"
@@ -20,34 +33,262 @@ using namespace esp32_wifi_util;
 static const char *TAG = "GUEST";
 static wifi_provisioning* g_wifi_provisioning = nullptr;
 
+#ifdef EVENT_LATENCY_BENCHMARK
+// 测量安装本库后默认事件循环的分发延迟：定时向默认事件循环投递带时间戳的事件，在处理函数中
+// 统计从投递到分发的延迟，同时输出本库事件处理函数的耗时。配网和连接过程中产生的大量 Wi-Fi
+// 事件会与这些事件在同一个任务中排队分发。
+// 在 platformio.ini 的 build_flags 中加入 -DEVENT_LATENCY_BENCHMARK 启用。
+static const char *BENCH_EVENT = "BENCH_EVENT";
+
+static struct
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+} g_dispatch_latency;
+
+static void start_event_latency_benchmark()
+{
+    // 默认事件循环可能已经存在
+    esp_event_loop_create_default();
+
+    esp_event_handler_register(BENCH_EVENT, ESP_EVENT_ANY_ID,
+        [](void*, esp_event_base_t, int32_t, void* event_data)
+        {
+            int64_t posted;
+            memcpy(&posted, event_data, sizeof(posted));
+
+            uint32_t latency = esp_timer_get_time() - posted;
+            g_dispatch_latency.count++;
+            g_dispatch_latency.total_us += latency;
+            if (latency > g_dispatch_latency.max_us)
+                g_dispatch_latency.max_us = latency;
+        }, nullptr);
+
+    esp_timer_create_args_t args = {};
+    args.callback = [](void*)
+    {
+        int64_t now = esp_timer_get_time();
+        esp_event_post(BENCH_EVENT, 0, &now, sizeof(now), 0);
+    };
+    args.name = "bench_event";
+
+    esp_timer_handle_t timer;
+    esp_timer_create(&args, &timer);
+    esp_timer_start_periodic(timer, 10 * 1000);
+}
+
+static void report_event_latency()
+{
+    auto count = g_dispatch_latency.count;
+    if (!count)
+        return;
+
+    auto stats = g_wifi_provisioning->get_event_handler_stats();
+
+    ESP_LOGI(TAG, "事件分发延迟 avg/max: %u/%u us (%u 个事件), 库事件处理 avg/max: %u/%u us (%u 个事件)",
+        (unsigned)(g_dispatch_latency.total_us / count), (unsigned)g_dispatch_latency.max_us, (unsigned)count,
+        (unsigned)stats.avg_us, (unsigned)stats.max_us, (unsigned)stats.events);
+}
+#endif
+
+#ifdef DEEP_SLEEP_BENCHMARK
+// 每次从深度睡眠唤醒后交替使用 resume_connect 和 auto_connect 连接，比较从唤醒到连接成功的耗时
+// （esp_timer 的计时，不含 ROM 和二级引导程序的时间），连接成功后再次进入深度睡眠。
+// 在 platformio.ini 的 build_flags 中加入 -DDEEP_SLEEP_BENCHMARK 启用，设备需要已经配网。
+static const uint64_t DEEP_SLEEP_BENCHMARK_US = 10 * 1000 * 1000;
+
+// 0 为 resume_connect，1 为 auto_connect，统计保存在 RTC 内存中，跨越深度睡眠累计
+static RTC_DATA_ATTR uint32_t g_wake_count;
+static RTC_DATA_ATTR uint32_t g_path_count[2];
+static RTC_DATA_ATTR uint64_t g_path_total_ms[2];
+static int g_path = 0;
+static std::atomic<bool> g_sleep_ready{ false };
+
+static void start_deep_sleep_benchmark()
+{
+    // 上电后的第一次连接没有 RTC 记录，不计入统计
+    bool woken = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+    g_path = g_wake_count++ % 2;
+
+    auto on_connect = [woken](wifi_status status, std::string_view ssid)
+    {
+        if (status != wifi_status::CONNECTED && status != wifi_status::FAILED)
+            return;
+
+        uint32_t ms = esp_timer_get_time() / 1000;
+        if (status == wifi_status::CONNECTED && woken)
+        {
+            g_path_count[g_path]++;
+            g_path_total_ms[g_path] += ms;
+        }
+
+        ESP_LOGI(TAG, "%s %s, 唤醒后 %u ms", g_path == 0 ? "resume_connect" : "auto_connect",
+            status == wifi_status::CONNECTED ? "连接成功" : "连接失败", (unsigned)ms);
+
+        for (int i = 0; i < 2; i++)
+        {
+            if (g_path_count[i])
+                ESP_LOGI(TAG, "%-14s 平均 %u ms (%u 次)", i == 0 ? "resume_connect" : "auto_connect",
+                    (unsigned)(g_path_total_ms[i] / g_path_count[i]), (unsigned)g_path_count[i]);
+        }
+
+        g_sleep_ready = true;
+    };
+
+    if (g_path == 0)
+        g_wifi_provisioning->resume_connect(on_connect);
+    else
+        g_wifi_provisioning->auto_connect(on_connect);
+}
+#endif
+
+#ifdef ASYNC_PROVISIONING_EXAMPLE
+// 用协程组合自动连接和配网会话：自动连接失败或超时后启动配置服务器，等待用户通过配置页面完成配网。
+// 在 platformio.ini 的 build_flags 中加入 -DASYNC_PROVISIONING_EXAMPLE 启用，代替下面基于回调的流程。
+static async_result<bool> provision(wifi_provisioning& wp)
+{
+    auto status = co_await wp.auto_connect_async().cancel_after(30000);
+    if (status == wifi_status::CONNECTED)
+        co_return true;
+
+    ESP_LOGW(TAG, "自动连接失败, 启动配置服务器");
+
+    // 10 分钟内没有完成配网则关闭配置热点
+    status = co_await wp.start_config_server_async("ESP32-XXXX", "20121208").cancel_after(10 * 60 * 1000);
+
+    co_return status == wifi_status::CONNECTED;
+}
+
+static async_result<bool> g_provisioned;
+#endif
+
 extern "C" void setup()
 {
     ESP_LOGI(TAG, "进入配置阶段");
 
     g_wifi_provisioning = new wifi_provisioning;
 
-    g_wifi_provisioning->auto_connect([](wifi_status status, std::string ssid) mutable
+#ifdef EVENT_LATENCY_BENCHMARK
+    start_event_latency_benchmark();
+#endif
+
+#ifdef DEEP_SLEEP_BENCHMARK
+    start_deep_sleep_benchmark();
+    return;
+#endif
+
+#ifdef AP_CHANNEL_BENCHMARK
+    // 只启动配置热点，用 tools/page_throughput.py 测量配置页面的吞吐量。
+    // -DAP_CHANNEL_BENCHMARK=1 固定使用信道 1，-DAP_CHANNEL_BENCHMARK=0 自动选择信道。
+    ap_options ap;
+    ap.channel = AP_CHANNEL_BENCHMARK;
+    g_wifi_provisioning->set_ap_options(ap);
+    g_wifi_provisioning->start_config_server("ESP32-XXXX", "20121208");
+    return;
+#endif
+
+#ifdef PORTAL_IDLE_EXAMPLE
+    // 配置热点空闲 2 分钟后停止 HTTP 和 DNS 服务器，5 分钟后关闭热点，之后每 10 分钟重新广播 1 分钟。
+    // 每次状态变化时输出空闲堆，对比各状态占用的内存
+    portal_idle_options idle;
+    idle.reduce_ms = 2 * 60 * 1000;
+    idle.shutdown_ms = 5 * 60 * 1000;
+    idle.readvertise_interval_ms = 10 * 60 * 1000;
+    idle.readvertise_window_ms = 60 * 1000;
+
+    g_wifi_provisioning->set_portal_idle(idle, [](portal_state state)
+    {
+        static const char* names[] = { "OFF", "ACTIVE", "REDUCED", "SLEEPING", "ADVERTISING" };
+        ESP_LOGI(TAG, "配置热点: %s, 空闲堆: %u", names[(int)state], (unsigned)esp_get_free_heap_size());
+    });
+#endif
+
+    // 连接成功后由链路监控负责断线重连和漫游
+    link_supervisor_options options;
+    options.gateway_ping_interval_ms = 5000;
+
+    g_wifi_provisioning->set_link_supervisor(options, [](const link_status& status)
+    {
+        if (status.connected)
+            ESP_LOGI(TAG, "Wi-Fi 链路质量: %d, RSSI: %d", (int)status.quality, status.rssi);
+        else
+            ESP_LOGW(TAG, "Wi-Fi 链路断开, reason: %d, 重连次数: %d",
+                status.disconnect_reason, status.reconnect_attempts);
+    });
+
+    // 地址变化时输出，无需在 loop 中轮询
+    g_wifi_provisioning->set_connection_callback([](const connection_info& info)
+    {
+        ESP_LOGI(TAG, "IP 地址: %s, SSID: %s, 信道: %d", info.ip_str, info.ssid, info.channel);
+    });
+
+#ifdef ASYNC_PROVISIONING_EXAMPLE
+    // 配网在后台进行，loop 不会被阻塞
+    g_provisioned = provision(*g_wifi_provisioning);
+#else
+    g_wifi_provisioning->auto_connect([](wifi_status status, std::string_view ssid)
     {
         switch (status)
         {
         case wifi_status::CONNECTED:
-            ESP_LOGI(TAG, "Wi-Fi 连接成功: %s", ssid.c_str());
+            ESP_LOGI(TAG, "Wi-Fi 连接成功: %.*s", (int)ssid.size(), ssid.data());
 
-            // 连接成功释放资源.
-            g_wifi_provisioning->stop();
-            delete g_wifi_provisioning;
-            g_wifi_provisioning = nullptr;
+            // 保持对象存活，链路监控会在断线后自动重连.
             break;
         case wifi_status::FAILED:
-            ESP_LOGE(TAG, "Wi-Fi 连接失败: %s", ssid.c_str());
+            ESP_LOGE(TAG, "Wi-Fi 连接失败: %.*s", (int)ssid.size(), ssid.data());
             g_wifi_provisioning->start_config_server("ESP32-XXXX", "20121208");
             break;
         default:
             break;
         }
     });
+#endif
+}
+
+#ifdef MEMORY_BUDGET_CHECK
+// 检查各阶段的内存使用是否超出预算，超出时终止运行，使自动化测试失败。
+// 在 platformio.ini 的 build_flags 中加入 -DMEMORY_BUDGET_CHECK 启用。
+static void check_memory_budget()
+{
+    const struct
+    {
+        provisioning_phase phase;
+        const char* name;
+        uint32_t max_heap_used;     // 阶段内允许消耗的堆
+        uint32_t min_stack_free;    // 控制任务栈至少剩余
+    } budgets[] = {
+        { provisioning_phase::INIT, "init", 64 * 1024, 1024 },
+        { provisioning_phase::SCAN, "scan", 8 * 1024, 1024 },
+        { provisioning_phase::CONFIG_SERVER, "config server", 48 * 1024, 1024 },
+        { provisioning_phase::CONNECT, "connect", 32 * 1024, 1024 },
+    };
+
+    bool ok = true;
+
+    for (const auto& b : budgets)
+    {
+        auto usage = g_wifi_provisioning->get_memory_usage(b.phase);
+        if (!usage.recorded)
+            continue;
+
+        uint32_t used = usage.free_before > usage.free_after ? usage.free_before - usage.free_after : 0;
+
+        ESP_LOGI(TAG, "%-14s 堆: %u/%u, 控制任务栈剩余: %u", b.name,
+            (unsigned)used, (unsigned)b.max_heap_used, (unsigned)usage.control_stack_free);
+
+        if (used > b.max_heap_used || usage.control_stack_free < b.min_stack_free)
+        {
+            ESP_LOGE(TAG, "%s 阶段超出内存预算", b.name);
+            ok = false;
+        }
+    }
 
+    if (!ok)
+        abort();
 }
+#endif
 
 extern "C" void loop()
 {
@@ -57,7 +298,36 @@ extern "C" void loop()
 
     if (g_wifi_provisioning)
     {
-        ESP_LOGI(TAG, "IP 地址: %s", g_wifi_provisioning->get_connected_ip().c_str());
+#ifdef ASYNC_PROVISIONING_EXAMPLE
+        static bool provision_reported = false;
+        if (!provision_reported && g_provisioned.ready())
+        {
+            ESP_LOGI(TAG, "配网流程结束: %s", g_provisioned.get() ? "成功" : "失败");
+            provision_reported = true;
+        }
+#endif
+
+#ifdef MEMORY_BUDGET_CHECK
+        static bool budget_checked = false;
+        if (!budget_checked)
+        {
+            check_memory_budget();
+            budget_checked = true;
+        }
+#endif
+
+#ifdef EVENT_LATENCY_BENCHMARK
+        if (count % 10 == 0)
+            report_event_latency();
+#endif
+
+#ifdef DEEP_SLEEP_BENCHMARK
+        if (g_sleep_ready)
+        {
+            ESP_LOGI(TAG, "进入深度睡眠");
+            esp_deep_sleep(DEEP_SLEEP_BENCHMARK_US);
+        }
+#endif
 
         if (++count == 2000)
         {
@@ -0,0 +1,367 @@
+#!/usr/bin/env python3
+# 批量配网工具：并发地为多台设备配置 Wi-Fi 凭据和设备设置。
+#
+# 每台设备使用一个 HTTP/1.1 长连接，GET /wl 和 POST /wb 在同一连接上流水线发送，
+# 设备不支持 /wb（旧固件）时退回到 /wc。每台设备的请求 id 在重试时保持不变，
+# 设备据此保证重试不会重复配网。
+#
+# 用法：
+#   python tools/fleet_provision.py devices.csv --ssid office --password secret
+#   python tools/fleet_provision.py devices.csv --ssid office --password secret \
+#       --profile low_power --ap-grace-ms 5000 --concurrency 16 --report report.json
+#
+# devices.csv 第一行为表头，必须包含 address 列（host 或 host:port），
+# 可选列 ssid、password、profile、ap_grace_ms、listen_interval 覆盖命令行中的默认值。
+#
+# 不连接真实设备，启动本地模拟设备验证工具本身（包括丢包重试和密码错误）：
+#   python tools/fleet_provision.py --simulate 20 --ssid office --password secret
+
+import argparse
+import asyncio
+import csv
+import json
+import random
+import sys
+import time
+import uuid
+
+DEFAULT_PORT = 80
+SETTING_FIELDS = ('profile', 'ap_grace_ms', 'listen_interval')
+
+
+class TransportError(Exception):
+    pass
+
+
+class HttpConnection:
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+
+    @classmethod
+    async def open(cls, host, port, timeout):
+        try:
+            reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+        except (OSError, asyncio.TimeoutError) as e:
+            raise TransportError('connect failed: %s' % e) from e
+        return cls(reader, writer)
+
+    def close(self):
+        self.writer.close()
+
+    # 一次写入多个请求（流水线），响应按请求顺序返回
+    async def pipeline(self, host, requests, timeout):
+        data = bytearray()
+        for method, path, body in requests:
+            payload = json.dumps(body).encode() if body is not None else b''
+            data += ('%s %s HTTP/1.1\r\nHost: %s\r\nContent-Length: %d\r\n' %
+                     (method, path, host, len(payload))).encode()
+            if body is not None:
+                data += b'Content-Type: application/json\r\n'
+            data += b'\r\n' + payload
+
+        try:
+            self.writer.write(bytes(data))
+            await self.writer.drain()
+            return [await asyncio.wait_for(self._read_response(), timeout) for _ in requests]
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, ValueError) as e:
+            raise TransportError('request failed: %r' % e) from e
+
+    async def _read_response(self):
+        status_line = await self.reader.readuntil(b'\r\n')
+        parts = status_line.decode('latin-1').split(' ', 2)
+        status = int(parts[1])
+
+        headers = {}
+        while True:
+            line = await self.reader.readuntil(b'\r\n')
+            if line == b'\r\n':
+                break
+            name, _, value = line.decode('latin-1').partition(':')
+            headers[name.strip().lower()] = value.strip()
+
+        if headers.get('transfer-encoding', '').lower() == 'chunked':
+            body = bytearray()
+            while True:
+                size = int((await self.reader.readuntil(b'\r\n')).split(b';')[0], 16)
+                chunk = await self.reader.readexactly(size + 2)
+                if size == 0:
+                    break
+                body += chunk[:-2]
+        else:
+            body = await self.reader.readexactly(int(headers.get('content-length', '0')))
+
+        return status, bytes(body)
+
+
+def parse_address(address):
+    host, _, port = address.partition(':')
+    return host, int(port) if port else DEFAULT_PORT
+
+
+def decode_json(body):
+    try:
+        return json.loads(body.decode('utf-8'))
+    except (UnicodeDecodeError, ValueError):
+        return None
+
+
+async def provision_once(device, request_id, args):
+    host, port = parse_address(device['address'])
+    conn = await HttpConnection.open(host, port, args.timeout)
+    try:
+        body = {'id': request_id, 'ssid': device['ssid'], 'password': device['password']}
+        for field in SETTING_FIELDS:
+            if device.get(field) not in (None, ''):
+                value = device[field]
+                body[field] = value if field == 'profile' else int(value)
+
+        (list_status, list_body), (status, resp) = await conn.pipeline(host, [
+            ('GET', '/wl', None),
+            ('POST', '/wb', body),
+        ], args.connect_timeout)
+
+        rssi = None
+        if list_status == 200:
+            networks = decode_json(list_body) or []
+            rssi = max((n['rssi'] for n in networks if n.get('ssid') == device['ssid']), default=None)
+
+        via = '/wb'
+        if status == 404:
+            # 旧固件没有 /wb，只能提交凭据
+            via = '/wc'
+            (status, resp), = await conn.pipeline(host, [
+                ('POST', '/wc', {'ssid': device['ssid'], 'password': device['password']}),
+            ], args.connect_timeout)
+
+        if status >= 500:
+            raise TransportError('http %d' % status)
+
+        result = decode_json(resp)
+        if status != 200 or not isinstance(result, dict):
+            return {'result': 'error', 'error': 'http %d' % status, 'via': via, 'rssi': rssi}
+
+        return {'result': result.get('result', 'error'), 'error': result.get('error'),
+                'via': via, 'rssi': rssi}
+    finally:
+        conn.close()
+
+
+async def provision(device, args, limit):
+    # 同一台设备的所有重试使用相同的 id，设备对重复的请求直接返回已有结果
+    request_id = uuid.uuid4().hex
+    start = time.monotonic()
+    attempts = 0
+    report = {'address': device['address'], 'id': request_id}
+
+    async with limit:
+        while True:
+            attempts += 1
+            try:
+                report.update(await provision_once(device, request_id, args))
+                break
+            except TransportError as e:
+                report.update({'result': 'unreachable', 'error': str(e)})
+                if attempts > args.retries:
+                    break
+                delay = min(args.backoff * (2 ** (attempts - 1)), 30.0)
+                await asyncio.sleep(delay * random.uniform(0.5, 1.0))
+
+    report['attempts'] = attempts
+    report['elapsed_s'] = round(time.monotonic() - start, 3)
+    print('%-22s %-12s attempts=%d %.1fs%s' % (
+        report['address'], report['result'], attempts, report['elapsed_s'],
+        ' (%s)' % report['error'] if report.get('error') else ''), flush=True)
+    return report
+
+
+def load_devices(path, args):
+    with open(path, newline='', encoding='utf-8') as f:
+        rows = list(csv.DictReader(f))
+
+    devices = []
+    for row in rows:
+        if not row.get('address'):
+            continue
+        device = {
+            'address': row['address'].strip(),
+            'ssid': row.get('ssid') or args.ssid,
+            'password': row.get('password') if row.get('password') is not None else args.password,
+        }
+        for field in SETTING_FIELDS:
+            device[field] = row.get(field) or getattr(args, field)
+        if not device['ssid']:
+            raise SystemExit('%s: missing ssid' % device['address'])
+        devices.append(device)
+    return devices
+
+
+def write_report(path, reports):
+    if path.endswith('.csv'):
+        fields = ['address', 'id', 'result', 'error', 'via', 'rssi', 'attempts', 'elapsed_s']
+        with open(path, 'w', newline='', encoding='utf-8') as f:
+            writer = csv.DictWriter(f, fieldnames=fields, extrasaction='ignore')
+            writer.writeheader()
+            writer.writerows(reports)
+    else:
+        with open(path, 'w', encoding='utf-8') as f:
+            json.dump(reports, f, indent=2)
+
+
+async def run(devices, args):
+    limit = asyncio.Semaphore(args.concurrency)
+    reports = await asyncio.gather(*(provision(d, args, limit) for d in devices))
+
+    summary = {}
+    for r in reports:
+        summary[r['result']] = summary.get(r['result'], 0) + 1
+    print('\n%d devices: %s' % (len(reports), ', '.join('%s=%d' % kv for kv in sorted(summary.items()))))
+
+    if args.report:
+        write_report(args.report, reports)
+    return 0 if summary.get('ok', 0) == len(reports) else 1
+
+
+#
+# 模拟设备：实现 /wl、/wc 和 /wb，支持流水线请求，按 /wb 的 id 去重。
+# 用于在没有真实设备时验证重试、超时和结果报告。
+#
+
+class SimulatedDevice:
+    def __init__(self, networks, drop_rate, old_firmware):
+        self.networks = networks
+        self.drop_rate = drop_rate
+        self.old_firmware = old_firmware
+        self.results = {}
+        self.provisioned = 0
+
+    async def verify(self, ssid, password):
+        await asyncio.sleep(random.uniform(0.2, 1.0))
+        ok = self.networks.get(ssid) == password
+        if ok:
+            self.provisioned += 1
+        return 'ok' if ok else 'failed'
+
+    async def handle(self, method, path, body):
+        if method == 'GET' and path == '/wl':
+            return 200, [{'ssid': s, 'rssi': random.randint(-80, -40), 'auth_mode': 3} for s in self.networks]
+
+        if method == 'POST' and path == '/wc':
+            return 200, {'result': await self.verify(body.get('ssid'), body.get('password'))}
+
+        if method == 'POST' and path == '/wb' and not self.old_firmware:
+            request_id = body.get('id')
+            if not request_id:
+                return 200, {'id': '', 'result': 'error', 'error': 'invalid id'}
+            if request_id not in self.results:
+                self.results[request_id] = asyncio.ensure_future(self.verify(body.get('ssid'), body.get('password')))
+            return 200, {'id': request_id, 'result': await self.results[request_id]}
+
+        return 404, {'error': 'not found'}
+
+    async def serve(self, reader, writer):
+        conn = HttpConnection(reader, writer)
+        try:
+            while True:
+                try:
+                    request_line = await reader.readuntil(b'\r\n')
+                except asyncio.IncompleteReadError:
+                    break
+                method, path, _ = request_line.decode('latin-1').split(' ', 2)
+
+                length = 0
+                while True:
+                    line = await reader.readuntil(b'\r\n')
+                    if line == b'\r\n':
+                        break
+                    name, _, value = line.decode('latin-1').partition(':')
+                    if name.strip().lower() == 'content-length':
+                        length = int(value)
+                body = decode_json(await reader.readexactly(length)) if length else None
+
+                # 模拟热点信号差导致的连接中断
+                if random.random() < self.drop_rate:
+                    break
+
+                status, payload = await self.handle(method, path, body or {})
+                data = json.dumps(payload).encode()
+                writer.write(b'HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n' %
+                             (status, b'OK' if status == 200 else b'Not Found', len(data)) + data)
+                await writer.drain()
+        except (OSError, ValueError, asyncio.IncompleteReadError):
+            pass
+        finally:
+            conn.close()
+
+
+async def simulate(args):
+    networks = {args.ssid: args.password, 'neighbour': 'x' * 8}
+    devices = []
+    servers = []
+    sims = []
+
+    for i in range(args.simulate):
+        # 每 5 台设备中有一台是不支持 /wb 的旧固件
+        sim = SimulatedDevice(networks, args.sim_drop_rate, old_firmware=(i % 5 == 4))
+        server = await asyncio.start_server(sim.serve, '127.0.0.1', 0)
+        port = server.sockets[0].getsockname()[1]
+        sims.append(sim)
+        servers.append(server)
+
+        # 最后一台设备使用错误的密码
+        password = args.password if i != args.simulate - 1 else args.password + '-wrong'
+        device = {'address': '127.0.0.1:%d' % port, 'ssid': args.ssid, 'password': password}
+        for field in SETTING_FIELDS:
+            device[field] = getattr(args, field)
+        devices.append(device)
+
+    try:
+        await run(devices, args)
+    finally:
+        for server in servers:
+            server.close()
+
+    # 除最后一台外都应该配网成功，且支持 /wb 的设备最多只配网一次
+    errors = []
+    for i, (device, sim) in enumerate(zip(devices, sims)):
+        expected = 1 if i != len(devices) - 1 else 0
+        if sim.provisioned < expected:
+            errors.append('%s: not provisioned' % device['address'])
+        elif sim.provisioned > 1 and not sim.old_firmware:
+            errors.append('%s: provisioned %d times' % (device['address'], sim.provisioned))
+
+    for error in errors:
+        print(error)
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='provision many wifi_provisioning devices concurrently')
+    parser.add_argument('devices', nargs='?', help='CSV file with an address column')
+    parser.add_argument('--ssid', required=True)
+    parser.add_argument('--password', default='')
+    parser.add_argument('--profile', choices=['low_latency', 'balanced', 'low_power'])
+    parser.add_argument('--ap-grace-ms', dest='ap_grace_ms', type=int)
+    parser.add_argument('--listen-interval', dest='listen_interval', type=int)
+    parser.add_argument('--concurrency', type=int, default=8)
+    parser.add_argument('--retries', type=int, default=3)
+    parser.add_argument('--backoff', type=float, default=1.0, help='initial retry delay in seconds')
+    parser.add_argument('--timeout', type=float, default=5.0, help='TCP connect timeout in seconds')
+    parser.add_argument('--connect-timeout', dest='connect_timeout', type=float, default=45.0,
+                        help='time to wait for the device to verify the credentials')
+    parser.add_argument('--report', help='write per-device results to a .json or .csv file')
+    parser.add_argument('--simulate', type=int, default=0, help='provision N local simulated devices')
+    parser.add_argument('--sim-drop-rate', dest='sim_drop_rate', type=float, default=0.2)
+    args = parser.parse_args()
+
+    if args.simulate:
+        return asyncio.run(simulate(args))
+
+    if not args.devices:
+        parser.error('devices file is required unless --simulate is used')
+
+    return asyncio.run(run(load_devices(args.devices, args), args))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
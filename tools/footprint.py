@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+# 统计不同功能组合下固件的 flash/RAM 占用。
+#
+# 用法（在项目根目录执行，需要 PlatformIO）：
+#   python tools/footprint.py               # 默认 esp32-idf 环境
+#   python tools/footprint.py -e esp32-arduino
+#
+# 每个组合使用独立的构建目录（.pio/footprint/<名称>），再次运行时只增量编译。
+# 功能宏说明见 wifi_provisioning.hpp。
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+FEATURES = [
+    'WIFI_PROVISIONING_DNS',
+    'WIFI_PROVISIONING_CAPTIVE_PORTAL',
+    'WIFI_PROVISIONING_WEB_UI',
+    'WIFI_PROVISIONING_ASSETS',
+    'WIFI_PROVISIONING_TEST_ENDPOINT',
+    'WIFI_PROVISIONING_SCAN',
+    'WIFI_PROVISIONING_MDNS',
+]
+
+# 默认关闭的功能，单独统计打开后的占用
+OPTIONAL = [
+    'WIFI_PROVISIONING_TRACE',
+    'WIFI_PROVISIONING_OTA',
+]
+
+# (名称, 关闭的功能, 打开的可选功能)
+COMBINATIONS = [('full', [], [])]
+COMBINATIONS += [('no-' + f[len('WIFI_PROVISIONING_'):].lower(), [f], []) for f in FEATURES]
+COMBINATIONS += [('with-' + f[len('WIFI_PROVISIONING_'):].lower(), [], [f]) for f in OPTIONAL]
+COMBINATIONS += [
+    ('headless', ['WIFI_PROVISIONING_CAPTIVE_PORTAL', 'WIFI_PROVISIONING_WEB_UI',
+                  'WIFI_PROVISIONING_ASSETS', 'WIFI_PROVISIONING_TEST_ENDPOINT',
+                  'WIFI_PROVISIONING_SCAN'], []),
+    ('minimal', FEATURES, []),
+]
+
+SIZE_RE = re.compile(r'^(RAM|Flash):.*\(used (\d+) bytes from (\d+) bytes\)', re.M)
+
+
+def build(env, name, disabled, enabled):
+    flags = ' '.join(['-D%s=0' % f for f in disabled] + ['-D%s=1' % f for f in enabled])
+    environ = dict(os.environ)
+    environ['PLATFORMIO_BUILD_FLAGS'] = flags
+    environ['PLATFORMIO_BUILD_DIR'] = os.path.join('.pio', 'footprint', name)
+    # 统计所有组合，超出 tools/size_budget.py 的预算时不让构建失败
+    environ['SIZE_BUDGET_REPORT_ONLY'] = '1'
+
+    proc = subprocess.run(['pio', 'run', '-e', env], env=environ,
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if proc.returncode != 0:
+        sys.stdout.write(proc.stdout)
+        raise RuntimeError('build failed: %s' % name)
+
+    sizes = {kind: int(used) for kind, used, _ in SIZE_RE.findall(proc.stdout)}
+    if 'RAM' not in sizes or 'Flash' not in sizes:
+        raise RuntimeError('size report not found: %s' % name)
+    return sizes['Flash'], sizes['RAM']
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-e', '--environment', default='esp32-idf')
+    args = parser.parse_args()
+
+    results = []
+    for name, disabled, enabled in COMBINATIONS:
+        print('building %s ...' % name, flush=True)
+        results.append((name,) + build(args.environment, name, disabled, enabled))
+
+    _, base_flash, base_ram = results[0]
+    print()
+    print('%-24s %10s %10s %10s %10s' % ('combination', 'flash', 'delta', 'ram', 'delta'))
+    for name, flash, ram in results:
+        print('%-24s %10d %+10d %10d %+10d' % (name, flash, flash - base_flash, ram, ram - base_ram))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+# OTA 升级工具：把固件通过配置服务器的 POST /ota 流式上传到设备，输出进度和吞吐量。
+#
+# 固件的 SHA-256 通过 X-OTA-SHA256 请求头发送，设备边接收边计算，不一致时放弃升级；
+# --reboot 时设备在升级成功后重启。设备需要有两个 OTA 分区（例如 CONFIG_PARTITION_TABLE_TWO_OTA），
+# 固件以 -DWIFI_PROVISIONING_OTA=1 编译，并由应用通过 set_ota_authorizer 设置认证函数；
+# --auth 的值作为 Authorization 请求头发送给认证函数。
+#
+# 用法：
+#   python tools/ota_upload.py http://192.168.4.1 firmware.bin --auth "Bearer <token>"
+#   python tools/ota_upload.py http://192.168.4.1 .pio/build/esp32-idf/firmware.bin --reboot --auth "Bearer <token>"
+#
+# 不连接真实设备，启动本地模拟设备测量吞吐量。模拟设备按设备端的实现以 4096 字节为一块接收，
+# 每块按 --link-kbps 计入接收耗时，用按 --flash-kbps 限速的 esp_ota_write 替身写入，
+# 分别以单缓冲（接收和写入交替进行）和双缓冲（接收与写入重叠）运行：
+#   python tools/ota_upload.py --simulate --size 1048576 --link-kbps 500 --flash-kbps 300
+
+import argparse
+import hashlib
+import http.client
+import http.server
+import json
+import os
+import queue
+import sys
+import threading
+import time
+import urllib.parse
+
+BLOCK_SIZE = 4096
+
+
+def upload(url, image, reboot=False, auth=None, quiet=False):
+    """上传固件，返回 (设备返回的结果, 耗时秒数)。"""
+    parts = urllib.parse.urlsplit(url)
+    conn = http.client.HTTPConnection(parts.hostname, parts.port or 80, timeout=60)
+
+    headers = {
+        'Content-Type': 'application/octet-stream',
+        'Content-Length': str(len(image)),
+        'X-OTA-SHA256': hashlib.sha256(image).hexdigest(),
+    }
+    if reboot:
+        headers['X-OTA-Reboot'] = '1'
+    if auth:
+        headers['Authorization'] = auth
+
+    start = time.perf_counter()
+    conn.putrequest('POST', '/ota')
+    for k, v in headers.items():
+        conn.putheader(k, v)
+    conn.endheaders()
+
+    sent = 0
+    last_percent = -1
+    while sent < len(image):
+        chunk = image[sent:sent + BLOCK_SIZE]
+        conn.send(chunk)
+        sent += len(chunk)
+
+        percent = sent * 100 // len(image)
+        if not quiet and percent != last_percent and percent % 10 == 0:
+            last_percent = percent
+            print('已发送 %d/%d (%d%%)' % (sent, len(image), percent))
+
+    response = conn.getresponse()
+    body = response.read()
+    elapsed = time.perf_counter() - start
+    conn.close()
+
+    try:
+        return json.loads(body), elapsed
+    except ValueError:
+        return {'result': 'error', 'error': 'HTTP %d' % response.status}, elapsed
+
+
+class SimulatedFlash:
+    """esp_ota_write 的替身，按 flash_kbps 的速度“写入”，只计算哈希。"""
+
+    def __init__(self, flash_kbps):
+        self.flash_kbps = flash_kbps
+        self.sha = hashlib.sha256()
+        self.write_time = 0.0
+
+    def write(self, data):
+        start = time.perf_counter()
+        time.sleep(len(data) / 1024 / self.flash_kbps)
+        self.sha.update(data)
+        self.write_time += time.perf_counter() - start
+
+
+def make_handler(buffers, link_kbps, flash_kbps, results):
+    class OtaHandler(http.server.BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def log_message(self, *args):
+            pass
+
+        def do_POST(self):
+            if self.path != '/ota':
+                self.send_error(404)
+                return
+
+            total = int(self.headers.get('Content-Length', 0))
+            expected = self.headers.get('X-OTA-SHA256', '')
+            flash = SimulatedFlash(flash_kbps)
+
+            # 与设备端相同：空闲缓冲区和待写入缓冲区两个队列，写入线程对应 ota 任务
+            free = queue.Queue()
+            filled = queue.Queue()
+            for _ in range(buffers):
+                free.put(None)
+
+            def writer():
+                while True:
+                    data = filled.get()
+                    if data is None:
+                        return
+                    flash.write(data)
+                    free.put(None)
+
+            thread = threading.Thread(target=writer)
+            thread.start()
+
+            start = time.perf_counter()
+            stall = 0.0
+            received = 0
+            while received < total:
+                t = time.perf_counter()
+                free.get()
+                stall += time.perf_counter() - t
+
+                # 本机接收几乎不耗时，按链路速率补足一块的接收时间
+                t = time.perf_counter()
+                data = self.rfile.read(min(BLOCK_SIZE, total - received))
+                if not data:
+                    break
+                delay = t + len(data) / 1024 / link_kbps - time.perf_counter()
+                if delay > 0:
+                    time.sleep(delay)
+                received += len(data)
+                filled.put(data)
+
+            filled.put(None)
+            thread.join()
+            elapsed = time.perf_counter() - start
+
+            ok = received == total and (not expected or expected == flash.sha.hexdigest())
+            results.append({'elapsed': elapsed, 'write': flash.write_time, 'stall': stall})
+            if ok:
+                body = {'result': 'ok', 'size': received, 'sha256': flash.sha.hexdigest(),
+                        'kbps': int(received / 1024 / elapsed)}
+            else:
+                body = {'result': 'error', 'error': 'sha256 mismatch'}
+
+            data = json.dumps(body).encode()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(data)))
+            self.end_headers()
+            self.wfile.write(data)
+
+    return OtaHandler
+
+
+def simulate(args):
+    image = os.urandom(args.size)
+
+    print('固件 %d KB, 链路 %d KB/s, flash %d KB/s' % (args.size // 1024, args.link_kbps, args.flash_kbps))
+    for buffers, name in ((1, '单缓冲'), (2, '双缓冲')):
+        results = []
+        server = http.server.ThreadingHTTPServer(('127.0.0.1', 0),
+                                                 make_handler(buffers, args.link_kbps, args.flash_kbps, results))
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+
+        url = 'http://127.0.0.1:%d' % server.server_address[1]
+        result, elapsed = upload(url, image, quiet=True)
+        server.shutdown()
+
+        if result.get('result') != 'ok':
+            print('%s: 失败 %s' % (name, result))
+            return 1
+
+        r = results[0]
+        print('%s: %6.1f KB/s, 耗时 %.2f s, 写入 %.2f s, 等待写入 %.2f s' % (
+            name, args.size / 1024 / elapsed, elapsed, r['write'], r['stall']))
+
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='通过 POST /ota 升级设备固件')
+    parser.add_argument('url', nargs='?', help='设备地址，例如 http://192.168.4.1')
+    parser.add_argument('firmware', nargs='?', help='固件文件（.bin）')
+    parser.add_argument('--reboot', action='store_true', help='升级成功后重启设备')
+    parser.add_argument('--auth', help='Authorization 请求头的值，由设备的认证函数检查')
+    parser.add_argument('--simulate', action='store_true', help='使用本地模拟设备测量单缓冲和双缓冲的吞吐量')
+    parser.add_argument('--size', type=int, default=1024 * 1024, help='模拟的固件大小（默认 1 MB）')
+    parser.add_argument('--link-kbps', type=int, default=500, help='模拟的网络速率（默认 500 KB/s）')
+    parser.add_argument('--flash-kbps', type=int, default=300, help='模拟的 flash 写入速率（默认 300 KB/s）')
+    args = parser.parse_args()
+
+    if args.simulate:
+        return simulate(args)
+
+    if not args.url or not args.firmware:
+        parser.error('需要设备地址和固件文件')
+
+    with open(args.firmware, 'rb') as f:
+        image = f.read()
+
+    result, elapsed = upload(args.url, image, reboot=args.reboot, auth=args.auth)
+    print('结果: %s' % json.dumps(result, ensure_ascii=False))
+    print('耗时 %.2f s, %.1f KB/s' % (elapsed, len(image) / 1024 / elapsed))
+
+    return 0 if result.get('result') == 'ok' else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+# 将配置页面的静态文件打包为 wifi_provisioning 使用的资源包（webui 分区镜像）。
+#
+# 用法：
+#   python tools/pack_webui.py <网页目录> webui.bin
+#   esptool.py write_flash <webui 分区地址> webui.bin
+#
+# 格式说明见 wifi_provisioning.cpp 中的 asset_bundle_header。
+
+import gzip
+import mimetypes
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b'WPAB'
+VERSION = 1
+EMPTY_BUCKET = 0xFFFF
+FLAG_GZIP = 0x01
+
+HEADER_FORMAT = '<4sHHHHII'
+ENTRY_FORMAT = '<IIIIIHBB'
+
+COMPRESSIBLE = ('text/', 'application/javascript', 'application/json', 'image/svg+xml')
+
+
+def fnv1a(data):
+    h = 0x811c9dc5
+    for b in data:
+        h ^= b
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def align4(n):
+    return (n + 3) & ~3
+
+
+def collect(root):
+    files = []
+    for dirpath, _, names in os.walk(root):
+        for name in sorted(names):
+            full = os.path.join(dirpath, name)
+            path = '/' + os.path.relpath(full, root).replace(os.sep, '/')
+            mime = mimetypes.guess_type(name)[0] or 'application/octet-stream'
+            with open(full, 'rb') as f:
+                data = f.read()
+            flags = 0
+            if mime.startswith(COMPRESSIBLE):
+                packed = gzip.compress(data, 9, mtime=0)
+                if len(packed) < len(data):
+                    data, flags = packed, FLAG_GZIP
+            files.append((path.encode(), mime.encode(), data, flags))
+    return sorted(files)
+
+
+def pack(files):
+    if len(files) >= EMPTY_BUCKET:
+        raise ValueError('too many files')
+
+    # 负载因子不超过 0.5
+    bucket_count = 1
+    while bucket_count < len(files) * 2:
+        bucket_count *= 2
+
+    buckets = [EMPTY_BUCKET] * bucket_count
+    for index, (path, _, _, _) in enumerate(files):
+        b = fnv1a(path) & (bucket_count - 1)
+        while buckets[b] != EMPTY_BUCKET:
+            b = (b + 1) & (bucket_count - 1)
+        buckets[b] = index
+
+    header_size = struct.calcsize(HEADER_FORMAT)
+    entry_size = struct.calcsize(ENTRY_FORMAT)
+    entries_offset = align4(header_size + bucket_count * 2)
+    offset = entries_offset + len(files) * entry_size
+
+    strings = bytearray()
+    string_offsets = []
+    for path, mime, _, _ in files:
+        if len(path) > 0xFFFF or len(mime) > 0xFF:
+            raise ValueError('path or mime type too long: %s' % path.decode())
+        path_offset = offset + len(strings)
+        strings += path + b'\0'
+        mime_offset = offset + len(strings)
+        strings += mime + b'\0'
+        string_offsets.append((path_offset, mime_offset))
+    offset = align4(offset + len(strings))
+    strings += b'\0' * (offset - entries_offset - len(files) * entry_size - len(strings))
+
+    entries = bytearray()
+    blobs = bytearray()
+    for (path, mime, data, flags), (path_offset, mime_offset) in zip(files, string_offsets):
+        data_offset = offset + len(blobs)
+        entries += struct.pack(ENTRY_FORMAT, fnv1a(path), path_offset, mime_offset,
+                               data_offset, len(data), len(path), len(mime), flags)
+        blobs += data
+        blobs += b'\0' * (align4(len(blobs)) - len(blobs))
+
+    body = struct.pack('<%dH' % bucket_count, *buckets)
+    body += b'\0' * (entries_offset - header_size - len(body))
+    body += entries + strings + blobs
+
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(files), bucket_count, 0,
+                         header_size + len(body), zlib.crc32(body) & 0xFFFFFFFF)
+    return header + body
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('usage: %s <webui dir> <output.bin>' % sys.argv[0])
+        return 1
+
+    files = collect(sys.argv[1])
+    image = pack(files)
+    with open(sys.argv[2], 'wb') as f:
+        f.write(image)
+
+    for path, mime, data, flags in files:
+        print('%-40s %-28s %8d%s' % (path.decode(), mime.decode(), len(data),
+                                     ' (gzip)' if flags & FLAG_GZIP else ''))
+    print('%d files, %d bytes' % (len(files), len(image)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
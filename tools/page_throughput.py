@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+# 配置页面吞吐量测试：连接到设备热点后，并发地多次获取同一个 URL，输出吞吐量和延迟分布。
+#
+# 用于比较不同热点参数（信道、带宽、beacon 间隔）下配置页面的加载性能，例如先后以
+# -DAP_CHANNEL_BENCHMARK=1（固定信道 1）和 -DAP_CHANNEL_BENCHMARK=0（自动选择信道）编译
+# IDF 示例，在同一位置分别运行本工具。
+#
+# 用法：
+#   python tools/page_throughput.py http://192.168.4.1/webconfig
+#   python tools/page_throughput.py http://192.168.4.1/webconfig --requests 200 --concurrency 4
+
+import argparse
+import sys
+import threading
+import time
+import urllib.request
+
+
+def fetch(url, timeout):
+    start = time.perf_counter()
+    with urllib.request.urlopen(url, timeout=timeout) as response:
+        size = len(response.read())
+    return size, time.perf_counter() - start
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='测量配置页面的吞吐量和延迟')
+    parser.add_argument('url', help='要获取的 URL，例如 http://192.168.4.1/webconfig')
+    parser.add_argument('--requests', type=int, default=100, help='请求总数（默认 100）')
+    parser.add_argument('--concurrency', type=int, default=2, help='并发请求数（默认 2）')
+    parser.add_argument('--timeout', type=float, default=10.0, help='单个请求的超时秒数')
+    args = parser.parse_args()
+
+    lock = threading.Lock()
+    remaining = [args.requests]
+    latencies = []
+    failures = [0]
+    total_bytes = [0]
+
+    def worker():
+        while True:
+            with lock:
+                if remaining[0] == 0:
+                    return
+                remaining[0] -= 1
+            try:
+                size, elapsed = fetch(args.url, args.timeout)
+            except OSError as e:
+                with lock:
+                    failures[0] += 1
+                print('请求失败: %s' % e, file=sys.stderr)
+                continue
+            with lock:
+                latencies.append(elapsed)
+                total_bytes[0] += size
+
+    start = time.perf_counter()
+    threads = [threading.Thread(target=worker) for _ in range(max(1, args.concurrency))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.perf_counter() - start
+
+    print('请求: %d 成功, %d 失败, 耗时 %.2f s' % (len(latencies), failures[0], elapsed))
+    if latencies:
+        print('吞吐量: %.1f KB/s, %.1f 请求/s' % (total_bytes[0] / 1024 / elapsed, len(latencies) / elapsed))
+        print('延迟 p50/p95/max: %.0f/%.0f/%.0f ms' % (percentile(latencies, 50) * 1000,
+              percentile(latencies, 95) * 1000, max(latencies) * 1000))
+
+    return 0 if latencies else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# 构建后检查固件的静态 RAM 和 flash 占用，超出预算时让构建失败。
+#
+# PlatformIO 中作为 post 脚本自动运行（见 platformio.ini 的 extra_scripts），预算由环境的
+# custom_flash_budget 和 custom_ram_budget 指定（字节），未指定的一项不检查。
+# 使用 idf.py 构建时可以单独运行：
+#   python tools/size_budget.py build/esp32_wifi_provisioning.elf --flash 983040 --ram 65536
+#
+# 环境变量 SIZE_BUDGET_REPORT_ONLY=1 时只输出不失败，tools/footprint.py 用它统计超出预算的组合。
+#
+# 只有链接时确定的占用能在构建时检查；各配网阶段消耗的堆和任务栈只能在设备上测量，
+# 见 IDF 示例的 MEMORY_BUDGET_CHECK。
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+# 与 PlatformIO 的 espressif32 平台统计程序大小时使用的段一致
+FLASH_SECTIONS = ('.iram0.vectors', '.iram0.text', '.dram0.data',
+                  '.flash.appdesc', '.flash.rodata', '.flash.text')
+RAM_SECTIONS = ('.dram0.data', '.dram0.bss', '.noinit')
+
+SECTION_RE = re.compile(r'^(\.\S+)\s+(\d+)\s+\d+\s*$', re.M)
+
+
+def measure(size_tool, elf):
+    proc = subprocess.run([size_tool, '-A', '-d', elf],
+                          stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    if proc.returncode != 0:
+        raise RuntimeError(proc.stdout.strip())
+
+    sections = {name: int(size) for name, size in SECTION_RE.findall(proc.stdout)}
+    flash = sum(sections.get(name, 0) for name in FLASH_SECTIONS)
+    ram = sum(sections.get(name, 0) for name in RAM_SECTIONS)
+    return flash, ram
+
+
+def check(size_tool, elf, flash_budget, ram_budget):
+    flash, ram = measure(size_tool, elf)
+
+    ok = True
+    for kind, used, budget in (('flash', flash, flash_budget), ('ram', ram, ram_budget)):
+        if not budget:
+            continue
+        state = 'ok' if used <= budget else 'OVER BUDGET'
+        print('size budget: %-5s %8d / %8d bytes (%+d) %s' % (kind, used, budget, used - budget, state))
+        ok = ok and used <= budget
+
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('elf')
+    parser.add_argument('--flash', type=int, default=0, help='flash budget in bytes')
+    parser.add_argument('--ram', type=int, default=0, help='static RAM budget in bytes')
+    parser.add_argument('--size-tool', default='xtensa-esp32-elf-size')
+    args = parser.parse_args()
+
+    return 0 if check(args.size_tool, args.elf, args.flash, args.ram) else 1
+
+
+def pio_post_action(source, target, env):
+    def budget(option):
+        value = env.GetProjectOption(option, '')
+        return int(value) if value else 0
+
+    # 返回非 0 时 SCons 认为这一步失败，构建随之失败
+    ok = check(env.subst('$SIZETOOL'), str(target[0]),
+               budget('custom_flash_budget'), budget('custom_ram_budget'))
+    return 0 if ok or os.environ.get('SIZE_BUDGET_REPORT_ONLY') == '1' else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
+else:
+    Import('env')  # noqa: F821  PlatformIO 执行 extra_scripts 时提供
+    env.AddPostAction('$BUILD_DIR/${PROGNAME}.elf', pio_post_action)  # noqa: F821
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# 将 wifi_provisioning 的跟踪记录（/wt 接口返回的 JSON）转换为 Chrome trace 格式，
+# 可以在 chrome://tracing 或 https://ui.perfetto.dev 中按任务查看时间线。
+#
+# 用法：
+#   python tools/trace2chrome.py http://192.168.4.1/wt trace.json
+#   python tools/trace2chrome.py wt.json trace.json
+#
+# 固件需要使用 -DWIFI_PROVISIONING_TRACE=1 编译。
+
+import json
+import sys
+import urllib.request
+
+
+def load(source):
+    if source.startswith(('http://', 'https://')):
+        with urllib.request.urlopen(source, timeout=10) as resp:
+            return json.load(resp)
+    with open(source, encoding='utf-8') as f:
+        return json.load(f)
+
+
+def convert(records):
+    tids = {}
+    events = []
+
+    for r in records:
+        task = r['task'] or '?'
+        tid = tids.setdefault(task, len(tids) + 1)
+
+        event = {
+            'name': r['name'],
+            'ph': r['ph'],
+            'ts': r['ts'],
+            'pid': 1,
+            'tid': tid,
+        }
+        if r['ph'] == 'i':
+            event['s'] = 't'
+        if r['arg'] or r['ph'] != 'E':
+            event['args'] = {'arg': r['arg']}
+        events.append(event)
+
+    # 缓冲区写满后最旧的记录被覆盖，开头可能出现没有 'B' 的 'E'，这里丢弃
+    depth = {}
+    filtered = []
+    for e in events:
+        key = (e['tid'], e['name'])
+        if e['ph'] == 'B':
+            depth[key] = depth.get(key, 0) + 1
+        elif e['ph'] == 'E':
+            if not depth.get(key):
+                continue
+            depth[key] -= 1
+        filtered.append(e)
+
+    metadata = [{'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': {'name': 'esp32'}}]
+    metadata += [{'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': task}}
+                 for task, tid in tids.items()]
+
+    return {'traceEvents': metadata + filtered, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    if len(sys.argv) != 3:
+        print('usage: %s <url or file> <output.json>' % sys.argv[0])
+        return 1
+
+    trace = convert(load(sys.argv[1]))
+    with open(sys.argv[2], 'w', encoding='utf-8') as f:
+        json.dump(trace, f)
+
+    print('%d events' % (len(trace['traceEvents'])))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())